@@ -18,16 +18,24 @@ set "common_link_options= /incremental:no /opt:ref /subsystem:console libvcrunti
 set "compile_options=%common_compile_options% /Od /Zo /Z7 /RTC1 /MTd"
 set "link_options=%common_link_options% libucrtd.lib libvcruntimed.lib"
 
+if "%1"=="shadow" (
+	set "compile_options=%compile_options% /DSIM86_SHADOW=1"
+	shift
+)
+
 if "%1" neq "" goto invalid_arguments
 
 cl %compile_options% ..\src\disassemble.c /link %link_options% /pdb:disassemble.pdb /out:disassemble.exe
 cl %compile_options% ..\src\execute.c /link %link_options% /pdb:execute.pdb /out:execute.exe
 cl %compile_options% ..\src\estimate.c /link %link_options% /pdb:estimate.pdb /out:estimate.exe
+cl %compile_options% ..\src\render.c /link %link_options% /pdb:render.pdb /out:render.exe
+cl %compile_options% ..\src\diverge.c /link %link_options% /pdb:diverge.pdb /out:diverge.exe
+cl %compile_options% ..\src\advise.c /link %link_options% /pdb:advise.pdb /out:advise.exe
 
 goto end
 
 :invalid_arguments
-echo Invalid arguments^. Usage: build
+echo Invalid arguments^. Usage: build [shadow]
 goto end
 
 :end
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+cd "$(dirname "$0")"
+
+mkdir -p build
+cd build
+
+compile_options="-std=c11 -D_POSIX_C_SOURCE=200809L -pthread -O0 -g"
+
+if [ "$1" = "shadow" ]; then
+	compile_options="$compile_options -DSIM86_SHADOW=1"
+	shift
+fi
+
+if [ "$1" != "" ]; then
+	echo "Invalid arguments. Usage: build.sh [shadow]"
+	exit 1
+fi
+
+cc $compile_options ../src/disassemble.c -o disassemble || exit 1
+cc $compile_options ../src/execute.c -o execute || exit 1
+cc $compile_options ../src/estimate.c -o estimate || exit 1
+cc $compile_options ../src/render.c -o render || exit 1
+cc $compile_options ../src/diverge.c -o diverge || exit 1
+cc $compile_options ../src/advise.c -o advise || exit 1
@@ -0,0 +1,341 @@
+#include "sim86.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sim86_platform.h"
+#include "sim86_load.h"
+#include "sim86_timing.h"
+
+// NOTE: Peephole advisor
+//       The program is run once under a timing model, counting per instruction address how often it ran, how often
+//       it branched, the clocks its word transfers lost to odd addresses and whether its memory operand was always at
+//       the same address. The executed instructions are then decoded again and checked for patterns with a cheaper
+//       alternative, and the clocks each alternative would have saved in this run are the difference between the two
+//       forms in the timing model times the count:
+//         - word transfers at odd addresses, what aligning the data saves
+//         - memory operands in loops that stay at one address, the register form of the same instruction
+//         - add and sub of 1 or -1, inc and dec, which leave CF alone
+//         - addresses made of two registers, the address kept in bx, si or di instead
+//       An instruction is in a loop when it is between a direct jump back that was taken and its target. Findings
+//       for the same instruction are alternatives, their savings don't add up. The advice is only as good as the
+//       timing model, and it doesn't know whether a register is free or CF is needed.
+
+#define ADVISE_DEFAULT_TOP 20
+
+typedef struct Advise_Site
+{
+  u64 count;
+  u64 taken;
+  u64 odd_clocks; // NOTE: Penalty clocks above what the transfers would have cost at even addresses
+  u32 operand; // NOTE: Address of the memory operand the first time the instruction ran
+  u16 cs;
+  u16 ip;
+  bool operand_moves; // NOTE: The memory operand was somewhere else on a later run, like a pointer walking an array
+  bool in_loop;
+} Advise_Site;
+
+typedef enum Advise_Kind
+{
+  Advise_OddWords,
+  Advise_Register,
+  Advise_IncDec,
+  Advise_Address,
+} Advise_Kind;
+
+typedef struct Advise_Finding
+{
+  u64 saved;
+  u32 per_run; // NOTE: Clocks saved per execution, 0 when it varies
+  u32 site;
+  Advise_Kind kind;
+} Advise_Finding;
+
+typedef struct Advise_Findings
+{
+  Advise_Finding* findings;
+  u32 count;
+  u32 capacity;
+} Advise_Findings;
+
+void
+Advise__Add(Advise_Findings* list, Advise_Kind kind, u32 site, u64 saved, u32 per_run)
+{
+  if (list->count == list->capacity)
+  {
+    list->capacity = (list->capacity == 0 ? 256 : list->capacity*2);
+    list->findings = realloc(list->findings, list->capacity*sizeof(Advise_Finding));
+    ASSERT(list->findings != 0);
+  }
+
+  list->findings[list->count++] = (Advise_Finding){ .saved = saved, .per_run = per_run, .site = site, .kind = kind };
+}
+
+// NOTE: Most clocks saved first, then by address
+int
+Advise__CompareFindings(const void* a, const void* b)
+{
+  const Advise_Finding* x = a;
+  const Advise_Finding* y = b;
+
+  int result;
+  if      (x->saved != y->saved) result = (x->saved > y->saved ? -1 : 1);
+  else if (x->site != y->site)   result = (x->site < y->site ? -1 : 1);
+  else                           result = (int)x->kind - (int)y->kind;
+
+  return result;
+}
+
+Timing_Form
+Advise__Reshape(Timing_Form form, Instruction_Kind kind, Timing_Shape shape)
+{
+  return (Timing_Form){
+    .index = (u16)((kind*TIMING_SHAPE_COUNT + shape)*2 + form.index%2),
+    .ea    = (shape == TimingShape_Mem || shape == TimingShape_MemImm ? form.ea  : TimingEA_None),
+    .seg   = (shape == TimingShape_Mem || shape == TimingShape_MemImm ? form.seg : false),
+    .lock  = form.lock,
+  };
+}
+
+// NOTE: Clocks of a form that don't depend on the run, 0 when the model has no entry for it
+uint
+Advise__Clocks(Timing_Model* model, Timing_Form form)
+{
+  Instruction_Timing timing = Timing_Model_Lookup(model, form);
+  return (timing.base != 0 ? TotalClocks(InstructionClocks(timing, 0, false, 0)) : 0);
+}
+
+// NOTE: Marks everything between the targets of taken jumps back and the jumps as in a loop
+void
+Advise__FindLoops(Advise_Site* sites, Memory* memory, Run_Info* run)
+{
+  for (u32 i = 0; i < run->code_end - run->code_start; ++i)
+  {
+    Advise_Site* site = &sites[i];
+    if (site->taken == 0) continue;
+
+    u32 address             = run->code_start + i;
+    u32 cursor              = address;
+    Instruction instruction = DecodeInstruction(memory, &cursor);
+
+    u32 target;
+    if (instruction.kind != Instruction_Call && DirectBranchTarget(instruction, site->cs, site->ip, &target) &&
+        target >= run->code_start && target <= address)
+    {
+      for (u32 j = target - run->code_start; j <= i; ++j) sites[j].in_loop = true;
+    }
+  }
+}
+
+void
+Advise__Check(Advise_Findings* list, Timing_Model* model, Advise_Site* sites, u32 index, Instruction instruction)
+{
+  Advise_Site* site     = &sites[index];
+  Timing_Form form      = TimingFormOf(&instruction);
+  Timing_Shape shape    = (Timing_Shape)((form.index/2) % TIMING_SHAPE_COUNT);
+  Instruction_Kind kind = instruction.kind;
+
+  if (site->odd_clocks != 0) Advise__Add(list, Advise_OddWords, index, site->odd_clocks, 0);
+
+  // NOTE: lea doesn't touch memory, les and lds and far jumps and calls have no register form. An operand that moves
+  //       from run to run is a different variable each time, which a register can't stand in for.
+  Timing_Shape register_shape = TimingShape_None;
+  if      (kind == Instruction_Lea || kind == Instruction_Les || kind == Instruction_Lds || kind == Instruction_Esc) register_shape = TimingShape_None;
+  else if (kind == Instruction_CallFar || kind == Instruction_JmpFar)                                              register_shape = TimingShape_None;
+  else if (shape == TimingShape_Mem)                                                                               register_shape = TimingShape_RMReg;
+  else if (shape == TimingShape_RegMem || shape == TimingShape_MemReg || shape == TimingShape_AccMem)              register_shape = TimingShape_RegReg;
+  else if (shape == TimingShape_MemImm)                                                                            register_shape = TimingShape_RegImm;
+  else if (shape == TimingShape_MemCL)                                                                             register_shape = TimingShape_RegCL;
+
+  if (register_shape != TimingShape_None && site->in_loop && !site->operand_moves)
+  {
+    uint from = Advise__Clocks(model, form);
+    uint to   = Advise__Clocks(model, Advise__Reshape(form, kind, register_shape));
+    if (to != 0 && from > to) Advise__Add(list, Advise_Register, index, (from - to)*site->count + site->odd_clocks, (u32)(from - to));
+  }
+
+  bool w     = !!(instruction.flags & InstructionFlag_W);
+  u16 value  = (w ? instruction.data : (u8)instruction.data);
+  u16 minus1 = (w ? 0xFFFF : 0xFF);
+  if ((kind == Instruction_Add || kind == Instruction_Sub) && (value == 1 || value == minus1) &&
+      (shape == TimingShape_RegImm || shape == TimingShape_AccImm || shape == TimingShape_MemImm))
+  {
+    // NOTE: inc and dec of a word register have a one byte form of their own
+    Instruction_Kind replacement = ((kind == Instruction_Add) == (value == 1) ? Instruction_Inc : Instruction_Dec);
+    Timing_Shape inc_shape       = (shape == TimingShape_MemImm ? TimingShape_Mem : w ? TimingShape_Reg : TimingShape_RMReg);
+
+    uint from = Advise__Clocks(model, form);
+    uint to   = Advise__Clocks(model, Advise__Reshape(form, replacement, inc_shape));
+    if (to != 0 && from > to) Advise__Add(list, Advise_IncDec, index, (from - to)*site->count, (u32)(from - to));
+  }
+
+  if (form.ea >= TimingEA_Index && model->ea[form.ea] > model->ea[TimingEA_Base])
+  {
+    u32 per_run = model->ea[form.ea] - model->ea[TimingEA_Base];
+    Advise__Add(list, Advise_Address, index, per_run*site->count, per_run);
+  }
+}
+
+void
+Advise__Report(Advise_Findings* list, Advise_Site* sites, Memory* memory, Run_Info* run, u64 clocks, u32 top)
+{
+  qsort(list->findings, list->count, sizeof(Advise_Finding), Advise__CompareFindings);
+
+  u32 shown = MIN(list->count, top);
+  printf("\nFindings: %u, the top %u by clocks saved\n", list->count, shown);
+  if (shown != 0) printf("     Saved      Run      Count  Address    Instruction ; advice\n");
+
+  for (u32 i = 0; i < shown; ++i)
+  {
+    Advise_Finding* finding = &list->findings[i];
+    Advise_Site* site       = &sites[finding->site];
+
+    u32 cursor              = run->code_start + finding->site;
+    Instruction instruction = DecodeInstruction(memory, &cursor);
+
+    printf("%10llu %7.2f%% %10llu  %04x:%04x  ", (unsigned long long)finding->saved,
+           (clocks != 0 ? 100.0*(double)finding->saved/(double)clocks : 0.0), (unsigned long long)site->count, site->cs, site->ip);
+    PrintInstruction(instruction, site->ip, stdout);
+
+    char* plural = (finding->per_run == 1 ? "" : "s");
+
+    switch (finding->kind)
+    {
+      case Advise_OddWords: printf(" ; word transfers at odd addresses, align the data\n"); break;
+      case Advise_Register: printf(" ; memory operand in a loop, a register is %u clock%s less\n", finding->per_run, plural); break;
+      case Advise_IncDec:
+      {
+        bool inc = ((instruction.kind == Instruction_Add) == (instruction.data == 1));
+        printf(" ; %s is %u clock%s less if CF isn't needed\n", (inc ? "inc" : "dec"), finding->per_run, plural);
+      } break;
+      case Advise_Address:  printf(" ; two register address, keeping it in bx, si or di is %u clock%s less\n", finding->per_run, plural); break;
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  char* input_path          = 0;
+  char* model_name          = 0;
+  u32 top                   = ADVISE_DEFAULT_TOP;
+  Load_Options load_options = {0};
+
+  bool args_ok = true;
+  for (int i = 1; i < argc && args_ok; ++i)
+  {
+    if      (ParseLoadOption(argc, argv, &i, &load_options))  continue;
+    else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)   top = (u32)strtoul(argv[++i], 0, 0);
+    else if (argv[i][0] != '-' && input_path == 0)            input_path = argv[i];
+    else if (argv[i][0] != '-' && model_name == 0)            model_name = argv[i];
+    else                                                      args_ok = false;
+  }
+
+  if (!args_ok || input_path == 0 || model_name == 0)
+  {
+    fprintf(stderr, "Invalid arguments. Expected: advise [options] <input_binary> <model>\n"
+                    "  --format <flat|com|exe>      input format, detected from the MZ signature and .com extension by default\n"
+                    "  --load-segment <seg>         segment to load the input at\n"
+                    "  --top <n>                    print the <n> findings that save the most clocks (default %u)\n"
+                    "Runs the input and lists instructions with a cheaper alternative, by the clocks it would have saved.\n"
+                    "A model is 8086, 8088 or a timing model file, e.g. timing_v30.txt, see sim86_timing.h for the format.\n",
+                    ADVISE_DEFAULT_TOP);
+  }
+  else
+  {
+    Timing_Model* model = Platform_AllocateMemory(sizeof(Timing_Model));
+    ASSERT(model != 0);
+
+    u32 error_line;
+    CPU_State cpu_state = {0};
+    Run_Info run        = {0};
+    Memory* memory      = 0;
+
+    bool loaded = Timing_Model_Load(model, model_name, &error_line);
+    if      (loaded)          memory = LoadProgram(input_path, load_options, &cpu_state, &run);
+    else if (error_line != 0) fprintf(stderr, "Invalid timing model %s, line %u\n", model_name, error_line);
+    else                      fprintf(stderr, "Failed to read timing model %s\n", model_name);
+
+    Advise_Site* sites = 0;
+    if (memory != 0)
+    {
+      sites = calloc(run.code_end - run.code_start, sizeof(Advise_Site));
+      if (sites == 0) fprintf(stderr, "Failed to allocate the profile\n");
+    }
+
+    if (sites != 0)
+    {
+      Decode_Cache* decode_cache = Platform_AllocateMemory(sizeof(Decode_Cache));
+      ASSERT(decode_cache != 0);
+
+      u64 clocks = run.clocks;
+      while (IsExecutingImage(&cpu_state, &run))
+      {
+        u16 cs            = GetRegister(&cpu_state, Register_CS);
+        u32 ip            = cpu_state.ip;
+        u32 code_address  = InstructionAddress(&cpu_state);
+        Advise_Site* site = &sites[code_address - run.code_start];
+
+        Timing_Form form;
+        Instruction instruction   = Decode_Cache_Fetch(decode_cache, &cpu_state, &form);
+        Instruction_Timing timing = Timing_Model_Lookup(model, form);
+
+        u32 address = 0;
+        if (timing.transfers != 0 || timing.count_transfers != 0) address = TransferAddress(&cpu_state, instruction);
+
+        bool has_operand = (HasEffectiveAddress(instruction) || instruction.operand_format == InstructionOperandFormat_AccMem);
+        u32 operand      = (has_operand ? TransferAddress(&cpu_state, instruction) : 0);
+
+        u32 count = 0;
+        u16 cx    = GetRegister(&cpu_state, Register_CX);
+        if (timing.per_count != 0) count = OperandCount(&cpu_state, instruction, timing);
+
+        bool branch_taken = ExecuteInstruction(&cpu_state, instruction);
+        run.instruction_count += 1;
+
+        if (timing.per_count != 0) count += RepeatCount(instruction, cx, GetRegister(&cpu_state, Register_CX));
+
+        Clocks step = InstructionClocks(timing, address, branch_taken, count);
+        clocks     += TotalClocks(step);
+
+        if      (site->count == 0)         site->operand = operand;
+        else if (site->operand != operand) site->operand_moves = true;
+
+        site->count += 1;
+        site->taken += branch_taken;
+        site->cs     = cs;
+        site->ip     = (u16)ip;
+        if (timing.word && address%2 != 0)
+        {
+          site->odd_clocks += (uint)(timing.odd_penalty - timing.even_penalty)*(timing.transfers + count*timing.count_transfers);
+        }
+
+        if (instruction.kind == Instruction_Hlt) break;
+      }
+
+      Platform_FreeMemory(decode_cache, sizeof(Decode_Cache));
+
+      printf("Clocks (%s): %llu\n", model->name, (unsigned long long)clocks);
+      printf("Instructions: %llu\n", (unsigned long long)run.instruction_count);
+
+      Advise__FindLoops(sites, memory, &run);
+
+      Advise_Findings findings = {0};
+      for (u32 i = 0; i < run.code_end - run.code_start; ++i)
+      {
+        if (sites[i].count == 0) continue;
+
+        u32 cursor = run.code_start + i;
+        Advise__Check(&findings, model, sites, i, DecodeInstruction(memory, &cursor));
+      }
+
+      Advise__Report(&findings, sites, memory, &run, clocks - run.clocks, top);
+
+      free(findings.findings);
+      free(sites);
+    }
+
+    Platform_FreeMemory(model, sizeof(Timing_Model));
+  }
+}
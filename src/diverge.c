@@ -0,0 +1,519 @@
+#include "sim86.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sim86_platform.h"
+#include "sim86_checkpoint.h"
+#include "sim86_load.h"
+#include "sim86_trace.h"
+
+// NOTE: Divergence search
+//       Two runs are stepped in lockstep. Every interval instructions their architectural state is compared: the
+//       registers, flags, ip, whether the run is still going, and a hash of memory kept up to date from the writes
+//       each step makes. While the runs agree, each takes a checkpoint, which only has to copy the pages written
+//       since the previous one. Once they disagree, both checkpoints are restored and the interval is replayed a step
+//       at a time, comparing after every step, to find the first step that made them disagree. Bisecting it instead
+//       would assume runs that differ once stay apart, and a flag or a scratch byte that is overwritten soon after
+//       makes them agree again. For the same reason a divergence that is gone again by the end of an interval isn't
+//       seen at all, --interval 1 compares after every step. Whatever already differs before the first instruction,
+//       like the bytes of an edited instruction or a register set up differently, is listed once and left out of
+//       the comparison.
+
+#define DIVERGE_DEFAULT_INTERVAL 4096
+#define DIVERGE_DEFAULT_CONTEXT  8
+#define DIVERGE_MEMORY_REPORT    8 // NOTE: Differing bytes listed
+
+// NOTE: What is compared, registers has one bit per Register_Kind, then one for the flags and one for ip
+typedef struct Diverge_Compare
+{
+  u32 registers;
+  bool memory;
+  u8* ignored_bytes; // NOTE: One bit per address left out of the memory hash
+} Diverge_Compare;
+
+#define DIVERGE_COMPARE_FLAGS (1 << REGISTER_COUNT)
+#define DIVERGE_COMPARE_IP    (1 << (REGISTER_COUNT + 1))
+
+typedef struct Diverge_Run
+{
+  char* path;
+  CPU_State state;
+  Run_Info run;
+  bool running;
+  u64 memory_hash;
+  u8* ignored_bytes;
+
+  Memory_Access_Log access_log;
+
+  // NOTE: Checkpoint, changed_pages has one bit per page written since it was taken
+  CPU_State saved_state;
+  Run_Info saved_run;
+  bool saved_running;
+  u64 saved_hash;
+  u8* saved_memory;
+  u64 changed_pages[MEMORY_PAGE_COUNT/64];
+} Diverge_Run;
+
+// NOTE: Zero bytes and ignored bytes hash to 0, so only the bytes that are set need to be visited when hashing all
+//       of memory
+u64
+Diverge__ByteHash(Diverge_Run* run, u32 address, u8 value)
+{
+  u64 x = (((u64)address << 8) | value) * 0x9E3779B97F4A7C15ull;
+  x ^= x >> 31;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 29;
+
+  bool ignored = (run->ignored_bytes[address/8] >> (address%8)) & 1;
+
+  return (value != 0 && !ignored ? x : 0);
+}
+
+void
+Diverge__HashMemory(Diverge_Run* run, u8* ignored_bytes)
+{
+  run->ignored_bytes = ignored_bytes;
+  run->memory_hash   = 0;
+
+  u8* mem    = run->state.memory->mem;
+  u64* words = (u64*)mem;
+  for (u32 i = 0; i < MEMORY_SIZE/sizeof(u64); ++i)
+  {
+    if (words[i] != 0)
+    {
+      for (u32 j = i*8; j < i*8 + 8; ++j) run->memory_hash += Diverge__ByteHash(run, j, mem[j]);
+    }
+  }
+
+  run->saved_hash = run->memory_hash;
+}
+
+bool
+Diverge__Open(Diverge_Run* run, char* path, Load_Options load_options)
+{
+  *run = (Diverge_Run){ .path = path };
+
+  // NOTE: Either side can be a checkpoint, which is how two runs start from different states of the same program
+  Memory* memory = LoadCheckpoint(path, &run->state, &run->run);
+  if (memory == 0) memory = LoadProgram(path, load_options, &run->state, &run->run);
+
+  run->saved_memory = malloc(MEMORY_SIZE);
+
+  bool result = (memory != 0 && run->saved_memory != 0);
+  if (result)
+  {
+    memory->access_log = &run->access_log;
+
+    run->running = true;
+
+    // NOTE: The memory hash is set up once both runs are open and it is known which bytes to leave out
+    memcpy(run->saved_memory, memory->mem, MEMORY_SIZE);
+    run->saved_state   = run->state;
+    run->saved_run     = run->run;
+    run->saved_running = run->running;
+  }
+
+  return result;
+}
+
+void
+Diverge__Save(Diverge_Run* run)
+{
+  for (u32 page = 0; page < MEMORY_PAGE_COUNT; ++page)
+  {
+    if (run->changed_pages[page/64] & (1ull << (page%64)))
+    {
+      memcpy(run->saved_memory + page*MEMORY_PAGE_SIZE, run->state.memory->mem + page*MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+    }
+  }
+
+  memset(run->changed_pages, 0, sizeof(run->changed_pages));
+
+  run->saved_state   = run->state;
+  run->saved_run     = run->run;
+  run->saved_running = run->running;
+  run->saved_hash    = run->memory_hash;
+}
+
+void
+Diverge__Restore(Diverge_Run* run)
+{
+  for (u32 page = 0; page < MEMORY_PAGE_COUNT; ++page)
+  {
+    if (run->changed_pages[page/64] & (1ull << (page%64)))
+    {
+      memcpy(run->state.memory->mem + page*MEMORY_PAGE_SIZE, run->saved_memory + page*MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+    }
+  }
+
+  memset(run->changed_pages, 0, sizeof(run->changed_pages));
+
+  run->state       = run->saved_state;
+  run->run         = run->saved_run;
+  run->running     = run->saved_running;
+  run->memory_hash = run->saved_hash;
+}
+
+// NOTE: Executes one instruction, if the run has not stopped. prev_state is left as the state before it.
+bool
+Diverge__Step(Diverge_Run* run, Instruction* instruction, CPU_State* prev_state)
+{
+  *prev_state = run->state;
+
+  if (run->running && !IsExecutingImage(&run->state, &run->run)) run->running = false;
+
+  if (run->running)
+  {
+    Memory* memory         = run->state.memory;
+    Memory_Access_Log* log = &run->access_log;
+
+    *instruction = FetchInstruction(&run->state);
+    log->count = 0;
+    ExecuteInstruction(&run->state, *instruction);
+    run->run.instruction_count += 1;
+
+    for (u32 i = 0; i < log->count; ++i)
+    {
+      Memory_Access* access = &log->accesses[i];
+      if (!access->is_write) continue;
+
+      for (u32 j = 0; j < access->size; ++j)
+      {
+        u32 address = (access->address + j) & MEMORY_MASK;
+
+        // NOTE: Only the first write to a byte in this step holds the value it had before the step
+        bool first_write = true;
+        for (u32 k = 0; k < i && first_write; ++k)
+        {
+          Memory_Access* earlier = &log->accesses[k];
+          first_write = !(earlier->is_write && ((address - earlier->address) & MEMORY_MASK) < earlier->size);
+        }
+
+        if (first_write)
+        {
+          run->memory_hash += Diverge__ByteHash(run, address, memory->mem[address]) - Diverge__ByteHash(run, address, access->old_bytes[j]);
+          run->changed_pages[address >> (MEMORY_PAGE_SHIFT + 6)] |= 1ull << ((address >> MEMORY_PAGE_SHIFT) % 64);
+        }
+      }
+    }
+
+    if (instruction->kind == Instruction_Hlt) run->running = false;
+
+    return true;
+  }
+
+  return false;
+}
+
+void
+Diverge__Advance(Diverge_Run* a, Diverge_Run* b, u64 steps)
+{
+  Instruction instruction;
+  CPU_State prev_state;
+
+  for (u64 i = 0; i < steps; ++i)
+  {
+    Diverge__Step(a, &instruction, &prev_state);
+    Diverge__Step(b, &instruction, &prev_state);
+  }
+}
+
+// NOTE: Returns the bits of registers, as in Diverge_Compare, that differ
+u32
+Diverge__DifferingRegisters(Diverge_Run* a, Diverge_Run* b, u32 registers)
+{
+  u32 result = 0;
+
+  for (u32 i = Register_AX; i < REGISTER_COUNT; ++i)
+  {
+    if (a->state.register_file[i] != b->state.register_file[i]) result |= 1 << i;
+  }
+
+  if (a->state.flags != b->state.flags) result |= DIVERGE_COMPARE_FLAGS;
+  if (a->state.ip != b->state.ip)       result |= DIVERGE_COMPARE_IP;
+
+  return (result & registers);
+}
+
+bool
+Diverge__SameState(Diverge_Run* a, Diverge_Run* b, Diverge_Compare* compare)
+{
+  return (Diverge__DifferingRegisters(a, b, compare->registers) == 0 && a->running == b->running &&
+          (!compare->memory || a->memory_hash == b->memory_hash));
+}
+
+void
+Diverge__WriteFlags(Writer* writer, CPU_State* state)
+{
+  if (state->flags == 0) Writer_Char(writer, '-');
+  for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(state, i)) Writer_Char(writer, FlagNames[i]);
+}
+
+// NOTE: Lists the bytes that differ and are not ignored, marking them ignored when ignore is set
+void
+Diverge__WriteMemoryDifferences(Writer* writer, Diverge_Run* a, Diverge_Run* b, u8* ignored_bytes, bool ignore)
+{
+  u8* mem_a = a->state.memory->mem;
+  u8* mem_b = b->state.memory->mem;
+
+  u32 count = 0;
+  for (u32 address = 0; address < MEMORY_SIZE; ++address)
+  {
+    if (mem_a[address] != mem_b[address] && !((ignored_bytes[address/8] >> (address%8)) & 1))
+    {
+      if (ignore) ignored_bytes[address/8] |= (u8)(1 << (address%8));
+
+      if (count < DIVERGE_MEMORY_REPORT)
+      {
+        Writer_Reserve(writer, WRITER_LINE_MAX);
+        Writer_String(writer, "  [0x");
+        Writer_Hex(writer, address, 5);
+        Writer_String(writer, "]: a 0x");
+        Writer_Hex(writer, mem_a[address], 2);
+        Writer_String(writer, ", b 0x");
+        Writer_Hex(writer, mem_b[address], 2);
+        Writer_Char(writer, '\n');
+      }
+
+      count += 1;
+    }
+  }
+
+  Writer_Reserve(writer, WRITER_LINE_MAX);
+  Writer_String(writer, "  ");
+  Writer_Unsigned(writer, count);
+  Writer_String(writer, " bytes of memory differ\n");
+}
+
+void
+Diverge__WriteDifferences(Writer* writer, Diverge_Run* a, Diverge_Run* b, Diverge_Compare* compare)
+{
+  u32 registers = Diverge__DifferingRegisters(a, b, compare->registers);
+
+  for (u32 i = Register_AX; i < REGISTER_COUNT; ++i)
+  {
+    if (registers & (1 << i))
+    {
+      Writer_Reserve(writer, WRITER_LINE_MAX);
+      Writer_String(writer, "  ");
+      Writer_String(writer, RegisterNames[i]);
+      Writer_String(writer, ": a 0x");
+      Writer_Hex(writer, a->state.register_file[i], 4);
+      Writer_String(writer, ", b 0x");
+      Writer_Hex(writer, b->state.register_file[i], 4);
+      Writer_Char(writer, '\n');
+    }
+  }
+
+  Writer_Reserve(writer, WRITER_LINE_MAX);
+  if (registers & DIVERGE_COMPARE_IP)
+  {
+    Writer_String(writer, "  ip: a 0x");
+    Writer_Hex(writer, a->state.ip, 4);
+    Writer_String(writer, ", b 0x");
+    Writer_Hex(writer, b->state.ip, 4);
+    Writer_Char(writer, '\n');
+  }
+
+  if (registers & DIVERGE_COMPARE_FLAGS)
+  {
+    Writer_String(writer, "  flags: a ");
+    Diverge__WriteFlags(writer, &a->state);
+    Writer_String(writer, ", b ");
+    Diverge__WriteFlags(writer, &b->state);
+    Writer_Char(writer, '\n');
+  }
+
+  if (a->running != b->running)
+  {
+    Writer_String(writer, "  stopped: ");
+    Writer_String(writer, (a->running ? "b" : "a"));
+    Writer_Char(writer, '\n');
+  }
+
+  if (compare->memory && a->memory_hash != b->memory_hash) Diverge__WriteMemoryDifferences(writer, a, b, compare->ignored_bytes, false);
+}
+
+void
+Diverge__WriteStep(Writer* writer, char* prefix, bool executed, Instruction instruction, CPU_State* prev_state, CPU_State* state)
+{
+  Writer_Reserve(writer, WRITER_LINE_MAX);
+  Writer_String(writer, prefix);
+
+  if (executed) WriteExecuteStep(writer, instruction, prev_state, state);
+  else          Writer_String(writer, "(stopped)\n");
+}
+
+int
+main(int argc, char** argv)
+{
+  char* paths[2]      = {0};
+  u32 path_count      = 0;
+  u64 interval        = DIVERGE_DEFAULT_INTERVAL;
+  u64 context         = DIVERGE_DEFAULT_CONTEXT;
+  u64 max_steps       = ~(u64)0;
+  bool compare_memory = true;
+  Load_Options load_options = {0};
+
+  bool args_ok = true;
+  for (int i = 1; i < argc && args_ok; ++i)
+  {
+    if      (ParseLoadOption(argc, argv, &i, &load_options))                   continue;
+    else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)         interval = strtoull(argv[++i], 0, 0);
+    else if (strcmp(argv[i], "--context") == 0 && i + 1 < argc)          context = strtoull(argv[++i], 0, 0);
+    else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) max_steps = strtoull(argv[++i], 0, 0);
+    else if (strcmp(argv[i], "--no-memory") == 0)                        compare_memory = false;
+    else if (argv[i][0] != '-' && path_count < 2)                        paths[path_count++] = argv[i];
+    else                                                                 args_ok = false;
+  }
+
+  if (!args_ok || path_count != 2 || interval == 0)
+  {
+    fprintf(stderr, "Invalid arguments. Expected: diverge [options] <a> <b>\n"
+                    "  --interval <n>               instructions between state comparisons (default 4096), runs that\n"
+                    "                               differ and agree again within an interval aren't told apart\n"
+                    "  --context <n>                instructions to print on either side of the divergence (default 8)\n"
+                    "  --max-instructions <n>       give up after <n> instructions\n"
+                    "  --no-memory                  only compare registers, flags and ip\n"
+                    "  --format <flat|com|exe>      input format, detected from the MZ signature and .com extension by default\n"
+                    "  --load-segment <seg>         segment to load the inputs at\n"
+                    "<a> and <b> are input binaries or checkpoints, and are run side by side until their state differs.\n"
+                    "Registers and memory that differ before the first instruction are left out of the comparison.\n"
+                    "Instructions are counted from where the inputs start, also for checkpoints.\n");
+  }
+  else
+  {
+    Diverge_Run* a    = malloc(sizeof(Diverge_Run));
+    Diverge_Run* b    = malloc(sizeof(Diverge_Run));
+    char* buffer      = malloc(WRITER_DEFAULT_CAPACITY);
+    u8* ignored_bytes = calloc(1, MEMORY_SIZE/8);
+
+    if      (a == 0 || b == 0 || buffer == 0 || ignored_bytes == 0) fprintf(stderr, "Failed to allocate memory\n");
+    else if (!Diverge__Open(a, paths[0], load_options))            fprintf(stderr, "Failed to load %s\n", paths[0]);
+    else if (!Diverge__Open(b, paths[1], load_options))            fprintf(stderr, "Failed to load %s\n", paths[1]);
+    else
+    {
+      Writer writer;
+      Writer_Init(&writer, stdout, buffer, WRITER_DEFAULT_CAPACITY);
+
+      // NOTE: good is the last step count both runs agreed after, and where the checkpoints are
+      u64 good = 0;
+      u64 bad  = 0;
+
+      u64 start_count = a->run.instruction_count;
+
+      // NOTE: Start out comparing everything, then leave out what differs already
+      Diverge_Compare compare = {
+        .registers     = ((1 << REGISTER_COUNT) - 1) | DIVERGE_COMPARE_FLAGS | DIVERGE_COMPARE_IP,
+        .memory        = compare_memory,
+        .ignored_bytes = ignored_bytes,
+      };
+
+      u32 initial_registers = Diverge__DifferingRegisters(a, b, compare.registers);
+      bool initial_memory   = (compare.memory && memcmp(a->state.memory->mem, b->state.memory->mem, MEMORY_SIZE) != 0);
+      if (initial_registers != 0 || initial_memory)
+      {
+        Writer_Reserve(&writer, WRITER_LINE_MAX);
+        Writer_String(&writer, "Left out of the comparison, as the runs differ in them from the start:\n");
+
+        compare.memory = false;
+        Diverge__WriteDifferences(&writer, a, b, &compare);
+        if (initial_memory) Diverge__WriteMemoryDifferences(&writer, a, b, ignored_bytes, true);
+        Writer_Char(&writer, '\n');
+
+        compare.registers &= ~initial_registers;
+        compare.memory     = compare_memory;
+      }
+
+      Diverge__HashMemory(a, ignored_bytes);
+      Diverge__HashMemory(b, ignored_bytes);
+
+      bool diverged = false;
+      while (!diverged && (a->running || b->running) && good < max_steps)
+      {
+        u64 steps = MIN(interval, max_steps - good);
+        Diverge__Advance(a, b, steps);
+
+        if (Diverge__SameState(a, b, &compare))
+        {
+          good += steps;
+          Diverge__Save(a);
+          Diverge__Save(b);
+        }
+        else
+        {
+          bad      = good + steps;
+          diverged = true;
+        }
+      }
+
+      if (!diverged)
+      {
+        // NOTE: Both runs stop on the same step when they agree, so a's count is b's too
+        Writer_Reserve(&writer, WRITER_LINE_MAX);
+        Writer_String(&writer, "No divergence in ");
+        Writer_Unsigned(&writer, a->run.instruction_count - start_count);
+        Writer_String(&writer, " instructions\n");
+      }
+      else
+      {
+        // NOTE: The runs agree after every step before hi and disagree after hi, the replay ends by bad at the latest
+        Diverge__Restore(a);
+        Diverge__Restore(b);
+
+        u64 hi = good;
+        do
+        {
+          Diverge__Advance(a, b, 1);
+          hi += 1;
+        }
+        while (hi < bad && Diverge__SameState(a, b, &compare));
+
+        Diverge__Restore(a);
+        Diverge__Restore(b);
+
+        Writer_Reserve(&writer, WRITER_LINE_MAX);
+        Writer_String(&writer, "Runs diverge at instruction ");
+        Writer_Unsigned(&writer, hi - 1);
+        Writer_String(&writer, "\n\n");
+
+        // NOTE: The context can't reach back past the checkpoint
+        u64 first = MAX(good, hi - 1 - MIN(hi - 1, context));
+        Diverge__Advance(a, b, first - good);
+
+        for (u64 index = first; index < hi + context && (a->running || b->running); ++index)
+        {
+          Instruction instruction_a, instruction_b;
+          CPU_State prev_a, prev_b;
+          bool executed_a = Diverge__Step(a, &instruction_a, &prev_a);
+          bool executed_b = Diverge__Step(b, &instruction_b, &prev_b);
+
+          char prefix[64];
+          snprintf(prefix, sizeof(prefix), "%s%10llu a: ", (index == hi - 1 ? ">" : " "), (unsigned long long)index);
+          Diverge__WriteStep(&writer, prefix, executed_a, instruction_a, &prev_a, &a->state);
+          Diverge__WriteStep(&writer, "            b: ", executed_b, instruction_b, &prev_b, &b->state);
+        }
+
+        Diverge__Restore(a);
+        Diverge__Restore(b);
+        Diverge__Advance(a, b, hi - good);
+
+        Writer_Reserve(&writer, WRITER_LINE_MAX);
+        Writer_String(&writer, "\nDifferences after instruction ");
+        Writer_Unsigned(&writer, hi - 1);
+        Writer_String(&writer, ":\n");
+
+        Diverge__WriteDifferences(&writer, a, b, &compare);
+      }
+
+      Writer_Flush(&writer);
+    }
+
+    free(ignored_bytes);
+    free(buffer);
+    free(b);
+    free(a);
+  }
+}
@@ -4,218 +4,431 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "sim86_platform.h"
+#include "sim86_checkpoint.h"
+#include "sim86_load.h"
+#include "sim86_heatmap.h"
+#include "sim86_trace.h"
+#include "sim86_filter.h"
+#include "sim86_pipeline.h"
+#include "sim86_timeline.h"
+#include "sim86_timing.h"
+#include "sim86_biu.h"
+#include "sim86_machine.h"
+#include "sim86_static.h"
+#include "sim86_profile.h"
+#include "sim86_callgraph.h"
+
+typedef struct Estimate_Model
+{
+  Timing_Model* timing;
+  Biu biu;
+  Machine machine;
+} Estimate_Model;
+
+// NOTE: Splits the comma separated model list in place, returns the number of models or 0 when there are too many
+u32
+ParseModels(char* list, char** names)
+{
+  u32 count = 0;
+  bool ok   = true;
+  for (char* name = strtok(list, ","); name != 0 && ok; name = strtok(0, ","))
+  {
+    ok = (count < ESTIMATE_MODEL_MAX);
+    if (ok) names[count++] = name;
+  }
+
+  return (ok ? count : 0);
+}
+
+// NOTE: Loads the timing model of every name, the names become the ones the models give themselves
+bool
+LoadModels(Estimate_Model* models, Timing_Model* timing_models, u32 model_count, char** names)
+{
+  bool result = true;
+  for (u32 i = 0; i < model_count && result; ++i)
+  {
+    u32 error_line;
+    result = Timing_Model_Load(&timing_models[i], names[i], &error_line);
+
+    if      (result)          models[i].timing = &timing_models[i], names[i] = timing_models[i].name;
+    else if (error_line != 0) fprintf(stderr, "Invalid timing model %s, line %u\n", names[i], error_line);
+    else                      fprintf(stderr, "Failed to read timing model %s\n", names[i]);
+  }
+
+  return result;
+}
+
 int
 main(int argc, char** argv)
 {
-  if (argc != 3) fprintf(stderr, "Invalid number of arguments. Expected: estimate <input_binary> <8086|8088>\n");
-  else if (strcmp(argv[2], "8086") != 0 && strcmp(argv[2], "8088") != 0) fprintf(stderr, "Invalid second argument, expected 8086 or 8088, not '%s'.", argv[2]);
+  char* input_path   = 0;
+  char* model        = 0;
+  char* restore_path = 0;
+  char* heatmap_path = 0;
+  char* trace_path   = 0;
+  char* listing_path = 0;
+  char* graph_path   = 0;
+  bool headless      = false;
+  bool biu_model     = false;
+  bool static_blocks = false;
+  u32 format_threads = 0;
+  u32 profile_top    = 0;
+  Checkpoint_Trigger checkpoint     = {0};
+  Load_Options load_options         = {0};
+  Trace_Filter filter               = {0};
+  Timeline_Options timeline_options = {0};
+  Machine_Options machine_options   = {0};
+  char* model_names[ESTIMATE_MODEL_MAX];
+  u32 model_count = 0;
+  char* positionals[2];
+  int positional_count = 0;
+
+  bool args_ok = true;
+  for (int i = 1; i < argc && args_ok; ++i)
+  {
+    if      (ParseCheckpointOption(argc, argv, &i, &checkpoint, &restore_path)) continue;
+    else if (ParseLoadOption(argc, argv, &i, &load_options))                    continue;
+    else if (ParseFilterOption(argc, argv, &i, &filter))                        continue;
+    else if (ParseTimelineOption(argc, argv, &i, &timeline_options))            continue;
+    else if (ParseMachineOption(argc, argv, &i, &machine_options))              continue;
+    else if (strcmp(argv[i], "--headless") == 0)                                headless = true;
+    else if (strcmp(argv[i], "--biu") == 0)                                     biu_model = true;
+    else if (strcmp(argv[i], "--static") == 0)                                  static_blocks = true;
+    else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc)                 heatmap_path = argv[++i];
+    else if (strcmp(argv[i], "--binary-trace") == 0 && i + 1 < argc)            trace_path = argv[++i];
+    else if (strcmp(argv[i], "--trace-threads") == 0 && i + 1 < argc)           format_threads = (u32)strtoul(argv[++i], 0, 0);
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)                 profile_top = (u32)strtoul(argv[++i], 0, 0);
+    else if (strcmp(argv[i], "--listing") == 0 && i + 1 < argc)                 listing_path = argv[++i];
+    else if (strcmp(argv[i], "--call-graph") == 0 && i + 1 < argc)              graph_path = argv[++i];
+    else if (argv[i][0] != '-' && positional_count < 2)                         positionals[positional_count++] = argv[i];
+    else                                                                        args_ok = false;
+  }
+
+  // NOTE: The positional arguments are the input and the model, when restoring only the model
+  if (args_ok && positional_count != (restore_path != 0 ? 1 : 2)) args_ok = false;
+  if (args_ok)
+  {
+    input_path = (restore_path != 0 ? 0 : positionals[0]);
+    model      = positionals[positional_count - 1];
+  }
+
+  // NOTE: The binary trace needs every step, filter it when rendering instead
+  if (args_ok && trace_path != 0 && filter.op_count != 0) args_ok = false;
+  if (args_ok && format_threads > PIPELINE_MAX_FORMATTERS) args_ok = false;
+
+  if (!args_ok)
+  {
+    fprintf(stderr, "Invalid arguments. Expected: estimate [options] <input_binary> <model>[,<model>...]\n"
+                    "  --checkpoint <file>          write a checkpoint to <file> when a trigger below fires\n"
+                    "  --checkpoint-after <n>       trigger after <n> executed instructions\n"
+                    "  --checkpoint-at-ip <ip>      trigger when ip reaches <ip>\n"
+                    "  --checkpoint-on-hlt          trigger on hlt\n"
+                    "  --restore <file>             resume from a checkpoint instead of loading <input_binary>\n"
+                    "  --format <flat|com|exe>      input format, detected from the MZ signature and .com extension by default\n"
+                    "  --load-segment <seg>         segment to load the input at\n"
+                    "  --headless                   skip the per-step trace, print the final registers, total clocks and the throughput\n"
+                    "  --static                     don't run, print the clocks of every basic block of the image from the timing table\n"
+                    "  --biu                        also simulate the prefetch queue, instructions wait for their bytes to be fetched\n"
+                    "  --machine pcxt               add the stalls of a PC/XT, DRAM refresh every 72 clocks for 4\n"
+                    "  --refresh <n>[,<clocks>]     DRAM refresh every <n> clocks, taking <clocks> (default 4)\n"
+                    "  --wait-states <addr>[-<addr>]=<n>  <n> wait states per bus cycle to memory in the range, up to 8 ranges\n"
+                    "  --heatmap <base>             write memory access counts to <base>.lines.csv, <base>.ips.csv and <base>.pgm\n"
+                    "  --profile <n>                print the <n> instructions that took the most clocks, with counts, EA clocks and penalties\n"
+                    "  --listing <file>             print a NASM listing (nasm -l) of the input with the counts and clocks of its lines\n"
+                    "  --call-graph <base>          write the call tree with inclusive and exclusive clocks to <base>.txt, folded stacks to <base>.folded\n"
+                    "  --binary-trace <file>        write the per-step trace to <file> in binary form, see render\n"
+                    "  --trace-ip <ip>[-<ip>]       only trace instructions in the ip range\n"
+                    "  --trace-kind <mnemonic>      only trace instructions of the kind, e.g. mov\n"
+                    "  --trace-reg <reg|flags>      only trace instructions that change the register\n"
+                    "  --trace-mem <addr>[-<addr>]  only trace instructions that access memory in the address range\n"
+                    "  --trace-every <n>            only trace every <n>th instruction\n"
+                    "  --trace-threads <n>          format the trace on <n> threads of its own, up to 16\n"
+                    "  --timeline <file>            write a Chrome/Perfetto trace event timeline of the run, one us per clock\n"
+                    "  --timeline-counter <reg>     chart the register on the timeline\n"
+                    "  --timeline-window <clocks>   clocks per memory write rate sample on the timeline (default 1000)\n"
+                    "A model is 8086, 8088 or a timing model file, e.g. timing_v30.txt, see sim86_timing.h for the format.\n"
+                    "Trace filters of the same kind are or'ed, different kinds are and'ed. Clock totals count every instruction.\n"
+                    "Several models are estimated in the same run, the binary trace, timeline, heatmap, profile, call graph and checkpoints follow the first.\n");
+  }
+  else if ((model_count = ParseModels(model, model_names)) == 0)
+  {
+    fprintf(stderr, "Invalid second argument, expected up to %u models separated by commas.\n", ESTIMATE_MODEL_MAX);
+  }
   else
   {
-    bool is_8088 = (strcmp(argv[2], "8088") == 0);
+    Estimate_Model models[ESTIMATE_MODEL_MAX] = {0};
+    Timing_Model* timing_models = Platform_AllocateMemory(model_count*sizeof(Timing_Model));
+    ASSERT(timing_models != 0);
 
-    FILE* file;
-    if (fopen_s(&file, argv[1], "rb") != 0) fprintf(stderr, "Failed to open input binary\n");
+    Memory* memory = 0;
+    CPU_State cpu_state = {0};
+    Run_Info run = {0};
+
+    if (!LoadModels(models, timing_models, model_count, model_names))
+    {
+      // NOTE: Nothing to run
+    }
+    else if (restore_path != 0)
+    {
+      memory = LoadCheckpoint(restore_path, &cpu_state, &run);
+      if (memory == 0) fprintf(stderr, "Failed to restore checkpoint\n");
+    }
     else
     {
-      fseek(file, 0, SEEK_END);
-      u64 file_size = ftell(file);
-      rewind(file);
+      memory = LoadProgram(input_path, load_options, &cpu_state, &run);
+    }
 
-      Memory* memory = calloc(1, sizeof(Memory));
+    if (memory != 0 && static_blocks)
+    {
+      Timing_Model* timings[ESTIMATE_MODEL_MAX];
+      for (u32 i = 0; i < model_count; ++i) timings[i] = models[i].timing;
+
+      Static_Analysis analysis;
+      if (Static_Analyze(&analysis, memory, &run, &cpu_state, timings, model_count)) Static_Report(&analysis, model_names);
+      else                                                                           fprintf(stderr, "Failed to allocate the block table\n");
+
+      Static_Free(&analysis);
+    }
+    else if (memory != 0)
+    {
+      u64 run_start_clocks = run.clocks;
+      u64 clocks[ESTIMATE_MODEL_MAX];
+      for (u32 i = 0; i < model_count; ++i) clocks[i] = run_start_clocks;
 
+      Filter_Compile(&filter);
 
-      if      (file_size > sizeof(Memory))                                    fprintf(stderr, "Input binary is too large\n");
-      else if (memory == 0 || fread(memory, 1, file_size, file) != file_size) fprintf(stderr, "Failed to read input binary\n");
-      else
+      Memory_Access_Log access_log = {0};
+      if (heatmap_path != 0 || filter.needs_access_log || timeline_options.path != 0 || machine_options.region_count != 0)
       {
-        CPU_State cpu_state = {
-          .register_file = {0},
-          .flags         = 0,
-          .ip            = 0,
-          .memory        = memory,
-        };
+        memory->access_log = &access_log;
+      }
 
-        uint clocks = 0;
+      Timeline timeline = {0};
+      if (timeline_options.path != 0 && !Timeline_Begin(&timeline, &timeline_options, model_names[0], &cpu_state, clocks[0]))
+      {
+        fprintf(stderr, "Failed to open timeline\n");
+      }
 
-        while (cpu_state.ip < file_size)
-        {
-          CPU_State prev_state = cpu_state;
-          Instruction instruction = DecodeInstruction(memory, &cpu_state.ip);
-          ExecuteInstruction(&cpu_state, instruction);
+      bool machine_model = MachineIsModeled(&machine_options);
+      for (u32 i = 0; i < model_count; ++i)
+      {
+        if (biu_model)     Biu_Begin(&models[i].biu, models[i].timing, &cpu_state, clocks[i]);
+        if (machine_model) Machine_Begin(&models[i].machine, &machine_options, models[i].timing->bus_width == 8, clocks[i]);
+      }
 
-          PrintInstruction(instruction, prev_state.ip, stdout);
+      Decode_Cache* decode_cache = Platform_AllocateMemory(sizeof(Decode_Cache));
+      ASSERT(decode_cache != 0);
 
-          uint base_clocks = 0;
-          bool ea          = false;
-          uint transfers   = 0;
+      Heatmap* heatmap = 0;
+      if (heatmap_path != 0)
+      {
+        Timing_Model* model = models[0].timing;
+        heatmap = Heatmap_Create((model->bus_width == 8 ? model->bus_cycle : 0), model->bus_cycle);
+        if (heatmap == 0) fprintf(stderr, "Failed to allocate heatmap\n");
+      }
 
-          if (instruction.kind == Instruction_Add || instruction.kind == Instruction_Sub)
-          {
-            if (instruction.operand_format == InstructionOperandFormat_RMRM)
-            {
-              if      (instruction.mod == 3)                  base_clocks =  3, ea = false, transfers = 0;
-              else if (instruction.flags & InstructionFlag_D) base_clocks =  9, ea = true,  transfers = 1;
-              else                                            base_clocks = 16, ea = true, transfers = 2;
-            }
-            else
-            {
-              ASSERT(instruction.operand_format == InstructionOperandFormat_RMImmed);
-              if (instruction.mod == 3) base_clocks =  4, ea = false, transfers = 0;
-              else                      base_clocks = 17, ea = true,  transfers = 2;
-            }
-          }
-          else if (instruction.kind == Instruction_Cmp)
-          {
-            if (instruction.operand_format == InstructionOperandFormat_RMRM)
-            {
-              if      (instruction.mod == 3)                  base_clocks = 3, ea = false, transfers = 0;
-              else if (instruction.flags & InstructionFlag_D) base_clocks = 9, ea = true,  transfers = 1;
-              else                                            base_clocks = 9, ea = true, transfers = 1;
-            }
-            else
-            {
-              ASSERT(instruction.operand_format == InstructionOperandFormat_RMImmed);
-              if (instruction.mod == 3) base_clocks =  4, ea = false, transfers = 0;
-              else                      base_clocks = 10, ea = true,  transfers = 1;
-            }
-          }
-          else if (instruction.kind == Instruction_Mov)
-          {
-            if (instruction.operand_format == InstructionOperandFormat_RegImmed)
-            {
-              base_clocks = 4, ea = false, transfers = 0;
-            }
-            else if (instruction.operand_format == InstructionOperandFormat_RMRM)
-            {
-              if      (instruction.mod == 3)                  base_clocks = 2, ea = false, transfers = 0;
-              else if (instruction.flags & InstructionFlag_D) base_clocks = 8, ea = true,  transfers = 1;
-              else                                            base_clocks = 9, ea = true,  transfers = 1;
-            }
-            else
-            {
-              ASSERT(instruction.operand_format == InstructionOperandFormat_RMImmed);
-              if (instruction.mod == 3) base_clocks =  4, ea = false, transfers = 0;
-              else                      base_clocks = 10, ea = true,  transfers = 1;
-            }
-          }
-          else
-          {
-            ASSERT(instruction.kind == Instruction_Je  || instruction.kind == Instruction_Jl  ||
-                   instruction.kind == Instruction_Jle || instruction.kind == Instruction_Jb  ||
-                   instruction.kind == Instruction_Jbe || instruction.kind == Instruction_Jp  ||
-                   instruction.kind == Instruction_Jo  || instruction.kind == Instruction_Js  ||
-                   instruction.kind == Instruction_Jne || instruction.kind == Instruction_Jge ||
-                   instruction.kind == Instruction_Jg  || instruction.kind == Instruction_Jae ||
-                   instruction.kind == Instruction_Ja  || instruction.kind == Instruction_Jnp ||
-                   instruction.kind == Instruction_Jno || instruction.kind == Instruction_Jns);
-
-            bool branch_taken = (cpu_state.ip == (u32)((int)prev_state.ip + (int)instruction.byte_size + (i16)instruction.disp));
-
-            base_clocks = (branch_taken ? 16 : 4), ea = false, transfers = 0;
-          }
+      Profile profile = {0};
+      if ((profile_top != 0 || listing_path != 0) && !Profile_Begin(&profile, &run, &cpu_state))
+      {
+        fprintf(stderr, "Failed to allocate the profile\n");
+      }
 
-          uint ea_clocks = 0;
-          if (ea)
-          {
-            if      (instruction.mod == 0 && instruction.rm == 6)                          ea_clocks = 6;
-            else if (instruction.mod == 0 && instruction.rm >= 4)                          ea_clocks = 5;
-            else if (instruction.mod != 0 && instruction.rm == 6 && instruction.disp == 0) ea_clocks = 5;
-            else if (instruction.mod != 0 && instruction.rm >= 4)                          ea_clocks = 9;
-            else if (instruction.mod == 0)                                                 ea_clocks = 7;
-            else                                                                           ea_clocks = 11;
-
-            if (instruction.rm == 1 || instruction.rm == 2) ea_clocks += 1;
-
-            bool seg = ((instruction.prefix & InstructionPrefix_SegES) || 
-                        (instruction.prefix & InstructionPrefix_SegSS) ||
-                        (instruction.prefix & InstructionPrefix_SegCS) ||
-                        (instruction.prefix & InstructionPrefix_SegDS));
-            ea_clocks += (seg ? 2 : 0);
-          }
+      Call_Graph call_graph = {0};
+      if (graph_path != 0 && !Call_Graph_Begin(&call_graph, &cpu_state)) fprintf(stderr, "Failed to allocate the call graph\n");
 
-          uint penalty = 0;
-          if (ea && (instruction.flags & InstructionFlag_W))
-          {
-            u32 address = EffectiveAddress(&prev_state, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
-            if (address%2 != 0 || is_8088) penalty = 4*transfers;
-          }
+      FILE* trace_file     = 0;
+      Trace_Encoder* trace = 0;
+      bool text_trace      = (!headless && trace_path == 0);
 
-          uint dclocks = base_clocks + ea_clocks + penalty;
+      char* buffer = 0;
+      if (text_trace || trace_path != 0)
+      {
+        buffer = malloc(WRITER_DEFAULT_CAPACITY);
+        ASSERT(buffer != 0);
+      }
 
-          clocks += dclocks;
+      Pipeline pipeline = {0};
+      if (text_trace && format_threads != 0 && !Pipeline_Start(&pipeline, TraceKind_Estimate, stdout, format_threads, model_count, model_names))
+      {
+        fprintf(stderr, "Failed to start formatter threads, formatting on this one\n");
+      }
 
-          printf(" ; Clocks: +%llu = %llu ", dclocks, clocks);
+      Writer writer = {0};
+      if (text_trace) Writer_Init(&writer, stdout, buffer, WRITER_DEFAULT_CAPACITY);
+      else if (trace_path != 0)
+      {
+        trace_file = fopen(trace_path, "wb");
+        trace      = malloc(sizeof(Trace_Encoder));
+        if (trace_file == 0 || trace == 0) fprintf(stderr, "Failed to open binary trace\n");
+        else                               Trace_BeginEncoding(trace, trace_file, buffer, WRITER_DEFAULT_CAPACITY, TraceKind_Estimate, &cpu_state, &run);
+      }
 
-          if (ea)
-          {
-            printf("(%llu + %lluea", base_clocks, ea_clocks);
-            if (penalty) printf(" + %llup", penalty);
-            printf(") ");
-          }
+      u64 start_count   = run.instruction_count;
+      double start_time = Platform_GetSeconds();
 
-          printf("| ");
+      while (IsExecutingImage(&cpu_state, &run))
+      {
+        u32 ip           = cpu_state.ip;
+        u32 code_address = InstructionAddress(&cpu_state);
 
-          for (Register_Kind i = Register_AX; i < REGISTER_COUNT; ++i)
-          {
-            u16 old = GetRegister(&prev_state, i);
-            u16 new = GetRegister(&cpu_state, i);
+        CPU_State prev_state;
+        if (text_trace) prev_state = cpu_state;
 
-            if (old == new) continue;
-            else            printf("%s:0x%x->0x%x ", RegisterNames[i], old, new);
-          }
+        // NOTE: Everything static about the clocks comes with the decode, each model looks its timing up by the form.
+        //       Only what depends on the run is left.
+        Timing_Form form;
+        Instruction instruction = Decode_Cache_Fetch(decode_cache, &cpu_state, &form);
+        u32 fallthrough_ip      = cpu_state.ip;
 
-          printf("ip:0x%x->0x%x ", prev_state.ip, cpu_state.ip);
+        Instruction_Timing timings[ESTIMATE_MODEL_MAX];
+        for (u32 i = 0; i < model_count; ++i) timings[i] = Timing_Model_Lookup(models[i].timing, form);
 
-          if (prev_state.flags != cpu_state.flags)
+        u32 address  = 0;
+        bool counted = false;
+        u32 counts[ESTIMATE_MODEL_MAX];
+        for (u32 i = 0; i < model_count; ++i)
+        {
+          Instruction_Timing* timing = &timings[i];
+          if (timing->transfers != 0 || timing->count_transfers != 0) address = TransferAddress(&cpu_state, instruction);
+
+          counts[i] = 0;
+          if (timing->per_count != 0) counts[i] = OperandCount(&cpu_state, instruction, *timing), counted = true;
+        }
+
+        u16 cx = (counted ? GetRegister(&cpu_state, Register_CX) : 0);
+
+        access_log.count  = 0;
+        bool branch_taken = ExecuteInstruction(&cpu_state, instruction);
+        if (heatmap != 0) Heatmap_Record(heatmap, ip, &access_log);
+        run.instruction_count += 1;
+
+#if SIM86_SHADOW
+        ShadowReportReads(memory, ip, stderr);
+#endif
+
+        u32 repeat_count = (counted ? RepeatCount(instruction, cx, GetRegister(&cpu_state, Register_CX)) : 0);
+
+        // NOTE: Execution is shared, each model only adds its own timing
+        Clocks steps[ESTIMATE_MODEL_MAX];
+        for (u32 i = 0; i < model_count; ++i)
+        {
+          Estimate_Model* m = &models[i];
+          u32 count         = counts[i] + (timings[i].per_count != 0 ? repeat_count : 0);
+          steps[i]          = InstructionClocks(timings[i], address, branch_taken, count);
+
+          if (biu_model)
           {
-            printf("flags:");
-            for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(&prev_state, i)) printf("%c", FlagNames[i]);
-            printf("->");
-            for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(&cpu_state, i)) printf("%c", FlagNames[i]);
-            printf(" ");
+            u32 bus_cycles = Biu_BusCycles(timings[i], address, count);
+            Biu_Step(&m->biu, &steps[i], clocks[i], fallthrough_ip - ip, bus_cycles, branch_taken, InstructionAddress(&cpu_state));
           }
 
-          printf("\n");
+          if (machine_model) Machine_Step(&m->machine, &steps[i], clocks[i], &access_log);
+
+          clocks[i] += TotalClocks(steps[i]);
         }
 
-        printf("\nFinal registers:\n");
-        Register_Kind print_registers[12] = {
-          Register_AX,
-          Register_BX,
-          Register_CX,
-          Register_DX,
-          Register_SP,
-          Register_BP,
-          Register_SI,
-          Register_DI,
-
-          Register_CS,
-          Register_ES,
-          Register_SS,
-          Register_DS,
-        };
-        for (uint i = 0; i < sizeof(print_registers)/sizeof(0[print_registers]); ++i)
+        if (call_graph.nodes != 0) Call_Graph_Step(&call_graph, &instruction, branch_taken, &cpu_state, TotalClocks(steps[0]));
+        if (profile.sites != 0) Profile_Step(&profile, code_address, TotalClocks(steps[0]), steps[0].ea, steps[0].penalty);
+        if (timeline.file != 0) Timeline_Step(&timeline, instruction, ip, branch_taken, &cpu_state, clocks[0] - TotalClocks(steps[0]), clocks[0], &access_log);
+
+        if (text_trace && Filter_Matches(&filter, run.instruction_count - 1, instruction.kind, &prev_state, &cpu_state, &access_log))
         {
-          Register_Kind reg_kind = print_registers[i];
-          if (cpu_state.register_file[reg_kind] != 0)
+          if (pipeline.formatter_count != 0)
           {
-            printf("      %s: 0x%04x (%u)\n", RegisterNames[reg_kind], cpu_state.register_file[reg_kind], cpu_state.register_file[reg_kind]);
+            Pipeline_Record* record = Pipeline_Push(&pipeline);
+            record->instruction = instruction;
+            record->prev_state  = prev_state;
+            record->state       = cpu_state;
+            memcpy(record->clocks, steps, model_count*sizeof(Clocks));
+            memcpy(record->total_clocks, clocks, model_count*sizeof(u64));
           }
+          else WriteEstimateStep(&writer, instruction, model_count, model_names, steps, clocks, &prev_state, &cpu_state);
         }
+        else if (trace_file != 0)
+        {
+          u8 bytes[TRACE_INSTRUCTION_MAX];
+          Trace_CopyInstruction(memory, code_address, fallthrough_ip - ip, bytes);
 
-        printf("      ip: 0x%04x (%u)\n", cpu_state.ip, cpu_state.ip);
+          if (!Trace_EncodeStep(trace, bytes, fallthrough_ip - ip, fallthrough_ip, &cpu_state, steps[0]))
+          {
+            fprintf(stderr, "Instruction at %05x is longer than the binary trace holds\n", code_address);
+            break;
+          }
+        }
 
-        if (cpu_state.flags != 0)
+        if (ShouldTakeCheckpoint(&checkpoint, run.instruction_count, cpu_state.ip, instruction.kind))
         {
-          printf("   flags: ");
+          run.clocks = clocks[0];
+          if (!WriteCheckpoint(checkpoint.path, &cpu_state, run)) fprintf(stderr, "Failed to write checkpoint\n");
+        }
+
+        if (instruction.kind == Instruction_Hlt) break;
+      }
+
+      if (pipeline.formatter_count != 0) Pipeline_Finish(&pipeline);
+
+      if (timeline.file != 0 && !Timeline_End(&timeline, clocks[0])) fprintf(stderr, "Failed to write timeline\n");
 
-          for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(&cpu_state, i)) printf("%c", FlagNames[i]);
+      Writer_Flush(&writer);
 
-          printf("\n");
+      if (trace_file != 0)
+      {
+        if (trace != 0) Trace_EndEncoding(trace);
+        if (fclose(trace_file) != 0) fprintf(stderr, "Failed to write binary trace\n");
+      }
+
+      free(trace);
+      free(buffer);
+      Platform_FreeMemory(decode_cache, sizeof(Decode_Cache));
+
+      double seconds = Platform_GetSeconds() - start_time;
+      u64 count      = run.instruction_count - start_count;
+
+      printf("\nFinal registers:\n");
+      PrintRegisters(&cpu_state);
+
+      if (headless)
+      {
+        printf("\n");
+        for (u32 i = 0; i < model_count; ++i)
+        {
+          if (model_count == 1) printf("Clocks: %llu\n", (unsigned long long)clocks[i]);
+          else                  printf("Clocks (%s): %llu\n", model_names[i], (unsigned long long)clocks[i]);
         }
+
+        for (u32 i = 0; i < model_count && machine_model; ++i)
+        {
+          Machine* machine = &models[i].machine;
+          u64 stalls       = machine->refresh_stalls + machine->wait_stalls;
+
+          if (model_count == 1) printf("Stalls: ");
+          else                  printf("Stalls (%s): ", model_names[i]);
+          printf("%llu refresh + %llu wait states, %llu clocks of execution\n", (unsigned long long)machine->refresh_stalls,
+                 (unsigned long long)machine->wait_stalls, (unsigned long long)(clocks[i] - run_start_clocks - stalls));
+        }
+        printf("Instructions: %llu\n", (unsigned long long)count);
+        printf("Wall time: %.6f s\n", seconds);
+        printf("MIPS: %.2f\n", (seconds > 0 ? (double)count / seconds * 1e-6 : 0.0));
       }
 
-      fclose(file);
+      if (profile.sites != 0)
+      {
+        if (profile_top != 0) Profile_Report(&profile, memory, model_names[0], profile_top);
+        if (listing_path != 0 && !Profile_Annotate(&profile, listing_path, model_names[0])) fprintf(stderr, "Failed to read listing\n");
+
+        Profile_End(&profile);
+      }
+
+      if (call_graph.nodes != 0)
+      {
+        if (!Call_Graph_Export(&call_graph, graph_path, model_names[0])) fprintf(stderr, "Failed to write call graph\n");
+        Call_Graph_End(&call_graph);
+      }
+
+      if (heatmap != 0 && !Heatmap_Export(heatmap, heatmap_path)) fprintf(stderr, "Failed to write heatmap\n");
     }
+
+    Platform_FreeMemory(timing_models, model_count*sizeof(Timing_Model));
   }
 }
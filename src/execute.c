@@ -2,137 +2,424 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "sim86_platform.h"
+#include "sim86_checkpoint.h"
+#include "sim86_load.h"
+#include "sim86_heatmap.h"
+#include "sim86_history.h"
+#include "sim86_pool.h"
+#include "sim86_trace.h"
+#include "sim86_filter.h"
+#include "sim86_pipeline.h"
+#include "sim86_framebuffer.h"
+
+bool
+DebugStep(CPU_State* cpu_state, Run_Info* run, History* history, Framebuffer* framebuffer)
+{
+  bool result = false;
+
+  if (IsExecutingImage(cpu_state, run))
+  {
+    CPU_State prev_state = *cpu_state;
+
+    Memory_Access_Log* log = cpu_state->memory->access_log;
+
+    History_BeginStep(history, cpu_state);
+    Instruction instruction = FetchInstruction(cpu_state);
+    log->count = 0;
+    ExecuteInstruction(cpu_state, instruction);
+    History_EndStep(history, log);
+    if (framebuffer != 0) Framebuffer_Record(framebuffer, log);
+
+    char buffer[2*WRITER_LINE_MAX];
+    Writer writer;
+    Writer_Init(&writer, stdout, buffer, sizeof(buffer));
+
+    Writer_Unsigned(&writer, history->instruction_count);
+    Writer_String(&writer, ": ");
+    WriteExecuteStep(&writer, instruction, &prev_state, cpu_state);
+    Writer_Flush(&writer);
+
+#if SIM86_SHADOW
+    ShadowReportReads(cpu_state->memory, prev_state.ip, stderr);
+#endif
+
+    result = (instruction.kind != Instruction_Hlt);
+  }
+
+  return result;
+}
+
+void
+Debug(CPU_State* cpu_state, Run_Info* run, History* history, Framebuffer* framebuffer)
+{
+  history->instruction_count = run->instruction_count;
+
+  Memory_Access_Log access_log = {0};
+  cpu_state->memory->access_log = &access_log;
+
+  fprintf(stderr, "commands: s [n] step, b [n] step back, g <index> go to instruction index, c continue, r registers, f write a frame, q quit\n");
+
+  char line[256];
+  for (;;)
+  {
+    fprintf(stderr, "%llu> ", (unsigned long long)history->instruction_count);
+    if (fgets(line, sizeof(line), stdin) == 0) break;
+
+    char* cursor = line;
+    while (*cursor == ' ' || *cursor == '\t') ++cursor;
+
+    char command = *cursor;
+    if (command != 0) ++cursor;
+
+    char* arg_end;
+    u64 arg = strtoull(cursor, &arg_end, 0);
+    bool has_arg = (arg_end != cursor);
+
+    if      (command == 'q') break;
+    else if (command == 'r') PrintRegisters(cpu_state);
+    else if (command == 'f')
+    {
+      if      (framebuffer == 0)                                        fprintf(stderr, "no framebuffer, see --framebuffer\n");
+      else if (!Framebuffer_WriteFrame(framebuffer, cpu_state->memory)) fprintf(stderr, "failed to write frame\n");
+    }
+    else if (command == 's')
+    {
+      for (u64 i = 0; i < (has_arg ? arg : 1); ++i)
+      {
+        if (!DebugStep(cpu_state, run, history, framebuffer)) break;
+      }
+    }
+    else if (command == 'c')
+    {
+      while (DebugStep(cpu_state, run, history, framebuffer));
+    }
+    else if (command == 'b' || command == 'g')
+    {
+      u64 count  = history->instruction_count;
+      u64 target = (command == 'g' ? arg : count - MIN(count, (has_arg ? arg : 1)));
+
+      if (command == 'g' && !has_arg) fprintf(stderr, "missing instruction index\n");
+      else if (target > count)
+      {
+        while (history->instruction_count < target && DebugStep(cpu_state, run, history, framebuffer));
+      }
+      else if (!History_Seek(history, cpu_state, run, target))
+      {
+        fprintf(stderr, "instruction %llu is no longer in the history (oldest is %llu)\n", (unsigned long long)target, (unsigned long long)History_OldestIndex(history));
+      }
+      else
+      {
+        PrintRegisters(cpu_state);
+      }
+    }
+    else if (command != '\n' && command != 0) fprintf(stderr, "unknown command '%c'\n", command);
+  }
+
+  cpu_state->memory->access_log = 0;
+}
+
+typedef struct Run_Options
+{
+  Checkpoint_Trigger* checkpoint;
+  Heatmap* heatmap;
+  Trace_Encoder* trace;
+  Trace_Filter* filter;
+  Framebuffer* framebuffer;
+  u32 format_threads;
+  bool headless;
+} Run_Options;
+
+// NOTE: A headless run prints nothing per step, only the final registers followed by the throughput. With a trace
+//       encoder the steps go to the binary trace instead of the text trace.
+void
+Run(CPU_State* cpu_state, Run_Info* run, Run_Options* options)
+{
+  Memory* memory                 = cpu_state->memory;
+  Checkpoint_Trigger* checkpoint = options->checkpoint;
+  Heatmap* heatmap               = options->heatmap;
+  Trace_Encoder* trace           = options->trace;
+  Trace_Filter* filter           = options->filter;
+  Framebuffer* framebuffer       = options->framebuffer;
+  bool headless                  = options->headless;
+
+  Memory_Access_Log access_log = {0};
+  if (heatmap != 0 || filter->needs_access_log || framebuffer != 0) memory->access_log = &access_log;
+
+  bool text_trace = (!headless && trace == 0);
+
+  Pipeline pipeline = {0};
+  if (text_trace && options->format_threads != 0 && !Pipeline_Start(&pipeline, TraceKind_Execute, stdout, options->format_threads, 0, 0))
+  {
+    fprintf(stderr, "Failed to start formatter threads, formatting on this one\n");
+  }
+
+  Writer writer = {0};
+  if (text_trace && pipeline.formatter_count == 0)
+  {
+    char* buffer = malloc(WRITER_DEFAULT_CAPACITY);
+    ASSERT(buffer != 0);
+    Writer_Init(&writer, stdout, buffer, WRITER_DEFAULT_CAPACITY);
+  }
+
+  u64 start_count   = run->instruction_count;
+  double start_time = Platform_GetSeconds();
+
+  while (IsExecutingImage(cpu_state, run))
+  {
+    u32 ip      = cpu_state->ip;
+    u32 address = InstructionAddress(cpu_state);
+
+    CPU_State prev_state;
+    if (text_trace) prev_state = *cpu_state;
+
+    Instruction instruction = FetchInstruction(cpu_state);
+    u32 fallthrough_ip      = cpu_state->ip;
+
+    access_log.count = 0;
+    ExecuteInstruction(cpu_state, instruction);
+    if (heatmap != 0) Heatmap_Record(heatmap, ip, &access_log);
+    run->instruction_count += 1;
+
+    if (framebuffer != 0)
+    {
+      Framebuffer_Record(framebuffer, &access_log);
+      Framebuffer_Tick(framebuffer, memory, run->instruction_count);
+    }
+
+    if (text_trace && Filter_Matches(filter, run->instruction_count - 1, instruction.kind, &prev_state, cpu_state, &access_log))
+    {
+      if (pipeline.formatter_count != 0)
+      {
+        Pipeline_Record* record = Pipeline_Push(&pipeline);
+        record->instruction = instruction;
+        record->prev_state  = prev_state;
+        record->state       = *cpu_state;
+      }
+      else WriteExecuteStep(&writer, instruction, &prev_state, cpu_state);
+    }
+    else if (trace != 0)
+    {
+      u8 bytes[TRACE_INSTRUCTION_MAX];
+      Trace_CopyInstruction(memory, address, fallthrough_ip - ip, bytes);
+
+      if (!Trace_EncodeStep(trace, bytes, fallthrough_ip - ip, fallthrough_ip, cpu_state, (Clocks){0}))
+      {
+        fprintf(stderr, "Instruction at %05x is longer than the binary trace holds\n", address);
+        break;
+      }
+    }
+
+#if SIM86_SHADOW
+    ShadowReportReads(memory, ip, stderr);
+#endif
+
+    if (ShouldTakeCheckpoint(checkpoint, run->instruction_count, cpu_state->ip, instruction.kind))
+    {
+      if (!WriteCheckpoint(checkpoint->path, cpu_state, *run)) fprintf(stderr, "Failed to write checkpoint\n");
+    }
+
+    if (instruction.kind == Instruction_Hlt) break;
+  }
+
+  if (pipeline.formatter_count != 0) Pipeline_Finish(&pipeline);
+
+  Writer_Flush(&writer);
+  free(writer.buffer);
+
+  if (trace != 0) Trace_EndEncoding(trace);
+
+  double seconds = Platform_GetSeconds() - start_time;
+  u64 count      = run->instruction_count - start_count;
+
+  memory->access_log = 0;
+
+  printf("\nFinal registers:\n");
+  PrintRegisters(cpu_state);
+
+  if (headless)
+  {
+    printf("\nInstructions: %llu\n", (unsigned long long)count);
+    printf("Wall time: %.6f s\n", seconds);
+    printf("MIPS: %.2f\n", (seconds > 0 ? (double)count / seconds * 1e-6 : 0.0));
+  }
+}
 
 int
 main(int argc, char** argv)
 {
-  if (argc != 2) fprintf(stderr, "Invalid number of arguments. Expected: disassemble <input_binary>\n");
+  char** input_paths     = calloc(argc, sizeof(char*));
+  int input_count        = 0;
+  char* restore_path     = 0;
+  char* heatmap_path     = 0;
+  char* trace_path       = 0;
+  bool debug             = false;
+  bool headless          = false;
+  u32 format_threads     = 0;
+  u64 history_interval   = 0;
+  u64 history_budget     = 0;
+  Checkpoint_Trigger checkpoint = {0};
+  Load_Options load_options     = {0};
+  Trace_Filter filter           = {0};
+  Framebuffer_Options framebuffer_options = DefaultFramebufferOptions();
+
+  bool args_ok = (input_paths != 0);
+  for (int i = 1; i < argc && args_ok; ++i)
+  {
+    if      (ParseCheckpointOption(argc, argv, &i, &checkpoint, &restore_path))      continue;
+    else if (ParseHistoryOption(argc, argv, &i, &history_interval, &history_budget)) continue;
+    else if (ParseLoadOption(argc, argv, &i, &load_options))                         continue;
+    else if (ParseFilterOption(argc, argv, &i, &filter))                             continue;
+    else if (ParseFramebufferOption(argc, argv, &i, &framebuffer_options))           continue;
+    else if (strcmp(argv[i], "--debug") == 0)                                        debug = true;
+    else if (strcmp(argv[i], "--headless") == 0)                                     headless = true;
+    else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc)                      heatmap_path = argv[++i];
+    else if (strcmp(argv[i], "--binary-trace") == 0 && i + 1 < argc)                 trace_path = argv[++i];
+    else if (strcmp(argv[i], "--trace-threads") == 0 && i + 1 < argc)                format_threads = (u32)strtoul(argv[++i], 0, 0);
+    else if (argv[i][0] != '-')                                                      input_paths[input_count++] = argv[i];
+    else                                                                             args_ok = false;
+  }
+
+  // NOTE: Several inputs are run back to back on one pooled instance, which rules out the options that follow a
+  //       single run
+  if (args_ok && (input_count == 0) == (restore_path == 0))                             args_ok = false;
+  if (args_ok && input_count > 1 && (debug || checkpoint.path != 0 || trace_path != 0 || framebuffer_options.path != 0)) args_ok = false;
+
+  // NOTE: The binary trace needs every step, filter it when rendering instead
+  if (args_ok && trace_path != 0 && filter.op_count != 0) args_ok = false;
+  if (args_ok && format_threads > PIPELINE_MAX_FORMATTERS) args_ok = false;
+  if (args_ok && !FramebufferFitsInMemory(&framebuffer_options)) args_ok = false;
+
+  if (!args_ok)
+  {
+    fprintf(stderr, "Invalid arguments. Expected: execute [options] <input_binary>...\n"
+                    "  --checkpoint <file>          write a checkpoint to <file> when a trigger below fires\n"
+                    "  --checkpoint-after <n>       trigger after <n> executed instructions\n"
+                    "  --checkpoint-at-ip <ip>      trigger when ip reaches <ip>\n"
+                    "  --checkpoint-on-hlt          trigger on hlt\n"
+                    "  --restore <file>             resume from a checkpoint instead of loading <input_binary>\n"
+                    "  --format <flat|com|exe>      input format, detected from the MZ signature and .com extension by default\n"
+                    "  --load-segment <seg>         segment to load the input at\n"
+                    "  --debug                      step through the program interactively, including stepping backwards\n"
+                    "  --history-interval <n>       instructions between history snapshots (default 4096)\n"
+                    "  --history-budget <mb>        memory limit of the history in MB (default 64)\n"
+                    "  --headless                   skip the per-step trace, print the final registers and the throughput\n"
+                    "  --heatmap <base>             write memory access counts to <base>.lines.csv, <base>.ips.csv and <base>.pgm\n"
+                    "  --binary-trace <file>        write the per-step trace to <file> in binary form, see render\n"
+                    "  --trace-ip <ip>[-<ip>]       only trace instructions in the ip range\n"
+                    "  --trace-kind <mnemonic>      only trace instructions of the kind, e.g. mov\n"
+                    "  --trace-reg <reg|flags>      only trace instructions that change the register\n"
+                    "  --trace-mem <addr>[-<addr>]  only trace instructions that access memory in the address range\n"
+                    "  --trace-every <n>            only trace every <n>th instruction\n"
+                    "  --trace-threads <n>          format the trace on <n> threads of its own, up to 16\n"
+                    "  --framebuffer <file>         write the framebuffer to <file> when the run ends, or every frame to its own file\n"
+                    "                               when <file> has a run of '#' for the frame number\n"
+                    "  --framebuffer-base <addr>    address of the framebuffer (default 256)\n"
+                    "  --framebuffer-size <w>x<h>   size of the framebuffer in pixels (default 64x64)\n"
+                    "  --framebuffer-format <fmt>   rgba, bgra or gray8 (default rgba)\n"
+                    "  --framebuffer-every <n>      also write a frame every <n> instructions, appended to <file> unless it has '#'\n"
+                    "  --framebuffer-raw            write bare pixels, rgb or gray, instead of PPM or PGM\n"
+                    "Trace filters of the same kind are or'ed, different kinds are and'ed.\n"
+                    "With several input binaries, each is run in turn on a reused instance, and the heatmap covers all of them.\n");
+  }
   else
   {
-    FILE* file;
-    if (fopen_s(&file, argv[1], "rb") != 0) fprintf(stderr, "Failed to open input binary\n");
-    else
+    Heatmap* heatmap = 0;
+    if (heatmap_path != 0 && !debug)
     {
-      fseek(file, 0, SEEK_END);
-      u64 file_size = ftell(file);
-      rewind(file);
+      heatmap = Heatmap_Create(0, 0);
+      if (heatmap == 0) fprintf(stderr, "Failed to allocate heatmap\n");
+    }
 
-      Memory* memory = calloc(1, sizeof(Memory));
+    Filter_Compile(&filter);
 
+    Run_Options run_options = {
+      .checkpoint     = &checkpoint,
+      .heatmap        = heatmap,
+      .filter         = &filter,
+      .format_threads = format_threads,
+      .headless       = headless,
+    };
 
-      if      (file_size > sizeof(Memory))                                    fprintf(stderr, "Input binary is too large\n");
-      else if (memory == 0 || fread(memory, 1, file_size, file) != file_size) fprintf(stderr, "Failed to read input binary\n");
+    if (input_count > 1)
+    {
+      Instance_Pool pool;
+      if (!Pool_Init(&pool, 1)) fprintf(stderr, "Failed to allocate instance pool\n");
       else
       {
-        CPU_State cpu_state = {
-          .register_file = {0},
-          .flags         = 0,
-          .ip            = 0,
-          .memory        = memory,
-        };
-
-        while (cpu_state.ip < file_size)
+        for (int i = 0; i < input_count; ++i)
         {
-          CPU_State prev_state = cpu_state;
-          Instruction instruction = DecodeInstruction(memory, &cpu_state.ip);
-          ExecuteInstruction(&cpu_state, instruction);
-
-          PrintInstruction(instruction, prev_state.ip, stdout);
-
-          bool has_printed_intro = false;
-
-          for (Register_Kind i = Register_AX; i < REGISTER_COUNT; ++i)
-          {
-            u16 old = GetRegister(&prev_state, i);
-            u16 new = GetRegister(&cpu_state, i);
-
-            if (old == new) continue;
-            else
-            {
-              if (!has_printed_intro)
-              {
-                printf(" ; ");
-                has_printed_intro = true;
-              }
-
-              printf("%s:0x%x->0x%x ", RegisterNames[i], old, new);
-            }
-          }
-
-#define DISPLAY_IP 1
-#if DISPLAY_IP
-          if (!has_printed_intro)
-          {
-            printf(" ; ");
-            has_printed_intro = true;
-          }
-          printf("ip:0x%x->0x%x ", prev_state.ip, cpu_state.ip);
-#endif
+          Memory* memory = Pool_Acquire(&pool);
 
-          if (prev_state.flags != cpu_state.flags)
-          {
-            if (!has_printed_intro)
-            {
-              printf(" ; ");
-              has_printed_intro = true;
-            }
-
-            printf("flags:");
-            for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(&prev_state, i)) printf("%c", FlagNames[i]);
-            printf("->");
-            for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(&cpu_state, i)) printf("%c", FlagNames[i]);
-            printf(" ");
-          }
-
-          printf("\n");
-        }
+          CPU_State cpu_state;
+          Run_Info run;
 
-        printf("\nFinal registers:\n");
-        Register_Kind print_registers[12] = {
-          Register_AX,
-          Register_BX,
-          Register_CX,
-          Register_DX,
-          Register_SP,
-          Register_BP,
-          Register_SI,
-          Register_DI,
-
-          Register_CS,
-          Register_ES,
-          Register_SS,
-          Register_DS,
-        };
-        for (uint i = 0; i < sizeof(print_registers)/sizeof(0[print_registers]); ++i)
-        {
-          Register_Kind reg_kind = print_registers[i];
-          if (cpu_state.register_file[reg_kind] != 0)
-          {
-            printf("      %s: 0x%04x (%u)\n", RegisterNames[reg_kind], cpu_state.register_file[reg_kind], cpu_state.register_file[reg_kind]);
-          }
+          printf("%s%s:\n", (i != 0 ? "\n" : ""), input_paths[i]);
+          if (LoadProgramInto(input_paths[i], load_options, memory, &cpu_state, &run)) Run(&cpu_state, &run, &run_options);
+
+          Pool_Release(&pool, memory);
         }
 
-#if DISPLAY_IP
-        printf("      ip: 0x%04x (%u)\n", cpu_state.ip, cpu_state.ip);
-#endif
+        Pool_Destroy(&pool);
+      }
+    }
+    else
+    {
+      Memory* memory = 0;
+      CPU_State cpu_state = {0};
+      Run_Info run = {0};
 
-        if (cpu_state.flags != 0)
-        {
-          printf("   flags: ");
+      if (restore_path != 0)
+      {
+        memory = LoadCheckpoint(restore_path, &cpu_state, &run);
+        if (memory == 0) fprintf(stderr, "Failed to restore checkpoint\n");
+      }
+      else
+      {
+        memory = LoadProgram(input_paths[0], load_options, &cpu_state, &run);
+      }
+
+      Framebuffer framebuffer;
+      if (memory != 0 && framebuffer_options.path != 0)
+      {
+        if (!Framebuffer_Begin(&framebuffer, &framebuffer_options)) fprintf(stderr, "Failed to open framebuffer output\n");
+        else                                                        run_options.framebuffer = &framebuffer;
+      }
 
-          for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(&cpu_state, i)) printf("%c", FlagNames[i]);
+      History history;
+      if (memory != 0 && debug)
+      {
+        if (!History_Init(&history, history_interval, history_budget)) fprintf(stderr, "Failed to allocate history\n");
+        else                                                         Debug(&cpu_state, &run, &history, run_options.framebuffer);
+      }
+      else if (memory != 0 && trace_path != 0)
+      {
+        FILE* trace_file     = fopen(trace_path, "wb");
+        char* buffer         = malloc(WRITER_DEFAULT_CAPACITY);
+        Trace_Encoder* trace = malloc(sizeof(Trace_Encoder));
+        if (trace_file == 0 || buffer == 0 || trace == 0) fprintf(stderr, "Failed to open binary trace\n");
+        else
+        {
+          Trace_BeginEncoding(trace, trace_file, buffer, WRITER_DEFAULT_CAPACITY, TraceKind_Execute, &cpu_state, &run);
 
-          printf("\n");
+          run_options.trace = trace;
+          Run(&cpu_state, &run, &run_options);
         }
 
-#if 0
-        FILE* im = fopen("image_out.data", "wb");
-        fwrite(cpu_state.memory->mem, 1, 64*4 + 64*64*4, im);
-        fclose(im);
-#endif
+        if (trace_file != 0 && fclose(trace_file) != 0) fprintf(stderr, "Failed to write binary trace\n");
+        free(trace);
+        free(buffer);
+      }
+      else if (memory != 0)
+      {
+        Run(&cpu_state, &run, &run_options);
       }
 
-      fclose(file);
+      if (run_options.framebuffer != 0 && !Framebuffer_End(&framebuffer, memory)) fprintf(stderr, "Failed to write framebuffer\n");
     }
+
+    if (heatmap != 0 && !Heatmap_Export(heatmap, heatmap_path)) fprintf(stderr, "Failed to write heatmap\n");
   }
 }
@@ -0,0 +1,97 @@
+#include "sim86.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sim86_platform.h"
+#include "sim86_trace.h"
+#include "sim86_filter.h"
+
+int
+main(int argc, char** argv)
+{
+  char* trace_path    = 0;
+  u64 from            = 0;
+  u64 to              = ~(u64)0;
+  Trace_Filter filter = {0};
+
+  bool args_ok = true;
+  for (int i = 1; i < argc && args_ok; ++i)
+  {
+    if      (ParseFilterOption(argc, argv, &i, &filter))     continue;
+    else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) from = strtoull(argv[++i], 0, 0);
+    else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc)   to = strtoull(argv[++i], 0, 0);
+    else if (argv[i][0] != '-' && trace_path == 0)           trace_path = argv[i];
+    else                                                     args_ok = false;
+  }
+
+  // NOTE: Memory accesses aren't in the trace
+  Filter_Compile(&filter);
+  if (filter.needs_access_log) args_ok = false;
+
+  if (!args_ok || trace_path == 0)
+  {
+    fprintf(stderr, "Invalid arguments. Expected: render [options] <trace_file>\n"
+                    "  --from <n>                   only print instructions with index >= <n>\n"
+                    "  --to <n>                     only print instructions with index < <n>\n"
+                    "  --trace-ip <ip>[-<ip>]       only print instructions in the ip range\n"
+                    "  --trace-kind <mnemonic>      only print instructions of the kind, e.g. mov\n"
+                    "  --trace-reg <reg|flags>      only print instructions that change the register\n"
+                    "  --trace-every <n>            only print every <n>th instruction\n"
+                    "Without options the output matches the text trace of the run that wrote the trace file.\n");
+  }
+  else
+  {
+    Trace_Reader* reader = malloc(sizeof(Trace_Reader));
+    Memory* scratch      = Platform_AllocateMemory(sizeof(Memory));
+    char* buffer         = malloc(WRITER_DEFAULT_CAPACITY);
+
+    if      (reader == 0 || scratch == 0 || buffer == 0) fprintf(stderr, "Failed to allocate memory\n");
+    else if (!Trace_OpenReader(reader, trace_path))      fprintf(stderr, "Failed to read trace, or not a trace file\n");
+    else
+    {
+      Writer writer;
+      Writer_Init(&writer, stdout, buffer, WRITER_DEFAULT_CAPACITY);
+
+      CPU_State cpu_state = { .memory = scratch };
+      Trace_InitialState(reader, &cpu_state);
+
+      u64 index  = reader->header.instruction_count;
+      u64 clocks = reader->header.clocks;
+
+      Trace_Step step;
+      CPU_State prev_state = cpu_state;
+      while (Trace_ReadStep(reader, &cpu_state, &step))
+      {
+        clocks += TotalClocks(step.clocks);
+
+        // NOTE: Only the instruction bytes are in the trace, decode them on their own
+        memcpy(scratch->mem, step.bytes, step.length);
+        u32 cursor = 0;
+        Instruction instruction = DecodeInstruction(scratch, &cursor);
+
+        if (index >= from && index < to && Filter_Matches(&filter, index, instruction.kind, &prev_state, &cpu_state, 0))
+        {
+          if (reader->header.kind == TraceKind_Estimate) WriteEstimateStep(&writer, instruction, 1, 0, &step.clocks, &clocks, &prev_state, &cpu_state);
+          else                                           WriteExecuteStep(&writer, instruction, &prev_state, &cpu_state);
+        }
+
+        prev_state = cpu_state;
+        index     += 1;
+      }
+
+      Writer_Flush(&writer);
+
+      if (reader->at != reader->size) fprintf(stderr, "Trace is truncated after instruction %llu\n", (unsigned long long)index);
+
+      printf("\nFinal registers:\n");
+      PrintRegisters(&cpu_state);
+
+      Trace_CloseReader(reader);
+    }
+
+    free(buffer);
+    free(reader);
+  }
+}
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 typedef uint8_t  u8;
 typedef uint16_t u16;
@@ -20,37 +21,228 @@ typedef u64 uint;
 #define ASSERT(EX) ((EX) ? 1 : (*(volatile int*)0, 0))
 #define NOT_IMPLEMENTED ASSERT(!"NOT_IMPLEMENTED")
 
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+#define MAX(A, B) ((A) > (B) ? (A) : (B))
+
 #define MEMORY_SIZE 0x100000 // 1 MB
 #define MEMORY_MASK 0x0FFFFF
 
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE  (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_COUNT (MEMORY_SIZE >> MEMORY_PAGE_SHIFT)
+
+// NOTE: Build with SIM86_SHADOW=1 to keep one metadata byte per memory byte and report reads of bytes that were
+//       never written (or loaded). The shadow bytes follow mem, so a check is one extra load at a fixed offset.
+#ifndef SIM86_SHADOW
+#define SIM86_SHADOW 0
+#endif
+
+#define MEMORY_ACCESS_LOG_CAPACITY 64
+
+typedef struct Memory_Access
+{
+  u32 address;
+  u8 size;
+  bool is_write;
+  u8 old_bytes[2]; // NOTE: Only set for writes
+#if SIM86_SHADOW
+  u8 old_shadow[2]; // NOTE: The shadow bytes of old_bytes
+#endif
+} Memory_Access;
+
+typedef struct Memory_Access_Log
+{
+  u32 count;
+  Memory_Access accesses[MEMORY_ACCESS_LOG_CAPACITY];
+} Memory_Access_Log;
+
+#define MEMORY_SHADOW_REPORT_CAPACITY 16
+
+typedef enum Shadow_Flag
+{
+  Shadow_Initialized = (1 << 0),
+  Shadow_Reported    = (1 << 1),
+} Shadow_Flag;
+
 typedef struct Memory
 {
   u8 mem[MEMORY_SIZE];
+
+#if SIM86_SHADOW
+  u8 shadow[MEMORY_SIZE];
+  u32 uninitialized_read_count;
+  u32 uninitialized_reads[MEMORY_SHADOW_REPORT_CAPACITY];
+#endif
+
+  // NOTE: Optional, collects every read and write made through the Read/Write functions until the owner resets count
+  Memory_Access_Log* access_log;
+
+  // NOTE: One bit per page stored to since the last MemoryReset, so resetting only has to clear those
+  u64 dirty_pages[MEMORY_PAGE_COUNT/64];
 } Memory;
 
+void
+MemoryMarkDirty(Memory* memory, u32 address, u32 size)
+{
+  if (size != 0)
+  {
+    u32 first = (address & MEMORY_MASK) >> MEMORY_PAGE_SHIFT;
+    u32 last  = ((address + size - 1) & MEMORY_MASK) >> MEMORY_PAGE_SHIFT;
+
+    for (u32 page = first;; page = (page + 1) % MEMORY_PAGE_COUNT)
+    {
+      memory->dirty_pages[page/64] |= 1ull << (page%64);
+      if (page == last) break;
+    }
+  }
+}
+
+// NOTE: Zeroes every dirty page, leaving memory as if freshly allocated
+void
+MemoryReset(Memory* memory)
+{
+  for (u32 i = 0; i < MEMORY_PAGE_COUNT/64; ++i)
+  {
+    u64 bits = memory->dirty_pages[i];
+    for (u32 page = i*64; bits != 0; ++page, bits >>= 1)
+    {
+      if (bits & 1)
+      {
+        memset(memory->mem + page*MEMORY_PAGE_SIZE, 0, MEMORY_PAGE_SIZE);
+#if SIM86_SHADOW
+        memset(memory->shadow + page*MEMORY_PAGE_SIZE, 0, MEMORY_PAGE_SIZE);
+#endif
+      }
+    }
+
+    memory->dirty_pages[i] = 0;
+  }
+
+#if SIM86_SHADOW
+  memory->uninitialized_read_count = 0;
+#endif
+
+  memory->access_log = 0;
+}
+
+#if SIM86_SHADOW
+void
+Shadow__ReportUninitializedRead(Memory* memory, u32 address)
+{
+  // NOTE: Each address is reported once, the next read sees a non-zero shadow byte
+  memory->shadow[address] = Shadow_Reported;
+
+  if (memory->uninitialized_read_count < MEMORY_SHADOW_REPORT_CAPACITY)
+  {
+    memory->uninitialized_reads[memory->uninitialized_read_count] = address;
+  }
+
+  memory->uninitialized_read_count += 1;
+}
+
+void
+ShadowMarkInitialized(Memory* memory, u32 address, u32 size)
+{
+  for (u32 i = 0; i < size; ++i) memory->shadow[(address + i) & MEMORY_MASK] |= Shadow_Initialized;
+}
+
+// NOTE: Prints and clears the uninitialized reads collected since the last call, ip is the instruction responsible
+void
+ShadowReportReads(Memory* memory, u32 ip, FILE* file)
+{
+  u32 count = MIN(memory->uninitialized_read_count, MEMORY_SHADOW_REPORT_CAPACITY);
+  for (u32 i = 0; i < count; ++i)
+  {
+    fprintf(file, "uninitialized read: ip 0x%04x, address 0x%05x\n", ip, memory->uninitialized_reads[i]);
+  }
+
+  if (memory->uninitialized_read_count > count)
+  {
+    fprintf(file, "uninitialized read: ip 0x%04x, %u more\n", ip, memory->uninitialized_read_count - count);
+  }
+
+  memory->uninitialized_read_count = 0;
+}
+#endif
+
+u8
+Memory__Load(Memory* memory, u32 address)
+{
+  address &= MEMORY_MASK;
+
+#if SIM86_SHADOW
+  if (memory->shadow[address] == 0) Shadow__ReportUninitializedRead(memory, address);
+#endif
+
+  return memory->mem[address];
+}
+
+void
+Memory__Store(Memory* memory, u32 address, u8 byte)
+{
+  address &= MEMORY_MASK;
+
+#if SIM86_SHADOW
+  memory->shadow[address] = Shadow_Initialized;
+#endif
+
+  memory->dirty_pages[address >> (MEMORY_PAGE_SHIFT + 6)] |= 1ull << ((address >> MEMORY_PAGE_SHIFT) % 64);
+  memory->mem[address] = byte;
+}
+
+void
+Memory__LogAccess(Memory* memory, u32 address, u8 size, bool is_write)
+{
+  Memory_Access_Log* log = memory->access_log;
+  ASSERT(log->count < MEMORY_ACCESS_LOG_CAPACITY);
+
+  Memory_Access* access = &log->accesses[log->count++];
+  access->address  = address & MEMORY_MASK;
+  access->size     = size;
+  access->is_write = is_write;
+
+  if (is_write)
+  {
+    access->old_bytes[0] = memory->mem[address & MEMORY_MASK];
+    access->old_bytes[1] = memory->mem[(address + 1) & MEMORY_MASK];
+#if SIM86_SHADOW
+    access->old_shadow[0] = memory->shadow[address & MEMORY_MASK];
+    access->old_shadow[1] = memory->shadow[(address + 1) & MEMORY_MASK];
+#endif
+  }
+}
+
 u8
 ReadByte(Memory* memory, u32 address)
 {
-  return memory->mem[address & MEMORY_MASK];
+  if (memory->access_log != 0) Memory__LogAccess(memory, address, 1, false);
+
+  return Memory__Load(memory, address);
 }
 
 void
 WriteByte(Memory* memory, u32 address, u8 byte)
 {
-  memory->mem[address & MEMORY_MASK] = byte;
+  if (memory->access_log != 0) Memory__LogAccess(memory, address, 1, true);
+
+  Memory__Store(memory, address, byte);
 }
 
 u16
 ReadWord(Memory* memory, u32 address)
 {
-  return ((u16)ReadByte(memory, address + 1) << 8) | ReadByte(memory, address);
+  if (memory->access_log != 0) Memory__LogAccess(memory, address, 2, false);
+
+  return ((u16)Memory__Load(memory, address + 1) << 8) | Memory__Load(memory, address);
 }
 
 void
 WriteWord(Memory* memory, u32 address, u16 word)
 {
-  memory->mem[address     & MEMORY_MASK] = word & 0xFF;
-  memory->mem[(address+1) & MEMORY_MASK] = word >> 8;
+  if (memory->access_log != 0) Memory__LogAccess(memory, address, 2, true);
+
+  Memory__Store(memory, address,     word & 0xFF);
+  Memory__Store(memory, address + 1, word >> 8);
 }
 
 typedef enum Register_Kind
@@ -281,6 +473,76 @@ typedef struct Instruction
   };
 } Instruction;
 
+// NOTE: An instruction's clocks in a timing model, the part known from its encoding alone. See InstructionClocks for
+//       the rest and sim86_timing.h for the models.
+typedef struct Instruction_Timing
+{
+  u8 base;            // NOTE: Not taken for branches, the setup before the first repetition for rep strings
+  u8 ea;              // NOTE: Including a segment override
+  u8 transfers;       // NOTE: Memory and i/o transfers
+  u8 taken;           // NOTE: Extra clocks when the branch is taken
+  u8 per_count;       // NOTE: Clocks per repetition of a rep string, or per bit of a shift by cl
+  u8 count_transfers; // NOTE: Transfers per repetition
+  u8 range;           // NOTE: Operand dependent clocks of mul and div above base, see OperandCount
+  u8 fault;           // NOTE: Clocks of the interrupt a divide error raises
+  u8 even_penalty;    // NOTE: Extra clocks per word transfer at an even address, for a bus narrower than a word
+  u8 odd_penalty;     // NOTE: Extra clocks per word transfer at an odd address
+  bool word;          // NOTE: The transfers move words
+  bool has_ea;
+} Instruction_Timing;
+
+// NOTE: The operands of an instruction as far as its clocks go, a timing model has an entry per kind, shape and
+//       operand size
+typedef enum Timing_Shape
+{
+  TimingShape_None = 0, // NOTE: Implied operands
+  TimingShape_Reg,      // NOTE: Register in the opcode
+  TimingShape_RMReg,    // NOTE: Register in r/m
+  TimingShape_Mem,
+  TimingShape_RegReg,
+  TimingShape_RegMem,   // NOTE: To a register from memory
+  TimingShape_MemReg,   // NOTE: To memory from a register
+  TimingShape_RegImm,
+  TimingShape_MemImm,
+  TimingShape_AccImm,
+  TimingShape_AccMem,
+  TimingShape_SegReg,   // NOTE: Segment register in the opcode, push and pop
+  TimingShape_Imm,
+  TimingShape_Near,
+  TimingShape_Far,
+  TimingShape_Rep,
+  TimingShape_RegCL,
+  TimingShape_MemCL,
+
+  TIMING_SHAPE_COUNT
+} Timing_Shape;
+
+typedef enum Timing_EA
+{
+  TimingEA_None = 0,
+  TimingEA_Disp,          // NOTE: [disp]
+  TimingEA_Base,          // NOTE: [bx], [si], [di]
+  TimingEA_Bp,            // NOTE: [bp], which is encoded as [bp + 0]
+  TimingEA_BaseDisp,
+  TimingEA_Index,         // NOTE: [bx + si], [bp + di]
+  TimingEA_IndexSlow,     // NOTE: [bx + di], [bp + si]
+  TimingEA_IndexDisp,
+  TimingEA_IndexDispSlow,
+
+  TIMING_EA_COUNT
+} Timing_EA;
+
+#define TIMING_FORM_COUNT (INSTRUCTION_COUNT*TIMING_SHAPE_COUNT*2)
+
+// NOTE: What a timing model needs to know about an instruction, the same for every model
+typedef struct Timing_Form
+{
+  u16 index; // NOTE: (kind*TIMING_SHAPE_COUNT + shape)*2 + w, into a model's entries
+  u8 ea;     // NOTE: Timing_EA
+  bool seg;  // NOTE: Segment override
+  bool lock;
+} Timing_Form;
+
 typedef struct Instruction_Details
 {
   Instruction_Kind kind;
@@ -562,6 +824,78 @@ Instruction_Details InstructionDetailsFromFirstByte[256] = {
   [0xFF] = {0},
 };
 
+bool
+HasEffectiveAddress(Instruction instruction)
+{
+  Instruction_Operand_Format format = instruction.operand_format;
+  return (format >= InstructionOperandFormat_RMRM && format <= InstructionOperandFormat_RMV && instruction.mod != 3);
+}
+
+Timing_EA
+TimingEAOf(u8 mod, u8 rm, u16 disp)
+{
+  Timing_EA result;
+  if      (mod == 0 && rm == 6)              result = TimingEA_Disp;
+  else if (mod == 0 && rm >= 4)              result = TimingEA_Base;
+  else if (mod != 0 && rm == 6 && disp == 0) result = TimingEA_Bp;
+  else if (mod != 0 && rm >= 4)              result = TimingEA_BaseDisp;
+  else if (mod == 0)                         result = (rm == 1 || rm == 2 ? TimingEA_IndexSlow     : TimingEA_Index);
+  else                                       result = (rm == 1 || rm == 2 ? TimingEA_IndexDispSlow : TimingEA_IndexDisp);
+
+  return result;
+}
+
+Timing_Form
+TimingFormOf(Instruction* instruction)
+{
+  Instruction_Kind kind             = instruction->kind;
+  Instruction_Operand_Format format = instruction->operand_format;
+  bool w   = !!(instruction->flags & InstructionFlag_W);
+  bool d   = !!(instruction->flags & InstructionFlag_D);
+  bool v   = !!(instruction->flags & InstructionFlag_V);
+  bool rep = !!(instruction->prefix & (InstructionPrefix_RepNZ | InstructionPrefix_RepZ));
+  bool mem = HasEffectiveAddress(*instruction);
+
+  Timing_Shape shape;
+  if      (kind >= Instruction_Movs && kind <= Instruction_Scas && rep) shape = TimingShape_Rep;
+  else if (kind >= Instruction_Rol && kind <= Instruction_Sar && v)     shape = (mem ? TimingShape_MemCL : TimingShape_RegCL);
+  else
+  {
+    switch (format)
+    {
+      case InstructionOperandFormat_RMRM:
+      case InstructionOperandFormat_RMSegReg:     shape = (!mem ? TimingShape_RegReg : d ? TimingShape_RegMem : TimingShape_MemReg); break;
+      case InstructionOperandFormat_RegMem:       shape = TimingShape_Mem;                                                           break;
+      case InstructionOperandFormat_RMImmed:      shape = (mem ? TimingShape_MemImm : TimingShape_RegImm);                           break;
+      case InstructionOperandFormat_RM:
+      case InstructionOperandFormat_OpcodeSource:
+      case InstructionOperandFormat_RMV:          shape = (mem ? TimingShape_Mem : TimingShape_RMReg);                               break;
+      case InstructionOperandFormat_AccImmed:     shape = TimingShape_AccImm;                                                        break;
+      case InstructionOperandFormat_Reg:
+      case InstructionOperandFormat_AccReg:       shape = TimingShape_Reg;                                                           break;
+      case InstructionOperandFormat_IpInc8:
+      case InstructionOperandFormat_NearProc:     shape = TimingShape_Near;                                                          break;
+      case InstructionOperandFormat_FarProc:      shape = TimingShape_Far;                                                           break;
+      case InstructionOperandFormat_AccMem:       shape = TimingShape_AccMem;                                                        break;
+      case InstructionOperandFormat_RegImmed:     shape = TimingShape_RegImm;                                                        break;
+      case InstructionOperandFormat_Immed:
+      case InstructionOperandFormat_InOutImmed:   shape = TimingShape_Imm;                                                           break;
+      case InstructionOperandFormat_ES:
+      case InstructionOperandFormat_SS:
+      case InstructionOperandFormat_CS:
+      case InstructionOperandFormat_DS:           shape = TimingShape_SegReg;                                                        break;
+      default:                                    shape = TimingShape_None;                                                          break;
+    }
+  }
+
+  return (Timing_Form){
+    .index = (u16)((kind*TIMING_SHAPE_COUNT + shape)*2 + w),
+    .ea    = (u8)(mem ? TimingEAOf(instruction->mod, instruction->rm, instruction->disp) : TimingEA_None),
+    .seg   = !!(instruction->prefix & (InstructionPrefix_SegES | InstructionPrefix_SegCS | InstructionPrefix_SegSS | InstructionPrefix_SegDS)),
+    .lock  = !!(instruction->prefix & InstructionPrefix_Lock),
+  };
+}
+
 Instruction
 DecodeInstruction(Memory* memory, u32* cursor)
 {
@@ -925,8 +1259,89 @@ char* RegisterNames[] = {
   [Register_BH] = "bh",
 };
 
+// NOTE: Buffered text output for traces. Numbers are converted by hand straight into the buffer, and the buffer
+//       reaches the file in large writes once it fills up or is flushed. The put functions don't check for space,
+//       callers reserve room for a whole line up front instead. A writer is not shared between threads.
+#define WRITER_DEFAULT_CAPACITY (1 << 20)
+#define WRITER_LINE_MAX         512
+
+typedef struct Writer
+{
+  FILE* file;
+  char* buffer;
+  char* at;
+  char* end;
+} Writer;
+
+void
+Writer_Init(Writer* writer, FILE* file, char* buffer, u32 capacity)
+{
+  ASSERT(capacity >= WRITER_LINE_MAX);
+  *writer = (Writer){ .file = file, .buffer = buffer, .at = buffer, .end = buffer + capacity };
+}
+
+void
+Writer_Flush(Writer* writer)
+{
+  if (writer->at != writer->buffer) fwrite(writer->buffer, 1, writer->at - writer->buffer, writer->file);
+  writer->at = writer->buffer;
+}
+
+void
+Writer_Reserve(Writer* writer, u32 size)
+{
+  ASSERT(size <= WRITER_LINE_MAX);
+  if ((u64)(writer->end - writer->at) < size) Writer_Flush(writer);
+}
+
 void
-PrintInstruction__PrintMemoryRef(Instruction_Prefix prefix, u8 mod, u8 rm, bool w, u16 disp, FILE* file)
+Writer_Char(Writer* writer, char c)
+{
+  *writer->at++ = c;
+}
+
+void
+Writer_String(Writer* writer, char* string)
+{
+  while (*string != 0) *writer->at++ = *string++;
+}
+
+void
+Writer_Unsigned(Writer* writer, u64 value)
+{
+  u32 count = 1;
+  for (u64 rest = value / 10; rest != 0; rest /= 10) ++count;
+
+  writer->at += count;
+  char* out = writer->at;
+  do *--out = (char)('0' + value % 10), value /= 10; while (value != 0);
+}
+
+// NOTE: Equivalent to %d, or %+d with force_sign
+void
+Writer_Signed(Writer* writer, i32 value, bool force_sign)
+{
+  if      (value < 0)  Writer_Char(writer, '-');
+  else if (force_sign) Writer_Char(writer, '+');
+
+  Writer_Unsigned(writer, (value < 0 ? (u32)-(i64)value : (u32)value));
+}
+
+// NOTE: Equivalent to %x, or %0<min_digits>x
+void
+Writer_Hex(Writer* writer, u32 value, u32 min_digits)
+{
+  u32 count = 1;
+  while (count < 8 && (value >> 4*count) != 0) ++count;
+  count = MAX(count, min_digits);
+
+  writer->at += count;
+  char* out = writer->at;
+  for (u32 i = 0; i < count; ++i) *--out = "0123456789abcdef"[value & 0xF], value >>= 4;
+}
+
+void
+WriteInstruction__MemoryRef(Writer* writer, Instruction_Prefix prefix, u8 mod, u8 rm, u16 disp)
 {
   ASSERT(mod != 3);
 
@@ -941,52 +1356,42 @@ PrintInstruction__PrintMemoryRef(Instruction_Prefix prefix, u8 mod, u8 rm, bool
     "bx"
   };
 
-  if (prefix & InstructionPrefix_SegES) fprintf(file, "es:");
-  if (prefix & InstructionPrefix_SegCS) fprintf(file, "cs:");
-  if (prefix & InstructionPrefix_SegSS) fprintf(file, "ss:");
-  if (prefix & InstructionPrefix_SegDS) fprintf(file, "ds:");
+  if (prefix & InstructionPrefix_SegES) Writer_String(writer, "es:");
+  if (prefix & InstructionPrefix_SegCS) Writer_String(writer, "cs:");
+  if (prefix & InstructionPrefix_SegSS) Writer_String(writer, "ss:");
+  if (prefix & InstructionPrefix_SegDS) Writer_String(writer, "ds:");
 
-  fprintf(file, "[");
+  Writer_Char(writer, '[');
 
   if (mod == 0)
   {
-    if (rm == 6) fprintf(file, "%+d", disp);
-    else         fprintf(file, "%s", effective_address_patterns[rm]);
+    if (rm == 6) Writer_Signed(writer, disp, true);
+    else         Writer_String(writer, effective_address_patterns[rm]);
   }
   else
   {
-    if (rm == 6 && disp == 0) fprintf(file, "%s", effective_address_patterns[rm]);
-    else                      fprintf(file, "%s%+d", effective_address_patterns[rm], (mod == 1 ? (int)(i8)disp : (int)(i16)disp));
+    Writer_String(writer, effective_address_patterns[rm]);
+    if (rm != 6 || disp != 0) Writer_Signed(writer, (mod == 1 ? (i32)(i8)disp : (i32)(i16)disp), true);
   }
 
-  fprintf(file, "]");
+  Writer_Char(writer, ']');
 }
 
 void
-PrintInstruction(Instruction instruction, u32 address, FILE* file)
+WriteInstruction(Writer* writer, Instruction instruction, u32 address)
 {
-  if (instruction.prefix & InstructionPrefix_Lock)
-  {
-    fprintf(file, "lock ");
-  }
+  if (instruction.prefix & InstructionPrefix_Lock)  Writer_String(writer, "lock ");
+  if (instruction.prefix & InstructionPrefix_RepNZ) Writer_String(writer, "repnz ");
+  if (instruction.prefix & InstructionPrefix_RepZ)  Writer_String(writer, "repz ");
 
-  if (instruction.prefix & InstructionPrefix_RepNZ)
-  {
-    fprintf(file, "repnz ");
-  }
-
-  if (instruction.prefix & InstructionPrefix_RepZ)
-  {
-    fprintf(file, "repz ");
-  }
-
-  fprintf(file, InstructionNames[instruction.kind]);
+  Writer_String(writer, InstructionNames[instruction.kind]);
 
   bool w = instruction.flags & InstructionFlag_W;
   bool d = instruction.flags & InstructionFlag_D;
-  bool s = instruction.flags & InstructionFlag_S;
   bool v = instruction.flags & InstructionFlag_V;
-  bool z = instruction.flags & InstructionFlag_Z;
+
+  char* size_name = (w ? " word" : " byte");
+  char* acc_name  = RegisterNames[w ? Register_AX : Register_AL];
 
   switch (instruction.operand_format)
   {
@@ -996,142 +1401,151 @@ PrintInstruction(Instruction instruction, u32 address, FILE* file)
     {
       char* reg_name = RegisterNames[instruction.reg];
 
-      if (instruction.operand_format == InstructionOperandFormat_RMRM && instruction.mod != 3 && !d) printf(" %s", (w ? "word" : "byte"));
+      if (instruction.operand_format == InstructionOperandFormat_RMRM && instruction.mod != 3 && !d) Writer_String(writer, size_name);
+
+      Writer_Char(writer, ' ');
 
       if (instruction.mod == 3)
       {
         char* rm_reg_name = RegisterNames[instruction.rm];
-        if (d) fprintf(file, " %s, %s", reg_name, rm_reg_name);
-        else   fprintf(file, " %s, %s", rm_reg_name, reg_name);
+        Writer_String(writer, (d ? reg_name : rm_reg_name));
+        Writer_String(writer, ", ");
+        Writer_String(writer, (d ? rm_reg_name : reg_name));
       }
       else
       {
-        if (d) fprintf(file, " %s, ", reg_name);
-        else   fprintf(file, " ");
+        if (d) Writer_String(writer, reg_name), Writer_String(writer, ", ");
 
-        PrintInstruction__PrintMemoryRef(instruction.prefix, instruction.mod, instruction.rm, w, instruction.disp, file);
+        WriteInstruction__MemoryRef(writer, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
 
-        if (!d) fprintf(file, ", %s", reg_name);
+        if (!d) Writer_String(writer, ", "), Writer_String(writer, reg_name);
       }
-
     } break;
 
     case InstructionOperandFormat_RMV:
     {
-      if (instruction.mod == 3) fprintf(file, " %s", RegisterNames[instruction.rm]);
+      Writer_Char(writer, ' ');
+      if (instruction.mod == 3) Writer_String(writer, RegisterNames[instruction.rm]);
       else
       {
-        fprintf(file, " %s ", (w ? "word" : "byte"));
-        PrintInstruction__PrintMemoryRef(instruction.prefix, instruction.mod, instruction.rm, w, instruction.disp, file);
+        Writer_String(writer, size_name + 1);
+        Writer_Char(writer, ' ');
+        WriteInstruction__MemoryRef(writer, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
       }
 
-      fprintf(file, ", %s", (v ? RegisterNames[Register_CL] : "1"));
+      Writer_String(writer, ", ");
+      Writer_String(writer, (v ? RegisterNames[Register_CL] : "1"));
     } break;
 
     case InstructionOperandFormat_RegImmed:
     {
-      fprintf(file, " %s, %u", RegisterNames[instruction.movreg], instruction.data);
+      Writer_Char(writer, ' ');
+      Writer_String(writer, RegisterNames[instruction.movreg]);
+      Writer_String(writer, ", ");
+      Writer_Unsigned(writer, instruction.data);
     } break;
 
     case InstructionOperandFormat_AccImmed:
-    {
-      char* acc_name = RegisterNames[w ? Register_AX : Register_AL];
-      if (d) fprintf(file, " %s, %u", acc_name, instruction.data);
-      else   fprintf(file, " %u, %s", instruction.data, acc_name);
-    } break;
-
     case InstructionOperandFormat_InOutImmed:
     {
-      char* acc_name = RegisterNames[w ? Register_AX : Register_AL];
-      if (d) fprintf(file, " %s, %u", acc_name, instruction.data);
-      else   fprintf(file, " %u, %s", instruction.data, acc_name);
+      Writer_Char(writer, ' ');
+      if (d) Writer_String(writer, acc_name), Writer_String(writer, ", "), Writer_Unsigned(writer, instruction.data);
+      else   Writer_Unsigned(writer, instruction.data), Writer_String(writer, ", "), Writer_String(writer, acc_name);
     } break;
 
     case InstructionOperandFormat_Immed:
     {
-      fprintf(file, " %u", instruction.data);
+      Writer_Char(writer, ' ');
+      Writer_Unsigned(writer, instruction.data);
     } break;
 
-    case InstructionOperandFormat_ES: fprintf(file, " %s", RegisterNames[Register_ES]); break;
-    case InstructionOperandFormat_CS: fprintf(file, " %s", RegisterNames[Register_CS]); break;
-    case InstructionOperandFormat_SS: fprintf(file, " %s", RegisterNames[Register_SS]); break;
-    case InstructionOperandFormat_DS: fprintf(file, " %s", RegisterNames[Register_DS]); break;
+    case InstructionOperandFormat_ES: Writer_Char(writer, ' '), Writer_String(writer, RegisterNames[Register_ES]); break;
+    case InstructionOperandFormat_CS: Writer_Char(writer, ' '), Writer_String(writer, RegisterNames[Register_CS]); break;
+    case InstructionOperandFormat_SS: Writer_Char(writer, ' '), Writer_String(writer, RegisterNames[Register_SS]); break;
+    case InstructionOperandFormat_DS: Writer_Char(writer, ' '), Writer_String(writer, RegisterNames[Register_DS]); break;
 
-    case InstructionOperandFormat_Reg: fprintf(file, " %s", RegisterNames[instruction.reg]); break;
+    case InstructionOperandFormat_Reg: Writer_Char(writer, ' '), Writer_String(writer, RegisterNames[instruction.reg]); break;
 
     case InstructionOperandFormat_AccReg:
-    {
-      char* acc_name = RegisterNames[w ? Register_AX : Register_AL];
-      char* aux_name = RegisterNames[instruction.reg];
-      if (d) fprintf(file, " %s, %s", aux_name, acc_name);
-      else   fprintf(file, " %s, %s", acc_name, aux_name);
-    } break;
-
     case InstructionOperandFormat_InOutReg:
     {
-      char* acc_name = RegisterNames[w ? Register_AX : Register_AL];
-      char* aux_name = RegisterNames[Register_DX];
-      if (d) fprintf(file, " %s, %s", aux_name, acc_name);
-      else   fprintf(file, " %s, %s", acc_name, aux_name);
+      char* aux_name = RegisterNames[instruction.operand_format == InstructionOperandFormat_AccReg ? instruction.reg : Register_DX];
+
+      Writer_Char(writer, ' ');
+      Writer_String(writer, (d ? aux_name : acc_name));
+      Writer_String(writer, ", ");
+      Writer_String(writer, (d ? acc_name : aux_name));
     } break;
 
     case InstructionOperandFormat_IpInc8:
     {
-      fprintf(file, " $%+d", (int)(i16)instruction.disp + instruction.byte_size);
+      Writer_String(writer, " $");
+      Writer_Signed(writer, (i32)(i16)instruction.disp + instruction.byte_size, true);
     } break;
 
     case InstructionOperandFormat_FarProc:
     {
-      fprintf(file, " %u:%u", instruction.seg, instruction.disp);
+      Writer_Char(writer, ' ');
+      Writer_Unsigned(writer, instruction.seg);
+      Writer_Char(writer, ':');
+      Writer_Unsigned(writer, instruction.disp);
     } break;
 
     case InstructionOperandFormat_NearProc:
     {
       u16 addr = (u16)((int)(address + instruction.byte_size) + (int)instruction.disp);
 
-      fprintf(file, " %u", addr);
+      Writer_Char(writer, ' ');
+      Writer_Unsigned(writer, addr);
     } break;
 
     case InstructionOperandFormat_RMImmed:
+    case InstructionOperandFormat_RM:
     {
-      if (instruction.mod == 3) printf(" %s, %u", RegisterNames[instruction.rm], instruction.data);
+      Writer_Char(writer, ' ');
+      if (instruction.mod == 3) Writer_String(writer, RegisterNames[instruction.rm]);
       else
       {
-        fprintf(file, " %s ", (w ? "word" : "byte"));
-        PrintInstruction__PrintMemoryRef(instruction.prefix, instruction.mod, instruction.rm, w, instruction.disp, file);
-        fprintf(file, ", %u", instruction.data);
+        Writer_String(writer, size_name + 1);
+        Writer_Char(writer, ' ');
+        WriteInstruction__MemoryRef(writer, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
       }
-    } break;
 
-    case InstructionOperandFormat_RM:
-    {
-      if (instruction.mod == 3) fprintf(file, " %s", RegisterNames[instruction.rm]);
-      else
+      if (instruction.operand_format == InstructionOperandFormat_RMImmed)
       {
-        fprintf(file, " %s ", (w ? "word" : "byte"));
-        PrintInstruction__PrintMemoryRef(instruction.prefix, instruction.mod, instruction.rm, w, instruction.disp, file);
+        Writer_String(writer, ", ");
+        Writer_Unsigned(writer, instruction.data);
       }
     } break;
 
     case InstructionOperandFormat_AccMem:
     {
-      char* reg_name = RegisterNames[w ? Register_AX : Register_AL];
+      if (d) Writer_Char(writer, ' '), Writer_String(writer, acc_name), Writer_String(writer, ", ");
 
-      if (d) printf(" %s, ", reg_name);
+      WriteInstruction__MemoryRef(writer, instruction.prefix, 0, 6, instruction.disp);
 
-      PrintInstruction__PrintMemoryRef(instruction.prefix, 0, 6, w, instruction.disp, file);
-
-      if (!d) printf(", %s", reg_name);
+      if (!d) Writer_String(writer, ", "), Writer_String(writer, acc_name);
     } break;
 
     case InstructionOperandFormat_SrcStr:
     case InstructionOperandFormat_DstStr:
-    case InstructionOperandFormat_DstStrSrcStr: fprintf(file, "%c", (w ? 'w' : 'b')); break;
+    case InstructionOperandFormat_DstStrSrcStr: Writer_Char(writer, (w ? 'w' : 'b')); break;
 
     case InstructionOperandFormat_OpcodeSource: break;
   }
 }
 
+void
+PrintInstruction(Instruction instruction, u32 address, FILE* file)
+{
+  char buffer[WRITER_LINE_MAX];
+  Writer writer;
+  Writer_Init(&writer, file, buffer, sizeof(buffer));
+
+  WriteInstruction(&writer, instruction, address);
+  Writer_Flush(&writer);
+}
+
 typedef enum Flag
 {
   CF = 0,
@@ -1175,14 +1589,36 @@ typedef struct CPU_State
   u16 register_file[REGISTER_COUNT];
   u16 flags;
   u32 ip;
-  u16 es;
-  u16 cs;
-  u16 ds;
-  u16 ss;
 
   Memory* memory;
 } CPU_State;
 
+typedef struct Run_Info
+{
+  u64 instruction_count;
+  u64 clocks;
+
+  // NOTE: Linear address range of the loaded image, execution stops when cs:ip leaves it
+  u32 code_start;
+  u32 code_end;
+} Run_Info;
+
+typedef struct Clocks
+{
+  uint base;
+  uint ea;
+  uint penalty;
+  uint fetch; // NOTE: Waiting on the prefetch queue, only the bus interface model has any
+  uint wait;  // NOTE: DRAM refresh and wait states, only the machine model has any
+  bool has_ea;
+} Clocks;
+
+uint
+TotalClocks(Clocks clocks)
+{
+  return clocks.base + clocks.ea + clocks.penalty + clocks.fetch + clocks.wait;
+}
+
 void
 SetRegister(CPU_State* state, Register_Kind kind, u16 data)
 {
@@ -1225,33 +1661,332 @@ GetFlag(CPU_State* state, Flag flag)
 u32
 EffectiveAddress(CPU_State* state, Instruction_Prefix prefix, u8 mod, u8 rm, u16 disp)
 {
-  u32 address = 0;
-  if      (prefix & InstructionPrefix_SegES) address = (u32)state->es << 4;
-  else if (prefix & InstructionPrefix_SegCS) address = (u32)state->cs << 4;
-  else if (prefix & InstructionPrefix_SegDS) address = (u32)state->ds << 4;
-  else if (prefix & InstructionPrefix_SegSS) address = (u32)state->ss << 4;
-
+  // NOTE: bp based addressing defaults to ss, everything else to ds
+  Register_Kind segment = (rm == 2 || rm == 3 || (rm == 6 && mod != 0) ? Register_SS : Register_DS);
+  if      (prefix & InstructionPrefix_SegES) segment = Register_ES;
+  else if (prefix & InstructionPrefix_SegCS) segment = Register_CS;
+  else if (prefix & InstructionPrefix_SegDS) segment = Register_DS;
+  else if (prefix & InstructionPrefix_SegSS) segment = Register_SS;
+
+  u16 offset = 0;
   switch (rm)
   {
-    case 0: address = (u32)GetRegister(state, Register_BX) + (u32)GetRegister(state, Register_SI); break;
-    case 1: address = (u32)GetRegister(state, Register_BX) + (u32)GetRegister(state, Register_DI); break;
-    case 2: address = (u32)GetRegister(state, Register_BP) + (u32)GetRegister(state, Register_SI); break;
-    case 3: address = (u32)GetRegister(state, Register_BP) + (u32)GetRegister(state, Register_DI); break;
-    case 4: address = (u32)GetRegister(state, Register_SI);                                        break;
-    case 5: address = (u32)GetRegister(state, Register_DI);                                        break;
-    case 6: address = (u32)GetRegister(state, Register_BP);                                        break;
-    case 7: address = (u32)GetRegister(state, Register_BX);                                        break;
+    case 0: offset = GetRegister(state, Register_BX) + GetRegister(state, Register_SI); break;
+    case 1: offset = GetRegister(state, Register_BX) + GetRegister(state, Register_DI); break;
+    case 2: offset = GetRegister(state, Register_BP) + GetRegister(state, Register_SI); break;
+    case 3: offset = GetRegister(state, Register_BP) + GetRegister(state, Register_DI); break;
+    case 4: offset = GetRegister(state, Register_SI);                                   break;
+    case 5: offset = GetRegister(state, Register_DI);                                   break;
+    case 6: offset = GetRegister(state, Register_BP);                                   break;
+    case 7: offset = GetRegister(state, Register_BX);                                   break;
+  }
+
+  if (mod == 0 && rm == 6) offset  = disp;
+  else                     offset += disp;
+
+  return (((u32)GetRegister(state, segment) << 4) + offset) & MEMORY_MASK;
+}
+
+// NOTE: Address of the instruction's memory transfers before it executes, only its parity matters to the clocks.
+//       Stack pushes and pops move sp by 2, string ops si and di by 2 for words, so the parity holds for all of them.
+u32
+TransferAddress(CPU_State* state, Instruction instruction)
+{
+  Instruction_Operand_Format format = instruction.operand_format;
+
+  u32 result;
+  if      (HasEffectiveAddress(instruction))               result = EffectiveAddress(state, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
+  else if (format == InstructionOperandFormat_AccMem)      result = EffectiveAddress(state, instruction.prefix, 0, 6, instruction.disp);
+  else if (format == InstructionOperandFormat_DstStr)      result = ((u32)GetRegister(state, Register_ES) << 4) + GetRegister(state, Register_DI);
+  else if (format == InstructionOperandFormat_SrcStr ||
+           format == InstructionOperandFormat_DstStrSrcStr) result = ((u32)GetRegister(state, Register_DS) << 4) + GetRegister(state, Register_SI);
+  else                                                      result = ((u32)GetRegister(state, Register_SS) << 4) + GetRegister(state, Register_SP);
+
+  return result & MEMORY_MASK;
+}
+
+// NOTE: Adds the dynamic part to an instruction's timing. address is its TransferAddress, count the repetitions a
+//       rep string made or the bits a shift by cl moved, see RepeatCount.
+Clocks
+InstructionClocks(Instruction_Timing timing, u32 address, bool branch_taken, u32 count)
+{
+  uint transfers = timing.transfers + count*timing.count_transfers;
+  uint penalty   = (timing.word ? (address%2 != 0 ? timing.odd_penalty : timing.even_penalty)*transfers : 0);
+
+  return (Clocks){
+    .base    = timing.base + (branch_taken ? timing.taken : 0) + count*timing.per_count,
+    .ea      = timing.ea,
+    .penalty = penalty,
+    .has_ea  = timing.has_ea,
+  };
+}
+
+u16
+ReadRMOperand(CPU_State* state, Instruction instruction)
+{
+  u16 result;
+  if (instruction.mod == 3) result = GetRegister(state, instruction.rm);
+  else
+  {
+    u32 address = EffectiveAddress(state, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
+    result      = (instruction.flags & InstructionFlag_W ? ReadWord(state->memory, address) : ReadByte(state->memory, address));
+  }
+
+  return result;
+}
+
+// NOTE: The dividend is dx:ax for words and ax for bytes. Returns false on a divide error, a zero divisor or a
+//       quotient that doesn't fit. The 8086 also faults on the most negative quotient, -128 or -32768.
+bool
+Divide(u32 dividend, u16 divisor, bool w, bool is_signed, u16* quotient, u16* remainder)
+{
+  bool result = (divisor != 0);
+  if (result && is_signed)
+  {
+    // NOTE: In 64 bits, as the host traps on dividing the most negative 32 bit dividend by -1
+    i64 n = (w ? (i32)dividend : (i16)dividend);
+    i64 d = (w ? (i16)divisor  : (i8)divisor);
+    i64 q = n / d;
+
+    result     = (w ? q >= -32767 && q <= 32767 : q >= -127 && q <= 127);
+    *quotient  = (u16)q;
+    *remainder = (u16)(n % d);
   }
+  else if (result)
+  {
+    u32 q = dividend / divisor;
 
-  if (mod == 0 && rm == 6) address  = disp;
-  else                     address += (i16)disp;
+    result     = (q <= (w ? 0xFFFFu : 0xFFu));
+    *quotient  = (u16)q;
+    *remainder = (u16)(dividend % divisor);
+  }
 
-  return address;
+  return result;
+}
+
+uint
+CountBits(u32 value)
+{
+  uint result = 0;
+  for (; value != 0; value &= value - 1) ++result;
+
+  return result;
 }
 
+// NOTE: The count of a shift by cl, or the operand dependent clocks of mul, imul, div and idiv, taken from the state
+//       before the instruction executes. The multiply and divide loops spend a clock more per set bit of the
+//       multiplier or quotient, so the count spreads the set bits over the timing's range above its base. A divide
+//       error adds the interrupt instead.
+u32
+OperandCount(CPU_State* state, Instruction instruction, Instruction_Timing timing)
+{
+  Instruction_Kind kind = instruction.kind;
+  bool w                = !!(instruction.flags & InstructionFlag_W);
+
+  u32 result = 0;
+  if (kind >= Instruction_Rol && kind <= Instruction_Sar && (instruction.flags & InstructionFlag_V))
+  {
+    result = GetRegister(state, Register_CL);
+  }
+  else if (kind == Instruction_Mul || kind == Instruction_Imul || kind == Instruction_Div || kind == Instruction_Idiv)
+  {
+    bool is_signed = (kind == Instruction_Imul || kind == Instruction_Idiv);
+    u16 operand    = ReadRMOperand(state, instruction);
+    u32 bits       = (w ? 16 : 8);
+
+    u32 ones = 0;
+    bool faulted = false;
+    if (kind == Instruction_Mul || kind == Instruction_Imul)
+    {
+      i32 value = (w ? (i16)operand : (i8)operand);
+      ones      = CountBits(is_signed && value < 0 ? (u32)-value : operand);
+    }
+    else
+    {
+      u32 dividend = (w ? (u32)GetRegister(state, Register_DX) << 16 : 0) | GetRegister(state, Register_AX);
+      u16 quotient, remainder;
+      faulted = !Divide(dividend, operand, w, is_signed, &quotient, &remainder);
+
+      i32 value = (w ? (i16)quotient : (i8)quotient);
+      ones      = CountBits((is_signed && value < 0 ? (u32)-value : quotient) & (w ? 0xFFFF : 0xFF));
+    }
+
+    if (faulted) result = timing.fault;
+    else         result = (MIN(ones, bits)*timing.range + bits/2)/bits;
+  }
+
+  return result;
+}
+
+// NOTE: The count of a rep string, cx is taken before the instruction executed and next_cx after
+u32
+RepeatCount(Instruction instruction, u16 cx, u16 next_cx)
+{
+  return (instruction.kind >= Instruction_Movs && instruction.kind <= Instruction_Scas ? (u16)(cx - next_cx) : 0);
+}
+
+u32
+InstructionAddress(CPU_State* state)
+{
+  return (((u32)GetRegister(state, Register_CS) << 4) + state->ip) & MEMORY_MASK;
+}
+
+bool
+IsExecutingImage(CPU_State* state, Run_Info* run)
+{
+  u32 address = InstructionAddress(state);
+  return (address >= run->code_start && address < run->code_end);
+}
+
+// NOTE: Decodes the instruction at cs:ip and advances ip past it
+Instruction
+FetchInstruction(CPU_State* state)
+{
+  u32 address = InstructionAddress(state);
+  u32 cursor  = address;
+
+  Instruction instruction = DecodeInstruction(state->memory, &cursor);
+  state->ip += cursor - address;
+
+  return instruction;
+}
+
+// NOTE: Decode cache
+//       Remembers the decoded instruction and its timing form per address, direct mapped. An entry keeps the bytes it
+//       was decoded from and is only used while memory still holds them, so code that rewrites itself decodes again.
+
+#define DECODE_CACHE_SIZE      4096
+#define DECODE_CACHE_BYTES_MAX 16
+
+typedef struct Decode_Cache_Entry
+{
+  u32 address; // NOTE: Plus one, 0 is an empty entry
+  Instruction instruction;
+  Timing_Form form;
+  u8 bytes[DECODE_CACHE_BYTES_MAX];
+} Decode_Cache_Entry;
+
+typedef struct Decode_Cache
+{
+  Decode_Cache_Entry entries[DECODE_CACHE_SIZE];
+} Decode_Cache;
+
+// NOTE: FetchInstruction that also hands out the timing form, decoding the instruction only on a miss
+Instruction
+Decode_Cache_Fetch(Decode_Cache* cache, CPU_State* state, Timing_Form* form)
+{
+  u32 address               = InstructionAddress(state);
+  Decode_Cache_Entry* entry = &cache->entries[address % DECODE_CACHE_SIZE];
+  u8* code                  = state->memory->mem + address;
+
+  Instruction instruction;
+  if (entry->address == address + 1 && memcmp(entry->bytes, code, entry->instruction.byte_size) == 0)
+  {
+    instruction = entry->instruction;
+    *form       = entry->form;
+  }
+  else
+  {
+    u32 cursor  = address;
+    instruction = DecodeInstruction(state->memory, &cursor);
+    *form       = TimingFormOf(&instruction);
+
+    // NOTE: Instructions running off the end of memory wrap around, those are left out
+    if (instruction.byte_size <= DECODE_CACHE_BYTES_MAX && address + instruction.byte_size <= MEMORY_SIZE)
+    {
+      entry->address     = address + 1;
+      entry->instruction = instruction;
+      entry->form        = *form;
+      memcpy(entry->bytes, code, instruction.byte_size);
+    }
+  }
+
+  state->ip += instruction.byte_size;
+
+  return instruction;
+}
+
+// NOTE: Whether the instruction can move ip anywhere other than right behind it
+bool
+EndsBasicBlock(Instruction_Kind kind)
+{
+  return ((kind >= Instruction_Jo && kind <= Instruction_Jg)                                       ||
+          kind == Instruction_Call   || kind == Instruction_CallFar || kind == Instruction_Jmp    ||
+          kind == Instruction_JmpFar || kind == Instruction_Ret     || kind == Instruction_RetF   ||
+          kind == Instruction_Int    || kind == Instruction_Int3    || kind == Instruction_Into   ||
+          kind == Instruction_Iret   || kind == Instruction_Loop    || kind == Instruction_Loopz  ||
+          kind == Instruction_Loopnz || kind == Instruction_Jcxz    || kind == Instruction_Hlt);
+}
+
+// NOTE: Linear address a direct jump, call or loop goes to, false for indirect ones and everything else. The
+//       instruction is at cs:ip.
+bool
+DirectBranchTarget(Instruction instruction, u16 cs, u16 ip, u32* target)
+{
+  Instruction_Operand_Format format = instruction.operand_format;
+  u16 next_ip                       = (u16)(ip + instruction.byte_size);
+
+  bool result = EndsBasicBlock(instruction.kind);
+  if      (result && format == InstructionOperandFormat_FarProc) *target = (((u32)instruction.seg << 4) + instruction.disp) & MEMORY_MASK;
+  else if (result && (format == InstructionOperandFormat_IpInc8 ||
+                      format == InstructionOperandFormat_NearProc)) *target = (((u32)cs << 4) + (u16)(next_ip + instruction.disp)) & MEMORY_MASK;
+  else                                                               result  = false;
+
+  return result;
+}
+
+void
+Execute__Push(CPU_State* state, u16 value)
+{
+  u16 sp = GetRegister(state, Register_SP) - 2;
+  SetRegister(state, Register_SP, sp);
+  WriteWord(state->memory, (((u32)GetRegister(state, Register_SS) << 4) + sp) & MEMORY_MASK, value);
+}
+
+u16
+Execute__Pop(CPU_State* state)
+{
+  u16 sp = GetRegister(state, Register_SP);
+  SetRegister(state, Register_SP, sp + 2);
+  return ReadWord(state->memory, (((u32)GetRegister(state, Register_SS) << 4) + sp) & MEMORY_MASK);
+}
+
+// NOTE: The segment register of the ES, CS, SS and DS operand formats
+Register_Kind
+Execute__SegmentRegister(Instruction_Operand_Format format)
+{
+  Register_Kind result;
+  if      (format == InstructionOperandFormat_ES) result = Register_ES;
+  else if (format == InstructionOperandFormat_CS) result = Register_CS;
+  else if (format == InstructionOperandFormat_SS) result = Register_SS;
+  else                                            result = Register_DS;
+
+  return result;
+}
+
+// NOTE: Pushes flags, cs and ip and goes through the vector at 0000:vector*4, with interrupts and traps off
 void
+Execute__Interrupt(CPU_State* state, u8 vector)
+{
+  Execute__Push(state, state->flags);
+  SetFlag(state, IF, false);
+  SetFlag(state, TF, false);
+
+  Execute__Push(state, GetRegister(state, Register_CS));
+  Execute__Push(state, (u16)state->ip);
+
+  state->ip = ReadWord(state->memory, (u32)vector*4);
+  SetRegister(state, Register_CS, ReadWord(state->memory, (u32)vector*4 + 2));
+}
+
+// NOTE: Returns whether the instruction transferred control: a jump, call, return or interrupt that was taken,
+//       including a divide error. The target can be the instruction right behind it, like jmp $+2 does, so the ip
+//       alone doesn't tell.
+bool
 ExecuteInstruction(CPU_State* state, Instruction instruction)
 {
+  bool result = false;
+
   bool w = !!(instruction.flags & InstructionFlag_W);
   bool d = !!(instruction.flags & InstructionFlag_D);
 
@@ -1429,6 +2164,47 @@ ExecuteInstruction(CPU_State* state, Instruction instruction)
     }
 
     if (should_jump) state->ip += (i16)instruction.disp;
+    result = should_jump;
+  }
+  else if (instruction.kind == Instruction_Mul || instruction.kind == Instruction_Imul)
+  {
+    u16 operand = ReadRMOperand(state, instruction);
+    u16 ax      = GetRegister(state, Register_AX);
+
+    // NOTE: Only CF and OF are defined, set when the upper half of the product is significant. The rest are left as
+    //       they were.
+    bool upper_used;
+    if (instruction.kind == Instruction_Mul)
+    {
+      u32 product = (w ? (u32)ax*operand : (u32)(ax & 0xFF)*operand);
+      if (w) SetRegister(state, Register_AX, (u16)product), SetRegister(state, Register_DX, (u16)(product >> 16));
+      else   SetRegister(state, Register_AX, (u16)product);
+
+      upper_used = (w ? (product >> 16) != 0 : (product >> 8) != 0);
+    }
+    else
+    {
+      i32 product = (w ? (i32)(i16)ax*(i16)operand : (i32)(i8)ax*(i8)operand);
+      if (w) SetRegister(state, Register_AX, (u16)product), SetRegister(state, Register_DX, (u16)((u32)product >> 16));
+      else   SetRegister(state, Register_AX, (u16)product);
+
+      upper_used = (w ? product != (i16)product : product != (i8)product);
+    }
+
+    SetFlag(state, CF, upper_used);
+    SetFlag(state, OF, upper_used);
+  }
+  else if (instruction.kind == Instruction_Div || instruction.kind == Instruction_Idiv)
+  {
+    u16 operand  = ReadRMOperand(state, instruction);
+    u32 dividend = (w ? (u32)GetRegister(state, Register_DX) << 16 : 0) | GetRegister(state, Register_AX);
+
+    // NOTE: Flags are undefined and left as they were. A divide error is interrupt 0, with ip past the instruction
+    //       like the 8086 pushes it.
+    u16 quotient, remainder;
+    if (!Divide(dividend, operand, w, instruction.kind == Instruction_Idiv, &quotient, &remainder)) Execute__Interrupt(state, 0), result = true;
+    else if (w) SetRegister(state, Register_AX, quotient), SetRegister(state, Register_DX, remainder);
+    else        SetRegister(state, Register_AL, quotient), SetRegister(state, Register_AH, remainder);
   }
   else if (instruction.kind == Instruction_Loop || instruction.kind == Instruction_Loopz ||
            instruction.kind == Instruction_Loopnz)
@@ -1445,5 +2221,83 @@ ExecuteInstruction(CPU_State* state, Instruction instruction)
     }
 
     if (should_jump) state->ip += (i16)instruction.disp;
+    result = should_jump;
   }
+  else if (instruction.kind == Instruction_Jmp || instruction.kind == Instruction_JmpFar ||
+           instruction.kind == Instruction_Call || instruction.kind == Instruction_CallFar)
+  {
+    bool call = (instruction.kind == Instruction_Call || instruction.kind == Instruction_CallFar);
+    u16 cs    = GetRegister(state, Register_CS);
+    u16 ip    = (u16)state->ip;
+
+    // NOTE: ip is already past the instruction, which is what relative targets count from and what calls push
+    u16 target_cs = cs;
+    u16 target_ip;
+    if      (instruction.operand_format == InstructionOperandFormat_FarProc) target_cs = instruction.seg, target_ip = instruction.disp;
+    else if (instruction.operand_format != InstructionOperandFormat_RM)     target_ip = (u16)(ip + instruction.disp);
+    else if (instruction.mod == 3)                                          target_ip = GetRegister(state, instruction.rm);
+    else
+    {
+      u32 address = EffectiveAddress(state, instruction.prefix, instruction.mod, instruction.rm, instruction.disp);
+      target_ip   = ReadWord(state->memory, address);
+      if (instruction.kind == Instruction_CallFar || instruction.kind == Instruction_JmpFar) target_cs = ReadWord(state->memory, address + 2);
+    }
+
+    bool far = (instruction.kind == Instruction_CallFar || instruction.operand_format == InstructionOperandFormat_FarProc);
+    if (call && far) Execute__Push(state, cs);
+    if (call)        Execute__Push(state, ip);
+
+    SetRegister(state, Register_CS, target_cs);
+    state->ip = target_ip;
+    result    = true;
+  }
+  else if (instruction.kind == Instruction_Ret || instruction.kind == Instruction_RetF)
+  {
+    state->ip = Execute__Pop(state);
+    if (instruction.kind == Instruction_RetF) SetRegister(state, Register_CS, Execute__Pop(state));
+
+    // NOTE: ret <n> also drops the caller's n bytes of arguments
+    if (instruction.operand_format == InstructionOperandFormat_Immed) SetRegister(state, Register_SP, GetRegister(state, Register_SP) + instruction.data);
+    result = true;
+  }
+  else if (instruction.kind == Instruction_Int || instruction.kind == Instruction_Int3 || instruction.kind == Instruction_Into)
+  {
+    if      (instruction.kind == Instruction_Int)  Execute__Interrupt(state, (u8)instruction.data), result = true;
+    else if (instruction.kind == Instruction_Int3) Execute__Interrupt(state, 3), result = true;
+    else if (GetFlag(state, OF))                   Execute__Interrupt(state, 4), result = true;
+  }
+  else if (instruction.kind == Instruction_Iret)
+  {
+    state->ip = Execute__Pop(state);
+    SetRegister(state, Register_CS, Execute__Pop(state));
+    state->flags = Execute__Pop(state);
+    result       = true;
+  }
+  else if (instruction.kind == Instruction_Push || instruction.kind == Instruction_Pushf)
+  {
+    Instruction_Operand_Format format = instruction.operand_format;
+
+    // NOTE: The 8086 pushes sp as it is after the push
+    u16 value;
+    if      (instruction.kind == Instruction_Pushf)                         value = state->flags;
+    else if (format == InstructionOperandFormat_Reg)                        value = GetRegister(state, instruction.reg) - (instruction.reg == Register_SP ? 2 : 0);
+    else if (format == InstructionOperandFormat_RM && instruction.mod == 3) value = GetRegister(state, instruction.rm) - (instruction.rm == Register_SP ? 2 : 0);
+    else if (format == InstructionOperandFormat_RM)                         value = ReadWord(state->memory, EffectiveAddress(state, instruction.prefix, instruction.mod, instruction.rm, instruction.disp));
+    else                                                                    value = GetRegister(state, Execute__SegmentRegister(format));
+
+    Execute__Push(state, value);
+  }
+  else if (instruction.kind == Instruction_Pop || instruction.kind == Instruction_Popf)
+  {
+    Instruction_Operand_Format format = instruction.operand_format;
+    u16 value                         = Execute__Pop(state);
+
+    if      (instruction.kind == Instruction_Popf)                          state->flags = value;
+    else if (format == InstructionOperandFormat_Reg)                        SetRegister(state, instruction.reg, value);
+    else if (format == InstructionOperandFormat_RM && instruction.mod == 3) SetRegister(state, instruction.rm, value);
+    else if (format == InstructionOperandFormat_RM)                         WriteWord(state->memory, EffectiveAddress(state, instruction.prefix, instruction.mod, instruction.rm, instruction.disp), value);
+    else                                                                    SetRegister(state, Execute__SegmentRegister(format), value);
+  }
+
+  return result;
 }
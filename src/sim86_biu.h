@@ -0,0 +1,114 @@
+// NOTE: Bus interface unit
+//       By default (compatibility mode) an instruction costs what the timing table says, as if its bytes were always
+//       waiting in the queue. With --biu the prefetch queue is simulated as well. The BIU fetches code whenever the
+//       bus is free and the queue has room, a word per bus cycle on a 16 bit bus (a byte when the address is odd) or
+//       a byte per bus cycle on an 8 bit one, into a queue of the timing model's size, 6 bytes on the 8086 and 4 on
+//       the 8088. The EU waits when the bytes of its next instruction haven't come in yet, its memory transfers keep
+//       the bus from prefetching, and a taken branch flushes the queue. The waiting is the fetch part of an
+//       instruction's clocks. The table's clocks already hold the EU's own bus cycles, those only cost more when they
+//       have to wait for a prefetch already on the bus.
+
+typedef struct Biu
+{
+  u32 queue_size;
+  u32 bus_cycle;
+  bool narrow_bus; // NOTE: 8 bit
+
+  u32 queued;        // NOTE: Bytes in the queue
+  u32 fetch_address; // NOTE: Linear address of the next byte to prefetch
+  u64 bus_free;      // NOTE: Clock the bus is free from for the next prefetch
+} Biu;
+
+void
+Biu_Begin(Biu* biu, Timing_Model* model, CPU_State* state, u64 clocks)
+{
+  *biu = (Biu){
+    .queue_size    = model->queue_size,
+    .bus_cycle     = model->bus_cycle,
+    .narrow_bus    = (model->bus_width == 8),
+    .fetch_address = InstructionAddress(state),
+    .bus_free      = clocks,
+  };
+}
+
+// NOTE: Bus cycles for the instruction's own transfers, a word that pays a penalty takes two
+u32
+Biu_BusCycles(Instruction_Timing timing, u32 address, u32 count)
+{
+  u32 transfers = timing.transfers + count*timing.count_transfers;
+  u8 penalty    = (address%2 != 0 ? timing.odd_penalty : timing.even_penalty);
+  return (timing.word && penalty != 0 ? 2*transfers : transfers);
+}
+
+// NOTE: Bytes the next prefetch brings in, 0 when the queue has no room for them
+u32
+Biu__FetchSize(Biu* biu)
+{
+  u32 size = (biu->narrow_bus || biu->fetch_address%2 != 0 ? 1 : 2);
+  return (biu->queued + size <= biu->queue_size ? size : 0);
+}
+
+// NOTE: Runs the prefetches that are done by clock t
+void
+Biu__Prefetch(Biu* biu, u64 t)
+{
+  for (u32 size; (size = Biu__FetchSize(biu)) != 0 && biu->bus_free + biu->bus_cycle <= t;)
+  {
+    biu->queued        += size;
+    biu->fetch_address  = (biu->fetch_address + size) & MEMORY_MASK;
+    biu->bus_free      += biu->bus_cycle;
+  }
+
+  // NOTE: With the queue full the bus sits idle, the next prefetch can't start before the EU makes room at t
+  if (Biu__FetchSize(biu) == 0 && biu->bus_free < t) biu->bus_free = t;
+}
+
+// NOTE: Times an instruction of length bytes that starts at clock start, filling in the fetch part of its table
+//       clocks. bus_cycles are its own transfers, see Biu_BusCycles. When it jumped, execution goes on at
+//       next_address.
+void
+Biu_Step(Biu* biu, Clocks* clocks, u64 start, u32 length, u32 bus_cycles, bool jumped, u32 next_address)
+{
+  // NOTE: The EU takes the instruction's bytes as they come in
+  u64 t = start;
+  for (u32 needed = length;;)
+  {
+    Biu__Prefetch(biu, t);
+
+    u32 taken    = MIN(needed, biu->queued);
+    biu->queued -= taken;
+    needed      -= taken;
+    if (needed == 0) break;
+
+    t = MAX(biu->bus_free, t) + biu->bus_cycle;
+  }
+
+  uint table_clocks = clocks->base + clocks->ea + clocks->penalty;
+  u64 end           = t + table_clocks;
+
+  // NOTE: The EU's transfers are put at the end of the instruction, prefetching has the bus until then
+  if (bus_cycles != 0)
+  {
+    u64 transfers_start = MAX(t, end - MIN(end, (u64)biu->bus_cycle*bus_cycles));
+    Biu__Prefetch(biu, transfers_start);
+
+    // NOTE: A prefetch that is already on the bus finishes first
+    if (Biu__FetchSize(biu) != 0 && biu->bus_free < transfers_start)
+    {
+      u64 fetch_end = biu->bus_free + biu->bus_cycle;
+      Biu__Prefetch(biu, fetch_end);
+      end += fetch_end - transfers_start;
+    }
+
+    biu->bus_free = MAX(biu->bus_free, end);
+  }
+
+  if (jumped)
+  {
+    biu->queued        = 0;
+    biu->fetch_address = next_address;
+    biu->bus_free      = MAX(biu->bus_free, end);
+  }
+
+  clocks->fetch = (uint)(end - start) - table_clocks;
+}
@@ -0,0 +1,411 @@
+// NOTE: Call graph
+//       A shadow call stack follows call, int (and the interrupts into and divide errors raise), ret, retf and iret.
+//       Every frame remembers the linear address its return address was pushed to. A return pops the frame whose
+//       slot it takes the return address from, and with it any frames above that were left without returning, e.g.
+//       by code that reset sp. A ret that pops a slot no frame pushed, like push and ret used as a jump, isn't a
+//       return, and a call that pushes over frames already off the stack drops them first. A frame whose return
+//       address is popped some other way, like pop and jmp, is dropped right after that instruction, which is still
+//       charged to it the way a ret is. The frames are nodes of a calling context tree, a node per chain of
+//       procedures from the entry point. Every step's clocks go to the node of the frame on top, which are its
+//       exclusive clocks, and a node's inclusive clocks add up its subtree. Per procedure, a recursive call only
+//       counts toward inclusive clocks at its outermost frame. The tree is exported as text and as folded stacks, one
+//       line per context with its exclusive clocks, which flamegraph.pl and speedscope read.
+
+typedef enum Call_Graph_Event
+{
+  CallGraphEvent_None = 0,
+  CallGraphEvent_Call,
+  CallGraphEvent_Interrupt, // NOTE: Only when the instruction went through a vector
+  CallGraphEvent_Return,
+  CallGraphEvent_ReturnFar,
+  CallGraphEvent_ReturnInterrupt,
+} Call_Graph_Event;
+
+u8 CallGraphEvents[INSTRUCTION_COUNT] = {
+  [Instruction_Call]    = CallGraphEvent_Call,
+  [Instruction_CallFar] = CallGraphEvent_Call,
+  [Instruction_Int]     = CallGraphEvent_Interrupt,
+  [Instruction_Int3]    = CallGraphEvent_Interrupt,
+  [Instruction_Into]    = CallGraphEvent_Interrupt,
+  [Instruction_Div]     = CallGraphEvent_Interrupt,
+  [Instruction_Idiv]    = CallGraphEvent_Interrupt,
+  [Instruction_Ret]     = CallGraphEvent_Return,
+  [Instruction_RetF]    = CallGraphEvent_ReturnFar,
+  [Instruction_Iret]    = CallGraphEvent_ReturnInterrupt,
+};
+
+typedef struct Call_Graph_Node
+{
+  u32 procedure; // NOTE: Linear address of its entry point
+  u32 parent;
+  u32 first_child; // NOTE: 0 when there is none, the root is nobody's child
+  u32 next_sibling;
+  u64 calls;
+  u64 exclusive;
+  u64 inclusive; // NOTE: Only set once the graph is exported
+  bool interrupt;
+} Call_Graph_Node;
+
+typedef struct Call_Graph_Frame
+{
+  u32 node;
+  u32 slot; // NOTE: Linear address of the return address
+} Call_Graph_Frame;
+
+typedef struct Call_Graph
+{
+  Call_Graph_Node* nodes;
+  u32 node_count;
+  u32 node_capacity;
+
+  Call_Graph_Frame* frames;
+  u32 depth;
+  u32 frame_capacity;
+
+  u32 current;
+  u64 unmatched_returns;
+  u64 abandoned_frames;
+} Call_Graph;
+
+// NOTE: The root is the procedure the run starts in
+bool
+Call_Graph_Begin(Call_Graph* graph, CPU_State* state)
+{
+  *graph = (Call_Graph){
+    .nodes          = malloc(256*sizeof(Call_Graph_Node)),
+    .node_count     = 1,
+    .node_capacity  = 256,
+    .frames         = malloc(64*sizeof(Call_Graph_Frame)),
+    .frame_capacity = 64,
+  };
+
+  bool result = (graph->nodes != 0 && graph->frames != 0);
+  if (result) graph->nodes[0] = (Call_Graph_Node){ .procedure = InstructionAddress(state), .calls = 1 };
+  else
+  {
+    free(graph->nodes);
+    free(graph->frames);
+    *graph = (Call_Graph){0};
+  }
+
+  return result;
+}
+
+u32
+Call_Graph__Child(Call_Graph* graph, u32 parent, u32 procedure, bool interrupt)
+{
+  u32 result = graph->nodes[parent].first_child;
+  while (result != 0 && (graph->nodes[result].procedure != procedure || graph->nodes[result].interrupt != interrupt))
+  {
+    result = graph->nodes[result].next_sibling;
+  }
+
+  if (result == 0)
+  {
+    if (graph->node_count == graph->node_capacity)
+    {
+      graph->node_capacity *= 2;
+      graph->nodes          = realloc(graph->nodes, graph->node_capacity*sizeof(Call_Graph_Node));
+      ASSERT(graph->nodes != 0);
+    }
+
+    result = graph->node_count++;
+    graph->nodes[result] = (Call_Graph_Node){
+      .procedure    = procedure,
+      .parent       = parent,
+      .next_sibling = graph->nodes[parent].first_child,
+      .interrupt    = interrupt,
+    };
+    graph->nodes[parent].first_child = result;
+  }
+
+  return result;
+}
+
+void
+Call_Graph__Event(Call_Graph* graph, Call_Graph_Event event, Instruction* instruction, CPU_State* state)
+{
+  u32 ss_base = (u32)GetRegister(state, Register_SS) << 4;
+  u16 sp      = GetRegister(state, Register_SP);
+
+  if (event == CallGraphEvent_Call || event == CallGraphEvent_Interrupt)
+  {
+    // NOTE: sp points at the return address just pushed, frames at or below it are gone
+    u32 slot = (ss_base + sp) & MEMORY_MASK;
+    while (graph->depth != 0 && graph->frames[graph->depth - 1].slot <= slot) graph->depth -= 1, graph->abandoned_frames += 1;
+
+    if (graph->depth == graph->frame_capacity)
+    {
+      graph->frame_capacity *= 2;
+      graph->frames          = realloc(graph->frames, graph->frame_capacity*sizeof(Call_Graph_Frame));
+      ASSERT(graph->frames != 0);
+    }
+
+    u32 parent     = (graph->depth != 0 ? graph->frames[graph->depth - 1].node : 0);
+    graph->current = Call_Graph__Child(graph, parent, InstructionAddress(state), event == CallGraphEvent_Interrupt);
+    graph->nodes[graph->current].calls += 1;
+    graph->frames[graph->depth++] = (Call_Graph_Frame){ .node = graph->current, .slot = slot };
+  }
+  else
+  {
+    // NOTE: Where the return address was, ret and retf <n> also dropped n bytes of arguments behind it
+    u16 popped = (event == CallGraphEvent_Return ? 2 : event == CallGraphEvent_ReturnFar ? 4 : 6);
+    if (instruction->operand_format == InstructionOperandFormat_Immed) popped += instruction->data;
+
+    u32 slot = (ss_base + (u16)(sp - popped)) & MEMORY_MASK;
+    while (graph->depth != 0 && graph->frames[graph->depth - 1].slot < slot) graph->depth -= 1, graph->abandoned_frames += 1;
+
+    if (graph->depth != 0 && graph->frames[graph->depth - 1].slot == slot) graph->depth -= 1;
+    else                                                                   graph->unmatched_returns += 1;
+
+    graph->current = (graph->depth != 0 ? graph->frames[graph->depth - 1].node : 0);
+  }
+}
+
+// NOTE: Call after executing the instruction, clocks are its clocks
+void
+Call_Graph_Step(Call_Graph* graph, Instruction* instruction, bool branch_taken, CPU_State* state, uint clocks)
+{
+  graph->nodes[graph->current].exclusive += clocks;
+
+  Call_Graph_Event event = CallGraphEvents[instruction->kind];
+  if (event != CallGraphEvent_None && (event != CallGraphEvent_Interrupt || branch_taken))
+  {
+    Call_Graph__Event(graph, event, instruction, state);
+  }
+
+  // NOTE: Offsets in the stack segment, sp can wrap around from 0 to 0xfffe and back
+  if (graph->depth != 0)
+  {
+    u32 ss_base = (u32)GetRegister(state, Register_SS) << 4;
+    u16 sp      = GetRegister(state, Register_SP);
+
+    bool popped = false;
+    while (graph->depth != 0 && (i16)(sp - (u16)(graph->frames[graph->depth - 1].slot - ss_base)) > 0)
+    {
+      graph->depth            -= 1;
+      graph->abandoned_frames += 1;
+      popped                   = true;
+    }
+
+    if (popped) graph->current = (graph->depth != 0 ? graph->frames[graph->depth - 1].node : 0);
+  }
+}
+
+typedef struct Call_Graph_Visit
+{
+  u64 inclusive;
+  u32 node;
+  u32 depth;
+} Call_Graph_Visit;
+
+typedef struct Call_Graph_Procedure
+{
+  u32 procedure;
+  bool interrupt;
+  u64 calls;
+  u64 exclusive;
+  u64 inclusive;
+} Call_Graph_Procedure;
+
+// NOTE: Ascending, the stack pops the most inclusive clocks, then the first node, first
+int
+Call_Graph__CompareVisits(const void* a, const void* b)
+{
+  const Call_Graph_Visit* x = a;
+  const Call_Graph_Visit* y = b;
+
+  int result;
+  if      (x->inclusive != y->inclusive) result = (x->inclusive < y->inclusive ? -1 : 1);
+  else if (x->node != y->node)           result = (x->node > y->node ? -1 : 1);
+  else                                   result = 0;
+
+  return result;
+}
+
+int
+Call_Graph__CompareProcedures(const void* a, const void* b)
+{
+  const Call_Graph_Procedure* x = a;
+  const Call_Graph_Procedure* y = b;
+
+  int result;
+  if      (x->procedure != y->procedure) result = (x->procedure < y->procedure ? -1 : 1);
+  else if (x->interrupt != y->interrupt) result = (x->interrupt < y->interrupt ? -1 : 1);
+  else                                   result = 0;
+
+  return result;
+}
+
+int
+Call_Graph__CompareInclusive(const void* a, const void* b)
+{
+  const Call_Graph_Procedure* x = a;
+  const Call_Graph_Procedure* y = b;
+  return (x->inclusive != y->inclusive ? (x->inclusive > y->inclusive ? -1 : 1) : Call_Graph__CompareProcedures(a, b));
+}
+
+double
+Call_Graph__Percent(u64 clocks, u64 total)
+{
+  return (total != 0 ? 100.0*(double)clocks/(double)total : 0.0);
+}
+
+bool
+Call_Graph__WriteTree(Call_Graph* graph, char* path, char* model)
+{
+  FILE* file = fopen(path, "wb");
+
+  Call_Graph_Visit* stack          = malloc(graph->node_count*sizeof(Call_Graph_Visit));
+  Call_Graph_Procedure* procedures = malloc(graph->node_count*sizeof(Call_Graph_Procedure));
+  ASSERT(stack != 0 && procedures != 0);
+
+  if (file != 0)
+  {
+    Call_Graph_Node* nodes = graph->nodes;
+    u64 total              = nodes[0].inclusive;
+
+    fprintf(file, "Call tree (%s), clocks of every calling context with and without its callees\n", model);
+    fprintf(file, " Inclusive       %%  Exclusive       %%      Calls  Procedure\n");
+
+    // NOTE: Depth first, the children with the most inclusive clocks first
+    u32 top = 0;
+    stack[top++] = (Call_Graph_Visit){ .node = 0 };
+    while (top != 0)
+    {
+      Call_Graph_Visit visit = stack[--top];
+      Call_Graph_Node* node  = &nodes[visit.node];
+
+      fprintf(file, "%10llu %6.2f%% %10llu %6.2f%% %10llu  %*s0x%05x%s\n", (unsigned long long)node->inclusive,
+              Call_Graph__Percent(node->inclusive, total), (unsigned long long)node->exclusive, Call_Graph__Percent(node->exclusive, total),
+              (unsigned long long)node->calls, 2*visit.depth, "", node->procedure, (node->interrupt ? " (interrupt)" : ""));
+
+      u32 first = top;
+      for (u32 child = node->first_child; child != 0; child = nodes[child].next_sibling)
+      {
+        stack[top++] = (Call_Graph_Visit){ .inclusive = nodes[child].inclusive, .node = child, .depth = visit.depth + 1 };
+      }
+
+      qsort(stack + first, top - first, sizeof(Call_Graph_Visit), Call_Graph__CompareVisits);
+    }
+
+    // NOTE: Per procedure, the inclusive clocks of frames that are inside a frame of the same procedure are already
+    //       part of that frame's
+    for (u32 i = 0; i < graph->node_count; ++i)
+    {
+      bool outermost = true;
+      for (u32 ancestor = i; ancestor != 0 && outermost;)
+      {
+        ancestor  = nodes[ancestor].parent;
+        outermost = (nodes[ancestor].procedure != nodes[i].procedure || nodes[ancestor].interrupt != nodes[i].interrupt);
+      }
+
+      procedures[i] = (Call_Graph_Procedure){
+        .procedure = nodes[i].procedure,
+        .interrupt = nodes[i].interrupt,
+        .calls     = nodes[i].calls,
+        .exclusive = nodes[i].exclusive,
+        .inclusive = (outermost ? nodes[i].inclusive : 0),
+      };
+    }
+
+    qsort(procedures, graph->node_count, sizeof(Call_Graph_Procedure), Call_Graph__CompareProcedures);
+
+    u32 procedure_count = 0;
+    for (u32 i = 0; i < graph->node_count; ++i)
+    {
+      Call_Graph_Procedure* last = (procedure_count != 0 ? &procedures[procedure_count - 1] : 0);
+      if (last != 0 && Call_Graph__CompareProcedures(last, &procedures[i]) == 0)
+      {
+        last->calls     += procedures[i].calls;
+        last->exclusive += procedures[i].exclusive;
+        last->inclusive += procedures[i].inclusive;
+      }
+      else procedures[procedure_count++] = procedures[i];
+    }
+
+    qsort(procedures, procedure_count, sizeof(Call_Graph_Procedure), Call_Graph__CompareInclusive);
+
+    fprintf(file, "\nProcedures (%s), recursive calls count toward inclusive clocks once\n", model);
+    fprintf(file, " Inclusive       %%  Exclusive       %%      Calls  Procedure\n");
+    for (u32 i = 0; i < procedure_count; ++i)
+    {
+      Call_Graph_Procedure* procedure = &procedures[i];
+      fprintf(file, "%10llu %6.2f%% %10llu %6.2f%% %10llu  0x%05x%s\n", (unsigned long long)procedure->inclusive,
+              Call_Graph__Percent(procedure->inclusive, total), (unsigned long long)procedure->exclusive,
+              Call_Graph__Percent(procedure->exclusive, total), (unsigned long long)procedure->calls, procedure->procedure,
+              (procedure->interrupt ? " (interrupt)" : ""));
+    }
+
+    fprintf(file, "\nReturns that matched no call: %llu\n", (unsigned long long)graph->unmatched_returns);
+    fprintf(file, "Frames left without returning: %llu\n", (unsigned long long)graph->abandoned_frames);
+    fprintf(file, "Frames still open at the end: %u\n", graph->depth);
+  }
+
+  free(procedures);
+  free(stack);
+
+  return (file != 0 && fclose(file) == 0);
+}
+
+// NOTE: "root;caller;callee clocks" for every context with exclusive clocks
+bool
+Call_Graph__WriteFolded(Call_Graph* graph, char* path)
+{
+  FILE* file = fopen(path, "wb");
+
+  u32* chain = malloc(graph->node_count*sizeof(u32));
+  ASSERT(chain != 0);
+
+  for (u32 i = 0; i < graph->node_count && file != 0; ++i)
+  {
+    if (graph->nodes[i].exclusive == 0) continue;
+
+    u32 length = 0;
+    for (u32 node = i;; node = graph->nodes[node].parent)
+    {
+      chain[length++] = node;
+      if (node == 0) break;
+    }
+
+    while (length != 0)
+    {
+      Call_Graph_Node* node = &graph->nodes[chain[--length]];
+      fprintf(file, "0x%05x%s", node->procedure, (length != 0 ? ";" : ""));
+    }
+    fprintf(file, " %llu\n", (unsigned long long)graph->nodes[i].exclusive);
+  }
+
+  free(chain);
+
+  return (file != 0 && fclose(file) == 0);
+}
+
+// NOTE: Writes <base>.txt, the tree and a table per procedure, and <base>.folded
+bool
+Call_Graph_Export(Call_Graph* graph, char* base, char* model)
+{
+  // NOTE: Children come after their parents
+  for (u32 i = 0; i < graph->node_count; ++i) graph->nodes[i].inclusive = graph->nodes[i].exclusive;
+  for (u32 i = graph->node_count - 1; i > 0; --i) graph->nodes[graph->nodes[i].parent].inclusive += graph->nodes[i].inclusive;
+
+  char path[4096];
+  bool succeeded = true;
+
+  snprintf(path, sizeof(path), "%s.txt", base);
+  succeeded = (Call_Graph__WriteTree(graph, path, model) && succeeded);
+
+  snprintf(path, sizeof(path), "%s.folded", base);
+  succeeded = (Call_Graph__WriteFolded(graph, path) && succeeded);
+
+  return succeeded;
+}
+
+void
+Call_Graph_End(Call_Graph* graph)
+{
+  free(graph->nodes);
+  free(graph->frames);
+  graph->nodes  = 0;
+  graph->frames = 0;
+}
@@ -0,0 +1,261 @@
+// NOTE: Checkpoint file layout
+//       [header, padded to CHECKPOINT_PAGE_SIZE][page][page]...[shadow page][shadow page]...
+//       Only pages with non-zero content are stored, in ascending address order, so every run of present pages
+//       is contiguous in the file and can be mapped over Memory with a single call when restoring. Builds with
+//       SIM86_SHADOW also store which bytes were initialized, the shadow pages follow the memory pages and are
+//       mapped over the shadow the same way. Restoring one without them in such a build trusts the stored pages.
+
+#define CHECKPOINT_MAGIC      0x43363853 // "S86C"
+#define CHECKPOINT_VERSION    3
+#define CHECKPOINT_PAGE_SIZE  PLATFORM_PAGE_SIZE
+#define CHECKPOINT_PAGE_COUNT (MEMORY_SIZE / CHECKPOINT_PAGE_SIZE)
+
+typedef struct Checkpoint_Header
+{
+  u32 magic;
+  u32 version;
+
+  u16 register_file[REGISTER_COUNT];
+  u16 flags;
+  u32 ip;
+
+  u64 instruction_count;
+  u64 clocks;
+  u32 code_start;
+  u32 code_end;
+  u32 page_count;
+  u8 page_present[CHECKPOINT_PAGE_COUNT / 8];
+
+  bool has_shadow;
+  u32 shadow_page_count;
+  u8 shadow_page_present[CHECKPOINT_PAGE_COUNT / 8];
+} Checkpoint_Header;
+
+typedef struct Checkpoint_Trigger
+{
+  char* path;
+  u64 after_instructions; // NOTE: 0 disables the trigger
+  u32 at_ip;
+  bool at_ip_enabled;
+  bool on_hlt;
+} Checkpoint_Trigger;
+
+bool
+Checkpoint__IsPageEmpty(u8* page)
+{
+  u64* words = (u64*)page;
+
+  u64 acc = 0;
+  for (uint i = 0; i < CHECKPOINT_PAGE_SIZE/sizeof(u64); ++i) acc |= words[i];
+
+  return (acc == 0);
+}
+
+// NOTE: Writes the pages of base marked present
+bool
+Checkpoint__WritePages(FILE* file, u8* base, u8* page_present)
+{
+  bool succeeded = true;
+  for (uint i = 0; i < CHECKPOINT_PAGE_COUNT && succeeded; ++i)
+  {
+    if (page_present[i/8] & (1 << (i%8)))
+    {
+      succeeded = (fwrite(base + i*CHECKPOINT_PAGE_SIZE, 1, CHECKPOINT_PAGE_SIZE, file) == CHECKPOINT_PAGE_SIZE);
+    }
+  }
+
+  return succeeded;
+}
+
+// NOTE: Maps the pages marked present over base, they are stored from *file_offset on, which is moved past them
+bool
+Checkpoint__MapPages(Platform_File file, u64* file_offset, u8* base, u8* page_present)
+{
+  bool succeeded = true;
+  for (uint i = 0; i < CHECKPOINT_PAGE_COUNT && succeeded;)
+  {
+    if (!(page_present[i/8] & (1 << (i%8)))) ++i;
+    else
+    {
+      uint run_start = i;
+      while (i < CHECKPOINT_PAGE_COUNT && (page_present[i/8] & (1 << (i%8)))) ++i;
+
+      u64 run_size = (u64)(i - run_start) * CHECKPOINT_PAGE_SIZE;
+      succeeded = Platform_MapPrivateAt(file, *file_offset, base + run_start*CHECKPOINT_PAGE_SIZE, run_size);
+
+      *file_offset += run_size;
+    }
+  }
+
+  return succeeded;
+}
+
+bool
+WriteCheckpoint(char* path, CPU_State* state, Run_Info info)
+{
+  bool succeeded = false;
+
+  static u8 header_page[CHECKPOINT_PAGE_SIZE];
+  memset(header_page, 0, sizeof(header_page));
+
+  Checkpoint_Header* header = (Checkpoint_Header*)header_page;
+  *header = (Checkpoint_Header){
+    .magic             = CHECKPOINT_MAGIC,
+    .version           = CHECKPOINT_VERSION,
+    .flags             = state->flags,
+    .ip                = state->ip,
+    .instruction_count = info.instruction_count,
+    .clocks            = info.clocks,
+    .code_start        = info.code_start,
+    .code_end          = info.code_end,
+  };
+  memcpy(header->register_file, state->register_file, sizeof(header->register_file));
+
+  for (uint i = 0; i < CHECKPOINT_PAGE_COUNT; ++i)
+  {
+    if (!Checkpoint__IsPageEmpty(state->memory->mem + i*CHECKPOINT_PAGE_SIZE))
+    {
+      header->page_present[i/8] |= (u8)(1 << (i%8));
+      header->page_count += 1;
+    }
+  }
+
+#if SIM86_SHADOW
+  // NOTE: Only whether a byte was initialized is kept, the restored run reports reads of the others on its own
+  static u8 shadow[MEMORY_SIZE];
+  for (uint i = 0; i < MEMORY_SIZE; ++i) shadow[i] = state->memory->shadow[i] & Shadow_Initialized;
+
+  header->has_shadow = true;
+  for (uint i = 0; i < CHECKPOINT_PAGE_COUNT; ++i)
+  {
+    if (!Checkpoint__IsPageEmpty(shadow + i*CHECKPOINT_PAGE_SIZE))
+    {
+      header->shadow_page_present[i/8] |= (u8)(1 << (i%8));
+      header->shadow_page_count += 1;
+    }
+  }
+#endif
+
+  FILE* file = fopen(path, "wb");
+  if (file != 0)
+  {
+    succeeded = (fwrite(header_page, 1, sizeof(header_page), file) == sizeof(header_page));
+    succeeded = (succeeded && Checkpoint__WritePages(file, state->memory->mem, header->page_present));
+#if SIM86_SHADOW
+    succeeded = (succeeded && Checkpoint__WritePages(file, shadow, header->shadow_page_present));
+#endif
+
+    succeeded = (fclose(file) == 0 && succeeded);
+  }
+
+  return succeeded;
+}
+
+// NOTE: The returned memory is owned by the caller and must be released with Platform_FreeMemory(memory, sizeof(Memory))
+Memory*
+LoadCheckpoint(char* path, CPU_State* state, Run_Info* info)
+{
+  Memory* result = 0;
+
+  Platform_File file;
+  if (Platform_OpenFileForReading(path, &file))
+  {
+    Checkpoint_Header header;
+    if (Platform_ReadAt(file, 0, &header, sizeof(header)) && header.magic == CHECKPOINT_MAGIC && header.version == CHECKPOINT_VERSION)
+    {
+      Memory* memory = Platform_AllocateMemory(sizeof(Memory));
+
+      u64 file_offset = CHECKPOINT_PAGE_SIZE;
+      bool succeeded  = (memory != 0 && Checkpoint__MapPages(file, &file_offset, memory->mem, header.page_present));
+
+#if SIM86_SHADOW
+      if (succeeded && header.has_shadow) succeeded = Checkpoint__MapPages(file, &file_offset, memory->shadow, header.shadow_page_present);
+#endif
+
+      if (!succeeded)
+      {
+        if (memory != 0) Platform_FreeMemory(memory, sizeof(Memory));
+      }
+      else
+      {
+        *state = (CPU_State){
+          .flags  = header.flags,
+          .ip     = header.ip,
+          .memory = memory,
+        };
+        memcpy(state->register_file, header.register_file, sizeof(state->register_file));
+
+#if SIM86_SHADOW
+        // NOTE: Written by a build without the shadow, so trust the pages that were stored
+        for (uint i = 0; i < CHECKPOINT_PAGE_COUNT && !header.has_shadow; ++i)
+        {
+          if (header.page_present[i/8] & (1 << (i%8))) ShadowMarkInitialized(memory, i*CHECKPOINT_PAGE_SIZE, CHECKPOINT_PAGE_SIZE);
+        }
+#endif
+
+        *info = (Run_Info){
+          .instruction_count = header.instruction_count,
+          .clocks            = header.clocks,
+          .code_start        = header.code_start,
+          .code_end          = header.code_end,
+        };
+
+        result = memory;
+      }
+    }
+
+    // NOTE: Mappings stay valid after the file is closed
+    Platform_CloseFile(file);
+  }
+
+  return result;
+}
+
+bool
+ShouldTakeCheckpoint(Checkpoint_Trigger* trigger, u64 instruction_count, u32 ip, Instruction_Kind last_kind)
+{
+  bool result = false;
+
+  if (trigger->path != 0)
+  {
+    if (trigger->after_instructions != 0 && instruction_count == trigger->after_instructions)
+    {
+      trigger->after_instructions = 0;
+      result = true;
+    }
+
+    if (trigger->at_ip_enabled && ip == trigger->at_ip)
+    {
+      trigger->at_ip_enabled = false;
+      result = true;
+    }
+
+    if (trigger->on_hlt && last_kind == Instruction_Hlt)
+    {
+      trigger->on_hlt = false;
+      result = true;
+    }
+  }
+
+  return result;
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a checkpoint option
+bool
+ParseCheckpointOption(int argc, char** argv, int* i, Checkpoint_Trigger* trigger, char** restore_path)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  if      (strcmp(arg, "--checkpoint-on-hlt") == 0) trigger->on_hlt = true;
+  else if (value == 0)                              result = false;
+  else if (strcmp(arg, "--checkpoint") == 0)        trigger->path = value, *i += 1;
+  else if (strcmp(arg, "--checkpoint-after") == 0)  trigger->after_instructions = strtoull(value, 0, 0), *i += 1;
+  else if (strcmp(arg, "--checkpoint-at-ip") == 0)  trigger->at_ip = (u32)strtoul(value, 0, 0), trigger->at_ip_enabled = true, *i += 1;
+  else if (strcmp(arg, "--restore") == 0)           *restore_path = value, *i += 1;
+  else                                              result = false;
+
+  return result;
+}
@@ -0,0 +1,174 @@
+// NOTE: Trace filters
+//       The --trace-* options pick which steps make it into the text trace. Options of the same kind are or'ed,
+//       different kinds are and'ed. They are compiled into a short list of ops, one clause per kind with the
+//       cheapest kinds first, and evaluated right after the step executes so a step that is filtered out is never
+//       formatted.
+
+#define FILTER_OP_CAPACITY 64
+
+typedef enum Filter_Op_Kind
+{
+  FilterOp_Sample = 0,      // NOTE: index % a == 0
+  FilterOp_IpRange,         // NOTE: a <= ip <= b
+  FilterOp_Kinds,           // NOTE: kind is in Trace_Filter.kinds
+  FilterOp_RegisterChanged, // NOTE: one of the registers in mask a changed, bit REGISTER_COUNT is the flags
+  FilterOp_MemoryRange,     // NOTE: an access touched a byte in [a, b]
+
+  FILTER_OP_KIND_COUNT
+} Filter_Op_Kind;
+
+typedef struct Filter_Op
+{
+  u8 kind;
+  bool ends_clause;
+  u32 a;
+  u32 b;
+} Filter_Op;
+
+typedef struct Trace_Filter
+{
+  Filter_Op ops[FILTER_OP_CAPACITY];
+  u32 op_count;
+
+  u64 kinds[(INSTRUCTION_COUNT + 63)/64];
+  bool needs_access_log;
+} Trace_Filter;
+
+bool
+Filter__ParseRange(char* value, u32* start, u32* end)
+{
+  char* cursor;
+  *start = (u32)strtoul(value, &cursor, 0);
+  *end   = *start;
+
+  if (*cursor == '-') *end = (u32)strtoul(cursor + 1, &cursor, 0);
+
+  return (cursor != value && *cursor == 0 && *start <= *end);
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a trace filter option
+bool
+ParseFilterOption(int argc, char** argv, int* i, Trace_Filter* filter)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  Filter_Op op = {0};
+  if      (value == 0 || filter->op_count == FILTER_OP_CAPACITY) result = false;
+  else if (strcmp(arg, "--trace-ip") == 0)                         op.kind = FilterOp_IpRange,     result = Filter__ParseRange(value, &op.a, &op.b);
+  else if (strcmp(arg, "--trace-mem") == 0)                        op.kind = FilterOp_MemoryRange, result = Filter__ParseRange(value, &op.a, &op.b);
+  else if (strcmp(arg, "--trace-every") == 0)                      op.kind = FilterOp_Sample,      op.a = (u32)strtoul(value, 0, 0), result = (op.a != 0);
+  else if (strcmp(arg, "--trace-kind") == 0)
+  {
+    op.kind = FilterOp_Kinds;
+
+    result = false;
+    for (u32 kind = 1; kind < INSTRUCTION_COUNT && !result; ++kind)
+    {
+      if (InstructionNames[kind] != 0 && strcmp(InstructionNames[kind], value) == 0) op.a = kind, result = true;
+    }
+  }
+  else if (strcmp(arg, "--trace-reg") == 0)
+  {
+    op.kind = FilterOp_RegisterChanged;
+
+    result = (strcmp(value, "flags") == 0);
+    if (result) op.a = 1 << REGISTER_COUNT;
+
+    for (u32 reg = 0; reg < REGISTER_COUNT && !result; ++reg)
+    {
+      if (strcmp(RegisterNames[reg], value) == 0) op.a = 1 << reg, result = true;
+    }
+  }
+  else result = false;
+
+  if (result)
+  {
+    filter->ops[filter->op_count++] = op;
+    *i += 1;
+  }
+
+  return result;
+}
+
+// NOTE: Turns the ops in the order they were given into one clause per kind. Kind and register ops are merged into
+//       a single op each.
+void
+Filter_Compile(Trace_Filter* filter)
+{
+  Filter_Op given[FILTER_OP_CAPACITY];
+  u32 given_count = filter->op_count;
+  memcpy(given, filter->ops, given_count*sizeof(Filter_Op));
+
+  filter->op_count = 0;
+  memset(filter->kinds, 0, sizeof(filter->kinds));
+
+  for (u32 kind = 0; kind < FILTER_OP_KIND_COUNT; ++kind)
+  {
+    u32 clause_start = filter->op_count;
+
+    for (u32 i = 0; i < given_count; ++i)
+    {
+      Filter_Op op = given[i];
+      if (op.kind != kind) continue;
+
+      bool merge = ((kind == FilterOp_Kinds || kind == FilterOp_RegisterChanged) && filter->op_count != clause_start);
+
+      if (kind == FilterOp_Kinds) filter->kinds[op.a / 64] |= 1ull << (op.a % 64);
+
+      if      (!merge)                           filter->ops[filter->op_count++] = op;
+      else if (kind == FilterOp_RegisterChanged) filter->ops[clause_start].a |= op.a;
+    }
+
+    if (filter->op_count != clause_start) filter->ops[filter->op_count - 1].ends_clause = true;
+    if (filter->op_count != clause_start && kind == FilterOp_MemoryRange) filter->needs_access_log = true;
+  }
+}
+
+// NOTE: index is the number of instructions executed before this one, log the accesses this step made when
+//       needs_access_log is set
+bool
+Filter_Matches(Trace_Filter* filter, u64 index, Instruction_Kind instruction_kind, CPU_State* prev_state, CPU_State* state, Memory_Access_Log* log)
+{
+  bool clause = false;
+
+  for (u32 i = 0; i < filter->op_count; ++i)
+  {
+    Filter_Op* op = &filter->ops[i];
+
+    if (!clause)
+    {
+      if      (op->kind == FilterOp_Sample)  clause = (index % op->a == 0);
+      else if (op->kind == FilterOp_IpRange) clause = (prev_state->ip >= op->a && prev_state->ip <= op->b);
+      else if (op->kind == FilterOp_Kinds)   clause = ((filter->kinds[instruction_kind / 64] >> (instruction_kind % 64)) & 1);
+      else if (op->kind == FilterOp_RegisterChanged)
+      {
+        for (u32 reg = 0; reg < REGISTER_COUNT && !clause; ++reg)
+        {
+          clause = ((op->a & (1 << reg)) && prev_state->register_file[reg] != state->register_file[reg]);
+        }
+
+        if (op->a & (1 << REGISTER_COUNT)) clause = (clause || prev_state->flags != state->flags);
+      }
+      else
+      {
+        ASSERT(op->kind == FilterOp_MemoryRange);
+        for (u32 j = 0; j < log->count && !clause; ++j)
+        {
+          Memory_Access* access = &log->accesses[j];
+          clause = (access->address + access->size - 1 >= op->a && access->address <= op->b);
+        }
+      }
+    }
+
+    if (op->ends_clause)
+    {
+      if (!clause) return false;
+      clause = false;
+    }
+  }
+
+  return true;
+}
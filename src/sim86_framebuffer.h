@@ -0,0 +1,250 @@
+// NOTE: Framebuffer device
+//       A region of memory is read as an image of width x height pixels, row after row with no padding. Rows the
+//       program writes to are marked dirty from the access log, and only those are converted again when the next
+//       frame goes out. Frames are PPM (PGM for gray8), or bare pixels with --framebuffer-raw, either appended to
+//       one stream file or written one file each when the path has a run of '#' for the frame number.
+
+#define FRAMEBUFFER_DEFAULT_BASE   (64*4)
+#define FRAMEBUFFER_DEFAULT_WIDTH  64
+#define FRAMEBUFFER_DEFAULT_HEIGHT 64
+#define FRAMEBUFFER_PATH_MAX       4096
+
+typedef enum Framebuffer_Format
+{
+  FramebufferFormat_RGBA = 0,
+  FramebufferFormat_BGRA,
+  FramebufferFormat_Gray8,
+
+  FRAMEBUFFER_FORMAT_COUNT
+} Framebuffer_Format;
+
+char* FramebufferFormatNames[FRAMEBUFFER_FORMAT_COUNT] = {
+  [FramebufferFormat_RGBA]  = "rgba",
+  [FramebufferFormat_BGRA]  = "bgra",
+  [FramebufferFormat_Gray8] = "gray8",
+};
+
+typedef struct Framebuffer_Options
+{
+  char* path;
+  u32 base;
+  u32 width;
+  u32 height;
+  Framebuffer_Format format;
+  u64 every; // NOTE: Instructions between frames, 0 only writes the final frame
+  bool raw;
+} Framebuffer_Options;
+
+typedef struct Framebuffer
+{
+  Framebuffer_Options options;
+  FILE* stream; // NOTE: 0 when every frame gets a file of its own
+
+  u32 pitch;
+  u32 channels;
+  u8* pixels;      // NOTE: Converted frame, channels bytes per pixel
+  u64* dirty_rows; // NOTE: One bit per row written since the row was last converted
+  u64 frame_count;
+  bool failed;
+} Framebuffer;
+
+bool
+Framebuffer_Begin(Framebuffer* framebuffer, Framebuffer_Options* options)
+{
+  *framebuffer = (Framebuffer){
+    .options  = *options,
+    .pitch    = options->width*(options->format == FramebufferFormat_Gray8 ? 1 : 4),
+    .channels = (options->format == FramebufferFormat_Gray8 ? 1 : 3),
+  };
+
+  framebuffer->pixels     = malloc((u64)options->width*options->height*framebuffer->channels);
+  framebuffer->dirty_rows = malloc((options->height + 63)/64*sizeof(u64));
+
+  // NOTE: Everything is dirty at first, so the first frame converts all of it
+  if (framebuffer->dirty_rows != 0) memset(framebuffer->dirty_rows, 0xFF, (options->height + 63)/64*sizeof(u64));
+
+  if (strchr(options->path, '#') == 0) framebuffer->stream = fopen(options->path, "wb");
+
+  bool result = (framebuffer->pixels != 0 && framebuffer->dirty_rows != 0 && (framebuffer->stream != 0 || strchr(options->path, '#') != 0));
+  if (!result)
+  {
+    if (framebuffer->stream != 0) fclose(framebuffer->stream);
+    free(framebuffer->pixels);
+    free(framebuffer->dirty_rows);
+    *framebuffer = (Framebuffer){0};
+  }
+
+  return result;
+}
+
+// NOTE: Call after executing an instruction, log must hold the accesses made by it
+void
+Framebuffer_Record(Framebuffer* framebuffer, Memory_Access_Log* log)
+{
+  u32 base = framebuffer->options.base;
+  u32 size = framebuffer->pitch*framebuffer->options.height;
+
+  for (u32 i = 0; i < log->count; ++i)
+  {
+    Memory_Access* access = &log->accesses[i];
+
+    u32 offset = access->address - base;
+    if (access->is_write && (offset < size || offset + access->size - 1 < size))
+    {
+      u32 first = (offset < size ? offset : 0)/framebuffer->pitch;
+      u32 last  = MIN(offset + access->size - 1, size - 1)/framebuffer->pitch;
+      for (u32 row = first; row <= last; ++row) framebuffer->dirty_rows[row/64] |= 1ull << (row%64);
+    }
+  }
+}
+
+void
+Framebuffer__ConvertRow(Framebuffer* framebuffer, Memory* memory, u32 row)
+{
+  u32 width = framebuffer->options.width;
+  u8* src   = memory->mem + framebuffer->options.base + row*framebuffer->pitch;
+  u8* dst   = framebuffer->pixels + (u64)row*width*framebuffer->channels;
+
+  if      (framebuffer->options.format == FramebufferFormat_Gray8) memcpy(dst, src, width);
+  else if (framebuffer->options.format == FramebufferFormat_RGBA)
+  {
+    for (u32 x = 0; x < width; ++x, src += 4, dst += 3) dst[0] = src[0], dst[1] = src[1], dst[2] = src[2];
+  }
+  else
+  {
+    for (u32 x = 0; x < width; ++x, src += 4, dst += 3) dst[0] = src[2], dst[1] = src[1], dst[2] = src[0];
+  }
+}
+
+// NOTE: Replaces the run of '#' in the path with the zero padded frame number
+void
+Framebuffer__FramePath(Framebuffer* framebuffer, char* path, u32 capacity)
+{
+  char* pattern = framebuffer->options.path;
+  char* hashes  = strchr(pattern, '#');
+
+  u32 digits = 0;
+  while (hashes[digits] == '#') ++digits;
+
+  snprintf(path, capacity, "%.*s%0*llu%s", (int)(hashes - pattern), pattern, (int)digits, (unsigned long long)framebuffer->frame_count, hashes + digits);
+}
+
+bool
+Framebuffer_WriteFrame(Framebuffer* framebuffer, Memory* memory)
+{
+  u32 width  = framebuffer->options.width;
+  u32 height = framebuffer->options.height;
+
+  for (u32 i = 0; i < (height + 63)/64; ++i)
+  {
+    u64 bits = framebuffer->dirty_rows[i];
+    for (u32 row = i*64; bits != 0; ++row, bits >>= 1)
+    {
+      if ((bits & 1) && row < height) Framebuffer__ConvertRow(framebuffer, memory, row);
+    }
+
+    framebuffer->dirty_rows[i] = 0;
+  }
+
+  FILE* file = framebuffer->stream;
+  if (file == 0)
+  {
+    char path[FRAMEBUFFER_PATH_MAX];
+    Framebuffer__FramePath(framebuffer, path, sizeof(path));
+    file = fopen(path, "wb");
+  }
+
+  bool succeeded = (file != 0);
+  if (succeeded)
+  {
+    if (!framebuffer->options.raw) fprintf(file, "%s\n%u %u\n255\n", (framebuffer->channels == 1 ? "P5" : "P6"), width, height);
+
+    u64 size  = (u64)width*height*framebuffer->channels;
+    succeeded = (fwrite(framebuffer->pixels, 1, size, file) == size);
+
+    if (file != framebuffer->stream) succeeded = (fclose(file) == 0 && succeeded);
+  }
+
+  framebuffer->frame_count += 1;
+  framebuffer->failed       = (framebuffer->failed || !succeeded);
+
+  return succeeded;
+}
+
+// NOTE: Writes a frame every options.every instructions, instruction_count is the number executed so far
+void
+Framebuffer_Tick(Framebuffer* framebuffer, Memory* memory, u64 instruction_count)
+{
+  if (framebuffer->options.every != 0 && instruction_count % framebuffer->options.every == 0) Framebuffer_WriteFrame(framebuffer, memory);
+}
+
+// NOTE: Writes the final frame and returns whether every frame was written
+bool
+Framebuffer_End(Framebuffer* framebuffer, Memory* memory)
+{
+  Framebuffer_WriteFrame(framebuffer, memory);
+
+  bool succeeded = !framebuffer->failed;
+  if (framebuffer->stream != 0) succeeded = (fclose(framebuffer->stream) == 0 && succeeded);
+
+  free(framebuffer->pixels);
+  free(framebuffer->dirty_rows);
+
+  return succeeded;
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a framebuffer option
+bool
+ParseFramebufferOption(int argc, char** argv, int* i, Framebuffer_Options* options)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  if      (strcmp(arg, "--framebuffer-raw") == 0)   options->raw = true;
+  else if (value == 0)                              result = false;
+  else if (strcmp(arg, "--framebuffer") == 0)       options->path = value, *i += 1;
+  else if (strcmp(arg, "--framebuffer-base") == 0)  options->base = (u32)strtoul(value, 0, 0), *i += 1;
+  else if (strcmp(arg, "--framebuffer-every") == 0) options->every = strtoull(value, 0, 0), *i += 1;
+  else if (strcmp(arg, "--framebuffer-size") == 0)
+  {
+    char* cursor;
+    options->width  = (u32)strtoul(value, &cursor, 0);
+    options->height = (*cursor == 'x' ? (u32)strtoul(cursor + 1, &cursor, 0) : 0);
+
+    result = (*cursor == 0 && options->width != 0 && options->height != 0);
+    if (result) *i += 1;
+  }
+  else if (strcmp(arg, "--framebuffer-format") == 0)
+  {
+    result = false;
+    for (u32 format = 0; format < FRAMEBUFFER_FORMAT_COUNT && !result; ++format)
+    {
+      if (strcmp(FramebufferFormatNames[format], value) == 0) options->format = format, result = true;
+    }
+
+    if (result) *i += 1;
+  }
+  else result = false;
+
+  return result;
+}
+
+Framebuffer_Options
+DefaultFramebufferOptions()
+{
+  return (Framebuffer_Options){
+    .base   = FRAMEBUFFER_DEFAULT_BASE,
+    .width  = FRAMEBUFFER_DEFAULT_WIDTH,
+    .height = FRAMEBUFFER_DEFAULT_HEIGHT,
+    .format = FramebufferFormat_RGBA,
+  };
+}
+
+bool
+FramebufferFitsInMemory(Framebuffer_Options* options)
+{
+  u64 size = (u64)options->width*options->height*(options->format == FramebufferFormat_Gray8 ? 1 : 4);
+  return ((u64)options->base + size <= MEMORY_SIZE);
+}
@@ -0,0 +1,239 @@
+// NOTE: Memory access heatmap
+//       Counts reads and writes per 64 byte line, and per (ip, line) pair in an open addressing table. Alignment
+//       penalty clocks are split per access the same way the estimator charges them: every word transfer at an odd
+//       address (or every word transfer on the 8088) costs 4 clocks.
+
+#define HEATMAP_LINE_SHIFT 6
+#define HEATMAP_LINE_COUNT (MEMORY_SIZE >> HEATMAP_LINE_SHIFT)
+
+typedef struct Heatmap_Line
+{
+  u32 reads;
+  u32 writes;
+  u64 penalty;
+} Heatmap_Line;
+
+typedef struct Heatmap_Entry
+{
+  u64 key; // NOTE: (ip << 14 | line) + 1, 0 marks an empty slot
+  Heatmap_Line counts;
+} Heatmap_Entry;
+
+typedef struct Heatmap
+{
+  Heatmap_Line lines[HEATMAP_LINE_COUNT];
+
+  Heatmap_Entry* entries;
+  u32 entry_count;
+  u32 entry_capacity;
+
+  u32 even_word_penalty;
+  u32 odd_word_penalty;
+} Heatmap;
+
+// NOTE: Pass 0, 0 for the penalties when no timing model applies
+Heatmap*
+Heatmap_Create(u32 even_word_penalty, u32 odd_word_penalty)
+{
+  Heatmap* heatmap = calloc(1, sizeof(Heatmap));
+
+  if (heatmap != 0)
+  {
+    heatmap->entry_capacity    = 1024;
+    heatmap->entries           = calloc(heatmap->entry_capacity, sizeof(Heatmap_Entry));
+    heatmap->even_word_penalty = even_word_penalty;
+    heatmap->odd_word_penalty  = odd_word_penalty;
+
+    if (heatmap->entries == 0)
+    {
+      free(heatmap);
+      heatmap = 0;
+    }
+  }
+
+  return heatmap;
+}
+
+Heatmap_Entry*
+Heatmap__FindSlot(Heatmap_Entry* entries, u32 capacity, u64 key)
+{
+  u32 mask = capacity - 1;
+  u32 slot = (u32)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+
+  while (entries[slot].key != 0 && entries[slot].key != key) slot = (slot + 1) & mask;
+
+  return &entries[slot];
+}
+
+void
+Heatmap__Grow(Heatmap* heatmap)
+{
+  u32 new_capacity = heatmap->entry_capacity*2;
+  Heatmap_Entry* new_entries = calloc(new_capacity, sizeof(Heatmap_Entry));
+  ASSERT(new_entries != 0);
+
+  for (u32 i = 0; i < heatmap->entry_capacity; ++i)
+  {
+    if (heatmap->entries[i].key != 0) *Heatmap__FindSlot(new_entries, new_capacity, heatmap->entries[i].key) = heatmap->entries[i];
+  }
+
+  free(heatmap->entries);
+  heatmap->entries        = new_entries;
+  heatmap->entry_capacity = new_capacity;
+}
+
+// NOTE: Call after executing the instruction at ip, log must hold the accesses made by it
+void
+Heatmap_Record(Heatmap* heatmap, u32 ip, Memory_Access_Log* log)
+{
+  for (u32 i = 0; i < log->count; ++i)
+  {
+    Memory_Access* access = &log->accesses[i];
+
+    u32 line    = access->address >> HEATMAP_LINE_SHIFT;
+    u32 penalty = 0;
+    if (access->size == 2) penalty = (access->address % 2 != 0 ? heatmap->odd_word_penalty : heatmap->even_word_penalty);
+
+    Heatmap_Line* counts = &heatmap->lines[line];
+    counts->reads   += !access->is_write;
+    counts->writes  +=  access->is_write;
+    counts->penalty += penalty;
+
+    if (2*(heatmap->entry_count + 1) > heatmap->entry_capacity) Heatmap__Grow(heatmap);
+
+    u64 key = (((u64)ip << 14) | line) + 1;
+    Heatmap_Entry* entry = Heatmap__FindSlot(heatmap->entries, heatmap->entry_capacity, key);
+    if (entry->key == 0)
+    {
+      entry->key = key;
+      heatmap->entry_count += 1;
+    }
+
+    entry->counts.reads   += !access->is_write;
+    entry->counts.writes  +=  access->is_write;
+    entry->counts.penalty += penalty;
+  }
+}
+
+int
+Heatmap__CompareEntries(const void* a, const void* b)
+{
+  u64 key_a = ((Heatmap_Entry*)a)->key;
+  u64 key_b = ((Heatmap_Entry*)b)->key;
+  return (key_a < key_b ? -1 : (key_a > key_b ? 1 : 0));
+}
+
+bool
+Heatmap__WriteLinesCSV(Heatmap* heatmap, char* path)
+{
+  bool succeeded = false;
+
+  FILE* file = fopen(path, "wb");
+  if (file != 0)
+  {
+    fprintf(file, "line_address,reads,writes,penalty_clocks\n");
+    for (u32 i = 0; i < HEATMAP_LINE_COUNT; ++i)
+    {
+      Heatmap_Line* line = &heatmap->lines[i];
+      if (line->reads != 0 || line->writes != 0)
+      {
+        fprintf(file, "0x%05x,%u,%u,%llu\n", i << HEATMAP_LINE_SHIFT, line->reads, line->writes, (unsigned long long)line->penalty);
+      }
+    }
+
+    succeeded = (fclose(file) == 0);
+  }
+
+  return succeeded;
+}
+
+bool
+Heatmap__WriteInstructionsCSV(Heatmap* heatmap, char* path)
+{
+  bool succeeded = false;
+
+  // NOTE: Sorting in place leaves the table unusable, compact it into a copy instead
+  Heatmap_Entry* sorted = malloc(MAX(heatmap->entry_count, 1)*sizeof(Heatmap_Entry));
+  FILE* file = (sorted != 0 ? fopen(path, "wb") : 0);
+  if (file != 0)
+  {
+    u32 count = 0;
+    for (u32 i = 0; i < heatmap->entry_capacity; ++i)
+    {
+      if (heatmap->entries[i].key != 0) sorted[count++] = heatmap->entries[i];
+    }
+
+    qsort(sorted, count, sizeof(Heatmap_Entry), Heatmap__CompareEntries);
+
+    fprintf(file, "ip,line_address,reads,writes,penalty_clocks\n");
+    for (u32 i = 0; i < count; ++i)
+    {
+      u64 key = sorted[i].key - 1;
+      fprintf(file, "0x%04x,0x%05x,%u,%u,%llu\n", (u32)(key >> 14), (u32)(key & (HEATMAP_LINE_COUNT - 1)) << HEATMAP_LINE_SHIFT,
+              sorted[i].counts.reads, sorted[i].counts.writes, (unsigned long long)sorted[i].counts.penalty);
+    }
+
+    succeeded = (fclose(file) == 0);
+  }
+
+  free(sorted);
+
+  return succeeded;
+}
+
+// NOTE: One pixel per line, 128x128 for the 1 MB address space, lines laid out row by row. Brightness is the
+//       log of the access count relative to the hottest line.
+bool
+Heatmap__WritePGM(Heatmap* heatmap, char* path)
+{
+  bool succeeded = false;
+
+  u32 width  = 128;
+  u32 height = HEATMAP_LINE_COUNT / width;
+
+  u32 max_count = 0;
+  for (u32 i = 0; i < HEATMAP_LINE_COUNT; ++i) max_count = MAX(max_count, heatmap->lines[i].reads + heatmap->lines[i].writes);
+
+  u32 max_log = 0;
+  while ((max_count >> max_log) != 0) ++max_log;
+
+  static u8 pixels[HEATMAP_LINE_COUNT];
+  for (u32 i = 0; i < HEATMAP_LINE_COUNT; ++i)
+  {
+    u32 count = heatmap->lines[i].reads + heatmap->lines[i].writes;
+
+    u32 log = 0;
+    while ((count >> log) != 0) ++log;
+
+    pixels[i] = (u8)(max_log != 0 ? (log*255)/max_log : 0);
+  }
+
+  FILE* file = fopen(path, "wb");
+  if (file != 0)
+  {
+    fprintf(file, "P5\n%u %u\n255\n", width, height);
+    succeeded = (fwrite(pixels, 1, sizeof(pixels), file) == sizeof(pixels));
+    succeeded = (fclose(file) == 0 && succeeded);
+  }
+
+  return succeeded;
+}
+
+// NOTE: Writes <base>.lines.csv, <base>.ips.csv and <base>.pgm
+bool
+Heatmap_Export(Heatmap* heatmap, char* base)
+{
+  char path[4096];
+  bool succeeded = true;
+
+  snprintf(path, sizeof(path), "%s.lines.csv", base);
+  succeeded = (Heatmap__WriteLinesCSV(heatmap, path) && succeeded);
+
+  snprintf(path, sizeof(path), "%s.ips.csv", base);
+  succeeded = (Heatmap__WriteInstructionsCSV(heatmap, path) && succeeded);
+
+  snprintf(path, sizeof(path), "%s.pgm", base);
+  succeeded = (Heatmap__WritePGM(heatmap, path) && succeeded);
+
+  return succeeded;
+}
@@ -0,0 +1,317 @@
+// NOTE: Execution history for stepping backwards
+//       A snapshot of the registers is taken every snapshot_interval instructions. Between two snapshots, the value
+//       a memory byte had before its first write is recorded once in that interval's undo segment. Rewinding
+//       to a snapshot applies the segments newest to oldest, after which at most snapshot_interval-1 instructions
+//       are re-executed to reach the exact target. When the history grows past its budget, older snapshots are
+//       thinned out by merging their segments, and only then is the oldest history dropped. Shadow builds keep the
+//       shadow byte of each recorded address along with its old value, so rewinding also undoes its initialization.
+
+typedef struct History_Snapshot
+{
+  u64 instruction_index;
+  CPU_State state;
+  u32 undo_first;
+} History_Snapshot;
+
+typedef struct History
+{
+  u64 snapshot_interval;
+  u64 budget;
+  u64 instruction_count;
+
+  History_Snapshot* snapshots;
+  u32 snapshot_count;
+  u32 snapshot_capacity;
+
+  u32* undo_addresses;
+  u8* undo_old_bytes;
+#if SIM86_SHADOW
+  u8* undo_old_shadow;
+#endif
+  u32 undo_count;
+  u32 undo_capacity;
+
+  // NOTE: One bit per address, set while the address has an entry in the newest segment
+  u8* recorded;
+} History;
+
+#define HISTORY_DEFAULT_INTERVAL 4096
+#define HISTORY_DEFAULT_BUDGET   (64ull << 20)
+#define HISTORY_UNDO_ENTRY_SIZE  (sizeof(u32) + sizeof(u8) + SIM86_SHADOW*sizeof(u8))
+
+bool
+History_Init(History* history, u64 snapshot_interval, u64 budget)
+{
+  *history = (History){
+    .snapshot_interval = (snapshot_interval != 0 ? snapshot_interval : HISTORY_DEFAULT_INTERVAL),
+    .budget            = (budget != 0 ? budget : HISTORY_DEFAULT_BUDGET),
+    .snapshot_capacity = 64,
+    .undo_capacity     = 4096,
+  };
+
+  history->snapshots      = malloc(history->snapshot_capacity * sizeof(History_Snapshot));
+  history->undo_addresses = malloc(history->undo_capacity * sizeof(u32));
+  history->undo_old_bytes = malloc(history->undo_capacity * sizeof(u8));
+  history->recorded       = calloc(1, MEMORY_SIZE/8);
+
+  bool result = (history->snapshots != 0 && history->undo_addresses != 0 && history->undo_old_bytes != 0 && history->recorded != 0);
+
+#if SIM86_SHADOW
+  history->undo_old_shadow = malloc(history->undo_capacity * sizeof(u8));
+  result                   = (result && history->undo_old_shadow != 0);
+#endif
+
+  return result;
+}
+
+u64
+History_UsedBytes(History* history)
+{
+  return (u64)history->snapshot_count*sizeof(History_Snapshot) + (u64)history->undo_count*HISTORY_UNDO_ENTRY_SIZE;
+}
+
+u32
+History__SegmentEnd(History* history, u32 snapshot)
+{
+  return (snapshot + 1 < history->snapshot_count ? history->snapshots[snapshot + 1].undo_first : history->undo_count);
+}
+
+void
+History__ClearRecorded(History* history, u32 first, u32 end)
+{
+  for (u32 i = first; i < end; ++i)
+  {
+    u32 address = history->undo_addresses[i];
+    history->recorded[address/8] &= ~(u8)(1 << (address%8));
+  }
+}
+
+// NOTE: Merges every other segment in the older half of the history into its predecessor. An address written in
+//       both keeps the older value, which is the one needed to rewind past both.
+void
+History__Thin(History* history)
+{
+  History__ClearRecorded(history, history->snapshots[history->snapshot_count - 1].undo_first, history->undo_count);
+
+  u32 keep_from = history->snapshot_count/2;
+
+  u32 write_snapshot = 0;
+  u32 write_undo     = 0;
+  for (u32 s = 0; s < history->snapshot_count; ++s)
+  {
+    u32 first = history->snapshots[s].undo_first;
+    u32 end   = History__SegmentEnd(history, s);
+
+    bool merge = (s < keep_from && s % 2 == 1);
+    if (!merge)
+    {
+      if (write_snapshot > 0) History__ClearRecorded(history, history->snapshots[write_snapshot - 1].undo_first, write_undo);
+
+      history->snapshots[write_snapshot] = history->snapshots[s];
+      history->snapshots[write_snapshot].undo_first = write_undo;
+      write_snapshot += 1;
+    }
+
+    for (u32 i = first; i < end; ++i)
+    {
+      u32 address = history->undo_addresses[i];
+      if (merge && (history->recorded[address/8] & (1 << (address%8)))) continue;
+
+      history->recorded[address/8] |= (u8)(1 << (address%8));
+      history->undo_addresses[write_undo] = address;
+      history->undo_old_bytes[write_undo] = history->undo_old_bytes[i];
+#if SIM86_SHADOW
+      history->undo_old_shadow[write_undo] = history->undo_old_shadow[i];
+#endif
+      write_undo += 1;
+    }
+  }
+
+  history->snapshot_count = write_snapshot;
+  history->undo_count     = write_undo;
+
+  // NOTE: The bits of the newest segment are left set, as recording continues into it
+}
+
+void
+History__DropOldest(History* history)
+{
+  ASSERT(history->snapshot_count > 1);
+
+  u32 dropped = history->snapshots[1].undo_first;
+
+  memmove(history->undo_addresses, history->undo_addresses + dropped, (history->undo_count - dropped)*sizeof(u32));
+  memmove(history->undo_old_bytes, history->undo_old_bytes + dropped, (history->undo_count - dropped)*sizeof(u8));
+#if SIM86_SHADOW
+  memmove(history->undo_old_shadow, history->undo_old_shadow + dropped, (history->undo_count - dropped)*sizeof(u8));
+#endif
+  memmove(history->snapshots, history->snapshots + 1, (history->snapshot_count - 1)*sizeof(History_Snapshot));
+
+  history->undo_count     -= dropped;
+  history->snapshot_count -= 1;
+
+  for (u32 s = 0; s < history->snapshot_count; ++s) history->snapshots[s].undo_first -= dropped;
+}
+
+void
+History__EnforceBudget(History* history)
+{
+  if (History_UsedBytes(history) > history->budget && history->snapshot_count > 4)
+  {
+    History__Thin(history);
+  }
+
+  while (History_UsedBytes(history) > history->budget && history->snapshot_count > 2)
+  {
+    History__DropOldest(history);
+  }
+}
+
+// NOTE: Call before decoding an instruction
+void
+History_BeginStep(History* history, CPU_State* state)
+{
+  if (history->instruction_count % history->snapshot_interval == 0 || history->snapshot_count == 0)
+  {
+    if (history->snapshot_count != 0)
+    {
+      u32 newest = history->snapshot_count - 1;
+      History__ClearRecorded(history, history->snapshots[newest].undo_first, history->undo_count);
+    }
+
+    if (history->snapshot_count == history->snapshot_capacity)
+    {
+      history->snapshot_capacity *= 2;
+      history->snapshots = realloc(history->snapshots, history->snapshot_capacity*sizeof(History_Snapshot));
+      ASSERT(history->snapshots != 0);
+    }
+
+    history->snapshots[history->snapshot_count++] = (History_Snapshot){
+      .instruction_index = history->instruction_count,
+      .state             = *state,
+      .undo_first        = history->undo_count,
+    };
+
+    History__EnforceBudget(history);
+  }
+}
+
+// NOTE: Call after executing an instruction, log must hold the accesses made by it. Moves the writes into the
+//       newest undo segment.
+void
+History_EndStep(History* history, Memory_Access_Log* log)
+{
+  if (history->undo_count + 2*log->count > history->undo_capacity)
+  {
+    history->undo_capacity *= 2;
+    history->undo_addresses = realloc(history->undo_addresses, history->undo_capacity*sizeof(u32));
+    history->undo_old_bytes = realloc(history->undo_old_bytes, history->undo_capacity*sizeof(u8));
+    ASSERT(history->undo_addresses != 0 && history->undo_old_bytes != 0);
+#if SIM86_SHADOW
+    history->undo_old_shadow = realloc(history->undo_old_shadow, history->undo_capacity*sizeof(u8));
+    ASSERT(history->undo_old_shadow != 0);
+#endif
+  }
+
+  for (u32 i = 0; i < log->count; ++i)
+  {
+    Memory_Access* access = &log->accesses[i];
+    if (!access->is_write) continue;
+
+    for (u32 j = 0; j < access->size; ++j)
+    {
+      u32 address = (access->address + j) & MEMORY_MASK;
+      if (history->recorded[address/8] & (1 << (address%8))) continue;
+
+      history->recorded[address/8] |= (u8)(1 << (address%8));
+      history->undo_addresses[history->undo_count] = address;
+      history->undo_old_bytes[history->undo_count] = access->old_bytes[j];
+#if SIM86_SHADOW
+      history->undo_old_shadow[history->undo_count] = access->old_shadow[j];
+#endif
+      history->undo_count += 1;
+    }
+  }
+
+  history->instruction_count += 1;
+}
+
+u64
+History_OldestIndex(History* history)
+{
+  return (history->snapshot_count != 0 ? history->snapshots[0].instruction_index : history->instruction_count);
+}
+
+// NOTE: Rewinds state to the instruction index target, which must lie between History_OldestIndex and the current
+//       instruction count. Everything recorded after target is discarded. Replaying up to target stops early where
+//       DebugStep would, on hlt or when execution leaves the image.
+bool
+History_Seek(History* history, CPU_State* state, Run_Info* run, u64 target)
+{
+  bool result = false;
+
+  if (target >= History_OldestIndex(history) && target <= history->instruction_count)
+  {
+    u32 snapshot = history->snapshot_count - 1;
+    while (history->snapshots[snapshot].instruction_index > target) --snapshot;
+
+    History__ClearRecorded(history, history->snapshots[history->snapshot_count - 1].undo_first, history->undo_count);
+
+    Memory* memory = state->memory;
+    for (u32 i = history->undo_count; i > history->snapshots[snapshot].undo_first; --i)
+    {
+      u32 address = history->undo_addresses[i - 1];
+      memory->mem[address] = history->undo_old_bytes[i - 1];
+#if SIM86_SHADOW
+      memory->shadow[address] = history->undo_old_shadow[i - 1];
+#endif
+      MemoryMarkDirty(memory, address, 1);
+    }
+
+    *state = history->snapshots[snapshot].state;
+    state->memory = memory;
+
+    history->instruction_count = history->snapshots[snapshot].instruction_index;
+    history->undo_count        = history->snapshots[snapshot].undo_first;
+    history->snapshot_count    = snapshot;
+
+    Memory_Access_Log* prev_log = memory->access_log;
+    Memory_Access_Log log = {0};
+    memory->access_log = &log;
+
+    bool halted = false;
+    while (history->instruction_count < target && !halted && IsExecutingImage(state, run))
+    {
+      History_BeginStep(history, state);
+      Instruction instruction = FetchInstruction(state);
+      log.count = 0;
+      ExecuteInstruction(state, instruction);
+      History_EndStep(history, &log);
+
+      halted = (instruction.kind == Instruction_Hlt);
+    }
+
+    memory->access_log = prev_log;
+
+    result = true;
+  }
+
+  return result;
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a history option
+bool
+ParseHistoryOption(int argc, char** argv, int* i, u64* snapshot_interval, u64* budget)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  if      (value == 0)                             result = false;
+  else if (strcmp(arg, "--history-interval") == 0) *snapshot_interval = strtoull(value, 0, 0), *i += 1;
+  else if (strcmp(arg, "--history-budget") == 0)   *budget = strtoull(value, 0, 0) << 20, *i += 1;
+  else                                             result = false;
+
+  return result;
+}
@@ -0,0 +1,283 @@
+// NOTE: Program loader
+//       Flat binaries are placed at load_segment:0. .COM files are placed at load_segment:0x100, behind a PSP at
+//       load_segment:0. MZ .EXE files get their load module at (load_segment + 0x10):0, behind the same PSP, and have
+//       their relocations fixed up. Whenever the image lands at an address that matches its file offset modulo the
+//       page size, it is mapped copy-on-write straight into Memory, so only the pages that are touched are ever read
+//       and the load time does not depend on the image size. The default segments for .COM and .EXE are picked to
+//       make that hold.
+
+typedef enum Program_Format
+{
+  ProgramFormat_Auto = 0,
+  ProgramFormat_Flat,
+  ProgramFormat_Com,
+  ProgramFormat_Exe,
+} Program_Format;
+
+typedef struct Load_Options
+{
+  Program_Format format;
+  u16 load_segment;
+  bool has_load_segment;
+} Load_Options;
+
+#define MZ_SIGNATURE      0x5A4D // "MZ"
+#define PSP_SIZE          0x100
+#define PSP_TOP_OF_MEMORY 0xA000
+#define COM_MAX_SIZE      (0x10000 - PSP_SIZE - 2)
+
+typedef struct MZ_Header
+{
+  u16 signature;
+  u16 last_page_bytes;
+  u16 page_count;
+  u16 relocation_count;
+  u16 header_paragraphs;
+  u16 min_alloc;
+  u16 max_alloc;
+  u16 ss;
+  u16 sp;
+  u16 checksum;
+  u16 ip;
+  u16 cs;
+  u16 relocation_offset;
+  u16 overlay;
+} MZ_Header;
+
+typedef struct MZ_Relocation
+{
+  u16 offset;
+  u16 segment;
+} MZ_Relocation;
+
+bool
+Load__HasComExtension(char* path)
+{
+  u64 length = strlen(path);
+  char* ext  = path + length - MIN(length, 4);
+
+  return (length >= 4 && ext[0] == '.' && (ext[1] | 0x20) == 'c' && (ext[2] | 0x20) == 'o' && (ext[3] | 0x20) == 'm');
+}
+
+// NOTE: The first segment at or above 0x100 that puts a load module starting header_paragraphs into the file at a
+//       page aligned address, so it can be mapped instead of copied
+u16
+Load__DefaultSegment(u16 header_paragraphs)
+{
+  return (u16)(0x100 + ((header_paragraphs - 0x10) & 0xFF));
+}
+
+bool
+Load__PlaceImage(Platform_File file, u64 offset, u32 size, Memory* memory, u32 address, bool allow_mapping)
+{
+  bool result;
+
+  u32 skew = (u32)(offset % PLATFORM_PAGE_SIZE);
+  if (allow_mapping && size != 0 && address % PLATFORM_PAGE_SIZE == skew)
+  {
+    u32 map_start = address - skew;
+    u32 map_end   = (address + size + PLATFORM_PAGE_SIZE - 1) & ~(u32)(PLATFORM_PAGE_SIZE - 1);
+
+    result = Platform_MapPrivateAt(file, offset - skew, memory->mem + map_start, map_end - map_start);
+
+    // NOTE: The mapping covers whole pages, clear whatever else the file has in the first and last one
+    if (result)
+    {
+      memset(memory->mem + map_start, 0, skew);
+      memset(memory->mem + address + size, 0, map_end - (address + size));
+    }
+  }
+  else
+  {
+    result = Platform_ReadAt(file, offset, memory->mem + address, size);
+    MemoryMarkDirty(memory, address, size);
+  }
+
+  return result;
+}
+
+void
+Load__WritePSP(Memory* memory, u16 segment)
+{
+  u32 base = (u32)segment << 4;
+
+  WriteByte(memory, base + 0x00, 0xCD); // NOTE: int 20h, where a .COM returns to
+  WriteByte(memory, base + 0x01, 0x20);
+  WriteWord(memory, base + 0x02, PSP_TOP_OF_MEMORY);
+  WriteByte(memory, base + 0x80, 0);    // NOTE: Empty command tail
+  WriteByte(memory, base + 0x81, 0x0D);
+
+#if SIM86_SHADOW
+  ShadowMarkInitialized(memory, base, PSP_SIZE);
+#endif
+}
+
+bool
+Load__ApplyRelocations(Platform_File file, MZ_Header* header, Memory* memory, u16 start_segment)
+{
+  bool succeeded = true;
+
+  MZ_Relocation relocations[256];
+  for (u32 first = 0; first < header->relocation_count && succeeded;)
+  {
+    u32 count = MIN(header->relocation_count - first, sizeof(relocations)/sizeof(0[relocations]));
+    succeeded = Platform_ReadAt(file, header->relocation_offset + first*sizeof(MZ_Relocation), relocations, count*sizeof(MZ_Relocation));
+
+    for (u32 i = 0; i < count && succeeded; ++i)
+    {
+      u32 address = ((((u32)start_segment + relocations[i].segment) << 4) + relocations[i].offset) & MEMORY_MASK;
+      WriteWord(memory, address, ReadWord(memory, address) + start_segment);
+    }
+
+    first += count;
+  }
+
+  return succeeded;
+}
+
+// NOTE: Loads into target when it is non-zero, which must be zeroed memory, otherwise into freshly allocated memory
+Memory*
+Load__Program(char* path, Load_Options options, Memory* target, CPU_State* state, Run_Info* run)
+{
+  Memory* result = 0;
+
+  Platform_File file;
+  if (!Platform_OpenFileForReading(path, &file)) fprintf(stderr, "Failed to open input binary\n");
+  else
+  {
+    u64 file_size = 0;
+    MZ_Header header = {0};
+
+    bool succeeded = Platform_GetFileSize(file, &file_size);
+    if (succeeded && file_size >= sizeof(MZ_Header)) succeeded = Platform_ReadAt(file, 0, &header, sizeof(header));
+
+    Program_Format format = options.format;
+    if (format == ProgramFormat_Auto)
+    {
+      if      (file_size >= sizeof(MZ_Header) && header.signature == MZ_SIGNATURE) format = ProgramFormat_Exe;
+      else if (Load__HasComExtension(path))                                         format = ProgramFormat_Com;
+      else                                                                          format = ProgramFormat_Flat;
+    }
+
+    u64 image_offset = 0;
+    u64 image_size   = file_size;
+    u16 segment      = 0;
+    if (format == ProgramFormat_Com) segment = Load__DefaultSegment(0);
+    if (format == ProgramFormat_Exe)
+    {
+      image_offset = (u64)header.header_paragraphs << 4;
+      image_size   = (u64)header.page_count*512 - (header.last_page_bytes != 0 ? 512 - header.last_page_bytes : 0);
+      image_size   = (image_size > image_offset ? image_size - image_offset : 0);
+      segment      = Load__DefaultSegment(header.header_paragraphs);
+    }
+    if (options.has_load_segment) segment = options.load_segment;
+
+    u32 image_address = (u32)segment << 4;
+    if (format != ProgramFormat_Flat) image_address += PSP_SIZE;
+
+    Memory* memory = target;
+    if      (!succeeded)                                                             fprintf(stderr, "Failed to read input binary\n");
+    else if (format == ProgramFormat_Exe && header.signature != MZ_SIGNATURE)        fprintf(stderr, "Input binary is not an MZ executable\n");
+    else if (format == ProgramFormat_Exe && image_offset + image_size > file_size)   fprintf(stderr, "Input binary is truncated\n");
+    else if (format == ProgramFormat_Com && image_size > COM_MAX_SIZE)               fprintf(stderr, "Input binary is too large\n");
+    else if (image_address + image_size > MEMORY_SIZE)                               fprintf(stderr, "Input binary is too large\n");
+    else if (target == 0 && (memory = Platform_AllocateMemory(sizeof(Memory))) == 0) fprintf(stderr, "Failed to allocate memory\n");
+    else
+    {
+      // NOTE: Mapped pages can't be told apart from the memory underneath, so memory that is reused gets a copy
+      succeeded = Load__PlaceImage(file, image_offset, (u32)image_size, memory, image_address, target == 0);
+
+#if SIM86_SHADOW
+      ShadowMarkInitialized(memory, image_address, (u32)image_size);
+#endif
+
+      *state = (CPU_State){ .memory = memory };
+      *run   = (Run_Info){ .code_start = image_address, .code_end = image_address + (u32)image_size };
+
+      if (format == ProgramFormat_Flat)
+      {
+        SetRegister(state, Register_CS, segment);
+        SetRegister(state, Register_DS, segment);
+        SetRegister(state, Register_ES, segment);
+        SetRegister(state, Register_SS, segment);
+      }
+      else if (format == ProgramFormat_Com)
+      {
+        Load__WritePSP(memory, segment);
+
+        SetRegister(state, Register_CS, segment);
+        SetRegister(state, Register_DS, segment);
+        SetRegister(state, Register_ES, segment);
+        SetRegister(state, Register_SS, segment);
+        SetRegister(state, Register_SP, 0xFFFE); // NOTE: The word at ss:fffe is 0, so a near ret lands on int 20h
+        state->ip = PSP_SIZE;
+      }
+      else
+      {
+        Load__WritePSP(memory, segment);
+
+        u16 start_segment = segment + (PSP_SIZE >> 4);
+        if (succeeded) succeeded = Load__ApplyRelocations(file, &header, memory, start_segment);
+
+        SetRegister(state, Register_CS, start_segment + header.cs);
+        SetRegister(state, Register_SS, start_segment + header.ss);
+        SetRegister(state, Register_SP, header.sp);
+        SetRegister(state, Register_DS, segment);
+        SetRegister(state, Register_ES, segment);
+        state->ip = header.ip;
+      }
+
+      if (succeeded) result = memory;
+      else
+      {
+        fprintf(stderr, "Failed to read input binary\n");
+        if (target == 0) Platform_FreeMemory(memory, sizeof(Memory));
+      }
+    }
+
+    // NOTE: Mappings stay valid after the file is closed
+    Platform_CloseFile(file);
+  }
+
+  return result;
+}
+
+// NOTE: The returned memory is owned by the caller and must be released with Platform_FreeMemory(memory, sizeof(Memory))
+Memory*
+LoadProgram(char* path, Load_Options options, CPU_State* state, Run_Info* run)
+{
+  return Load__Program(path, options, 0, state, run);
+}
+
+// NOTE: Copies the program into memory, which must be zeroed, for instance by MemoryReset. The pages written are
+//       marked dirty, so the next MemoryReset clears them.
+bool
+LoadProgramInto(char* path, Load_Options options, Memory* memory, CPU_State* state, Run_Info* run)
+{
+  return (Load__Program(path, options, memory, state, run) != 0);
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a load option
+bool
+ParseLoadOption(int argc, char** argv, int* i, Load_Options* options)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  if      (value == 0)                         result = false;
+  else if (strcmp(arg, "--load-segment") == 0) options->load_segment = (u16)strtoul(value, 0, 0), options->has_load_segment = true, *i += 1;
+  else if (strcmp(arg, "--format") == 0)
+  {
+    if      (strcmp(value, "flat") == 0) options->format = ProgramFormat_Flat;
+    else if (strcmp(value, "com") == 0)  options->format = ProgramFormat_Com;
+    else if (strcmp(value, "exe") == 0)  options->format = ProgramFormat_Exe;
+    else                                 result = false;
+
+    if (result) *i += 1;
+  }
+  else result = false;
+
+  return result;
+}
@@ -0,0 +1,151 @@
+// NOTE: Machine model
+//       Stalls a PC class machine adds on top of the per-instruction clocks. DRAM refresh: every refresh_interval
+//       clocks, counted from clock 0, DMA channel 0 takes the bus for refresh_clocks, and the instruction running
+//       at that point waits it out. Wait states: every bus cycle to memory in a region takes extra clocks, e.g.
+//       video memory. Both show up as the wait part of an instruction's clocks. Only the transfers an instruction
+//       makes for its operands pay wait states, fetching code from a region doesn't.
+
+#define MACHINE_REGION_MAX 8
+
+// NOTE: PC/XT, PIT channel 1 requests a refresh every 18 of its 1.19 MHz ticks, 72 clocks at 4.77 MHz (~15 us),
+//       and the DMA cycle that serves it keeps the processor off the bus for 4 clocks
+#define MACHINE_PCXT_REFRESH_INTERVAL 72
+#define MACHINE_PCXT_REFRESH_CLOCKS   4
+
+typedef struct Machine_Region
+{
+  u32 start;
+  u32 end; // NOTE: Inclusive
+  u32 wait_states;
+} Machine_Region;
+
+typedef struct Machine_Options
+{
+  u32 refresh_interval; // NOTE: 0 means no refresh
+  u32 refresh_clocks;
+  Machine_Region regions[MACHINE_REGION_MAX];
+  u32 region_count;
+} Machine_Options;
+
+typedef struct Machine
+{
+  Machine_Options* options;
+  bool narrow_bus; // NOTE: 8 bit
+  u64 next_refresh;
+
+  u64 refresh_stalls;
+  u64 wait_stalls;
+} Machine;
+
+bool
+MachineIsModeled(Machine_Options* options)
+{
+  return (options->refresh_interval != 0 || options->region_count != 0);
+}
+
+void
+Machine_Begin(Machine* machine, Machine_Options* options, bool narrow_bus, u64 clocks)
+{
+  *machine = (Machine){ .options = options, .narrow_bus = narrow_bus };
+  if (options->refresh_interval != 0) machine->next_refresh = (clocks/options->refresh_interval + 1)*options->refresh_interval;
+}
+
+// NOTE: Adds the stalls of an instruction that started at clock start to the wait part of its clocks. log must hold
+//       the accesses it made.
+void
+Machine_Step(Machine* machine, Clocks* clocks, u64 start, Memory_Access_Log* log)
+{
+  Machine_Options* options = machine->options;
+
+  uint waits = 0;
+  for (u32 i = 0; i < log->count && options->region_count != 0; ++i)
+  {
+    Memory_Access* access = &log->accesses[i];
+
+    // NOTE: A word takes two bus cycles at an odd address or on an 8 bit bus, either may land in a region
+    bool split = (access->size == 2 && (machine->narrow_bus || access->address%2 != 0));
+    for (u32 cycle = 0; cycle < (split ? 2u : 1u); ++cycle)
+    {
+      u32 address = (access->address + cycle) & MEMORY_MASK;
+      for (u32 j = 0; j < options->region_count; ++j)
+      {
+        Machine_Region* region = &options->regions[j];
+        if (address >= region->start && address <= region->end)
+        {
+          waits += region->wait_states;
+          break;
+        }
+      }
+    }
+  }
+
+  u64 end      = start + TotalClocks(*clocks) + waits;
+  uint refresh = 0;
+  if (options->refresh_interval != 0)
+  {
+    while (machine->next_refresh < end)
+    {
+      end                   += options->refresh_clocks;
+      refresh               += options->refresh_clocks;
+      machine->next_refresh += options->refresh_interval;
+    }
+  }
+
+  clocks->wait            += waits + refresh;
+  machine->wait_stalls    += waits;
+  machine->refresh_stalls += refresh;
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a machine option
+bool
+ParseMachineOption(int argc, char** argv, int* i, Machine_Options* options)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  if      (value == 0) result = false;
+  else if (strcmp(arg, "--machine") == 0)
+  {
+    result = (strcmp(value, "pcxt") == 0);
+    if (result)
+    {
+      options->refresh_interval = MACHINE_PCXT_REFRESH_INTERVAL;
+      options->refresh_clocks   = MACHINE_PCXT_REFRESH_CLOCKS;
+      *i += 1;
+    }
+  }
+  else if (strcmp(arg, "--refresh") == 0)
+  {
+    char* cursor;
+    options->refresh_interval = (u32)strtoul(value, &cursor, 0);
+    options->refresh_clocks   = (*cursor == ',' ? (u32)strtoul(cursor + 1, &cursor, 0) : MACHINE_PCXT_REFRESH_CLOCKS);
+
+    // NOTE: A refresh has to be over before the next one is due
+    result = (*cursor == 0 && options->refresh_clocks < options->refresh_interval);
+    if (result) *i += 1;
+  }
+  else if (strcmp(arg, "--wait-states") == 0)
+  {
+    Machine_Region region = {0};
+
+    char* cursor;
+    region.start = (u32)strtoul(value, &cursor, 0);
+    region.end   = region.start;
+    if (*cursor == '-') region.end = (u32)strtoul(cursor + 1, &cursor, 0);
+
+    result = (cursor != value && *cursor == '=' && region.start <= region.end && options->region_count < MACHINE_REGION_MAX);
+    if (result)
+    {
+      char* number       = cursor + 1;
+      region.wait_states = (u32)strtoul(number, &cursor, 0);
+      result             = (cursor != number && *cursor == 0);
+    }
+
+    if (result) options->regions[options->region_count++] = region, *i += 1;
+  }
+  else result = false;
+
+  return result;
+}
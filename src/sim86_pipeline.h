@@ -0,0 +1,196 @@
+// NOTE: Trace pipeline
+//       With --trace-threads, the thread running the program only copies each traced step into a record, and
+//       formatter threads turn the records into text. Records travel in chunks, dealt round robin to the formatters
+//       through one single producer, single consumer ring each. Formatters take turns writing out their chunks in
+//       the order the chunks were filled, so the output is the same as formatting on the spot.
+
+#define PIPELINE_CHUNK_STEPS    4096
+#define PIPELINE_RING_SIZE      4 // NOTE: Chunks in flight per formatter
+#define PIPELINE_MAX_FORMATTERS 16
+#define PIPELINE_TEXT_CAPACITY  (PIPELINE_CHUNK_STEPS*2*WRITER_LINE_MAX) // NOTE: Estimate lines run longer with several models
+
+typedef struct Pipeline_Record
+{
+  Instruction instruction;
+  CPU_State prev_state;
+  CPU_State state;
+
+  // NOTE: Estimate only, one per model
+  Clocks clocks[ESTIMATE_MODEL_MAX];
+  u64 total_clocks[ESTIMATE_MODEL_MAX];
+} Pipeline_Record;
+
+typedef struct Pipeline_Chunk
+{
+  u64 sequence;
+  u32 count;
+  Pipeline_Record records[PIPELINE_CHUNK_STEPS];
+} Pipeline_Chunk;
+
+// NOTE: The indices count chunks and only ever grow, each on a cache line of its own
+typedef struct Pipeline_Ring
+{
+  volatile u64 write_index;
+  u8 write_pad[56];
+  volatile u64 read_index;
+  u8 read_pad[56];
+
+  Pipeline_Chunk chunks[PIPELINE_RING_SIZE];
+} Pipeline_Ring;
+
+typedef struct Pipeline_Formatter
+{
+  struct Pipeline* pipeline;
+  Pipeline_Ring ring;
+  char* text;
+  Platform_Thread thread;
+} Pipeline_Formatter;
+
+typedef struct Pipeline
+{
+  Trace_Kind kind;
+  FILE* file;
+  u32 model_count;
+  char** model_names;
+
+  Pipeline_Formatter* formatters[PIPELINE_MAX_FORMATTERS];
+  u32 formatter_count;
+
+  volatile u64 next_write; // NOTE: Sequence number of the chunk whose text goes out next
+  volatile u64 done;
+
+  // NOTE: Producer side, chunk is the one being filled
+  u64 sequence;
+  Pipeline_Chunk* chunk;
+} Pipeline;
+
+void
+Pipeline__Format(void* data)
+{
+  Pipeline_Formatter* formatter = data;
+  Pipeline* pipeline            = formatter->pipeline;
+  Pipeline_Ring* ring           = &formatter->ring;
+
+  for (u64 read_index = 0;;)
+  {
+    if (read_index == Platform_AtomicLoad(&ring->write_index))
+    {
+      // NOTE: Every chunk is published before done is set, so one more look at write_index settles it
+      if (Platform_AtomicLoad(&pipeline->done) && read_index == Platform_AtomicLoad(&ring->write_index)) break;
+
+      Platform_Yield();
+      continue;
+    }
+
+    Pipeline_Chunk* chunk = &ring->chunks[read_index % PIPELINE_RING_SIZE];
+    u64 sequence          = chunk->sequence;
+
+    // NOTE: The text buffer holds a full chunk, so the writer never flushes on its own
+    Writer writer;
+    Writer_Init(&writer, pipeline->file, formatter->text, PIPELINE_TEXT_CAPACITY);
+
+    for (u32 i = 0; i < chunk->count; ++i)
+    {
+      Pipeline_Record* record = &chunk->records[i];
+      if (pipeline->kind == TraceKind_Estimate) WriteEstimateStep(&writer, record->instruction, pipeline->model_count, pipeline->model_names, record->clocks, record->total_clocks, &record->prev_state, &record->state);
+      else                                      WriteExecuteStep(&writer, record->instruction, &record->prev_state, &record->state);
+    }
+
+    read_index += 1;
+    Platform_AtomicStore(&ring->read_index, read_index);
+
+    while (Platform_AtomicLoad(&pipeline->next_write) != sequence) Platform_Yield();
+    Writer_Flush(&writer);
+    Platform_AtomicStore(&pipeline->next_write, sequence + 1);
+  }
+}
+
+void
+Pipeline__Publish(Pipeline* pipeline)
+{
+  if (pipeline->chunk != 0)
+  {
+    Pipeline_Ring* ring = &pipeline->formatters[pipeline->sequence % pipeline->formatter_count]->ring;
+    Platform_AtomicStore(&ring->write_index, ring->write_index + 1);
+
+    pipeline->sequence += 1;
+    pipeline->chunk     = 0;
+  }
+}
+
+void
+Pipeline__Stop(Pipeline* pipeline, u32 started)
+{
+  Platform_AtomicStore(&pipeline->done, 1);
+
+  for (u32 i = 0; i < pipeline->formatter_count; ++i)
+  {
+    if (i < started) Platform_JoinThread(pipeline->formatters[i]->thread);
+
+    free(pipeline->formatters[i]->text);
+    Platform_FreeMemory(pipeline->formatters[i], sizeof(Pipeline_Formatter));
+  }
+
+  pipeline->formatter_count = 0;
+}
+
+// NOTE: model_count and model_names are the estimate models, see WriteEstimateStep
+bool
+Pipeline_Start(Pipeline* pipeline, Trace_Kind kind, FILE* file, u32 formatter_count, u32 model_count, char** model_names)
+{
+  *pipeline = (Pipeline){ .kind = kind, .file = file, .model_count = model_count, .model_names = model_names };
+
+  bool succeeded = (formatter_count != 0 && formatter_count <= PIPELINE_MAX_FORMATTERS);
+  for (u32 i = 0; i < formatter_count && succeeded; ++i)
+  {
+    Pipeline_Formatter* formatter = Platform_AllocateMemory(sizeof(Pipeline_Formatter));
+    if (formatter == 0) succeeded = false;
+    else
+    {
+      pipeline->formatters[pipeline->formatter_count++] = formatter;
+
+      formatter->pipeline = pipeline;
+      formatter->text     = malloc(PIPELINE_TEXT_CAPACITY);
+      succeeded           = (formatter->text != 0);
+    }
+  }
+
+  u32 started = 0;
+  while (succeeded && started < pipeline->formatter_count)
+  {
+    Pipeline_Formatter* formatter = pipeline->formatters[started];
+    succeeded = Platform_StartThread(&formatter->thread, Pipeline__Format, formatter);
+    if (succeeded) started += 1;
+  }
+
+  if (!succeeded) Pipeline__Stop(pipeline, started);
+
+  return succeeded;
+}
+
+// NOTE: Returns the record for the next step, to be filled in before the next call
+Pipeline_Record*
+Pipeline_Push(Pipeline* pipeline)
+{
+  if (pipeline->chunk != 0 && pipeline->chunk->count == PIPELINE_CHUNK_STEPS) Pipeline__Publish(pipeline);
+
+  if (pipeline->chunk == 0)
+  {
+    Pipeline_Ring* ring = &pipeline->formatters[pipeline->sequence % pipeline->formatter_count]->ring;
+    while (ring->write_index - Platform_AtomicLoad(&ring->read_index) == PIPELINE_RING_SIZE) Platform_Yield();
+
+    pipeline->chunk           = &ring->chunks[ring->write_index % PIPELINE_RING_SIZE];
+    pipeline->chunk->sequence = pipeline->sequence;
+    pipeline->chunk->count    = 0;
+  }
+
+  return &pipeline->chunk->records[pipeline->chunk->count++];
+}
+
+// NOTE: Returns once every record pushed is written out
+void
+Pipeline_Finish(Pipeline* pipeline)
+{
+  Pipeline__Publish(pipeline);
+  Pipeline__Stop(pipeline, pipeline->formatter_count);
+}
@@ -0,0 +1,303 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+typedef HANDLE Platform_File;
+typedef HANDLE Platform_Thread;
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// NOTE: MAP_ANONYMOUS isn't in POSIX.1-2008 and the huge page flags are Linux only. The feature macros that make the
+//       C libraries declare them also typedef uint differently from sim86.h. On Linux the kernel's own header has
+//       them, with the values of the architecture built for.
+#if !defined(MAP_HUGETLB) && defined(__linux__)
+#include <linux/mman.h>
+#endif
+
+#ifndef MAP_ANONYMOUS
+#error "sim86_platform.h: the system headers don't define MAP_ANONYMOUS without _DEFAULT_SOURCE or _DARWIN_C_SOURCE"
+#endif
+
+typedef int Platform_File;
+typedef pthread_t Platform_Thread;
+#endif
+
+typedef void Platform_Thread_Proc(void* data);
+
+#define PLATFORM_PAGE_SIZE       4096
+#define PLATFORM_LARGE_PAGE_SIZE (2ull << 20)
+
+// NOTE: Seconds since an arbitrary point, for measuring intervals
+double
+Platform_GetSeconds(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec*1e-9;
+#endif
+}
+
+// NOTE: Returns zeroed, page aligned memory
+void*
+Platform_AllocateMemory(u64 size)
+{
+#ifdef _WIN32
+  return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+  void* result = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (result == MAP_FAILED ? 0 : result);
+#endif
+}
+
+void
+Platform_FreeMemory(void* memory, u64 size)
+{
+#ifdef _WIN32
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  munmap(memory, size);
+#endif
+}
+
+// NOTE: Returns zeroed memory aligned to PLATFORM_LARGE_PAGE_SIZE, backed by large pages when the system has them
+//       to spare, which is only asked for on Windows and Linux. Otherwise falls back to regular pages, on Linux with a
+//       request for transparent huge pages.
+void*
+Platform_AllocateLargeMemory(u64 size)
+{
+  u64 large_size = (size + PLATFORM_LARGE_PAGE_SIZE - 1) & ~(PLATFORM_LARGE_PAGE_SIZE - 1);
+
+#ifdef _WIN32
+  // NOTE: Needs SeLockMemoryPrivilege, which most users don't have
+  void* result = 0;
+  SIZE_T large_page_size = GetLargePageMinimum();
+  if (large_page_size != 0 && large_size % large_page_size == 0)
+  {
+    result = VirtualAlloc(0, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  }
+
+  if (result == 0) result = VirtualAlloc(0, large_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+  return result;
+#else
+  void* result = MAP_FAILED;
+#ifdef __linux__
+  result = mmap(0, large_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+  if (result == MAP_FAILED)
+  {
+    // NOTE: Over-allocate by one large page to carve out an aligned range, which transparent huge pages need
+    u8* base = mmap(0, large_size + PLATFORM_LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) result = 0;
+    else
+    {
+      u8* aligned = (u8*)(((uintptr_t)base + PLATFORM_LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(PLATFORM_LARGE_PAGE_SIZE - 1));
+      u8* end     = base + large_size + PLATFORM_LARGE_PAGE_SIZE;
+
+      if (aligned != base)             munmap(base, aligned - base);
+      if (aligned + large_size != end) munmap(aligned + large_size, end - (aligned + large_size));
+
+#ifdef __linux__
+      // NOTE: Only a hint, the allocation is still usable when THP is disabled. glibc and musl pass any advice but
+      //       POSIX_MADV_DONTNEED on to madvise, which they only declare behind _DEFAULT_SOURCE.
+      posix_madvise(aligned, large_size, MADV_HUGEPAGE);
+#endif
+
+      result = aligned;
+    }
+  }
+
+  return result;
+#endif
+}
+
+void
+Platform_FreeLargeMemory(void* memory, u64 size)
+{
+  Platform_FreeMemory(memory, (size + PLATFORM_LARGE_PAGE_SIZE - 1) & ~(PLATFORM_LARGE_PAGE_SIZE - 1));
+}
+
+bool
+Platform_OpenFileForReading(char* path, Platform_File* file)
+{
+#ifdef _WIN32
+  *file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  return (*file != INVALID_HANDLE_VALUE);
+#else
+  *file = open(path, O_RDONLY);
+  return (*file != -1);
+#endif
+}
+
+void
+Platform_CloseFile(Platform_File file)
+{
+#ifdef _WIN32
+  CloseHandle(file);
+#else
+  close(file);
+#endif
+}
+
+bool
+Platform_GetFileSize(Platform_File file, u64* size)
+{
+#ifdef _WIN32
+  LARGE_INTEGER file_size;
+  bool result = !!GetFileSizeEx(file, &file_size);
+  *size = (u64)file_size.QuadPart;
+  return result;
+#else
+  struct stat info;
+  bool result = (fstat(file, &info) == 0);
+  *size = (u64)info.st_size;
+  return result;
+#endif
+}
+
+bool
+Platform_ReadAt(Platform_File file, u64 offset, void* dest, u64 size)
+{
+#ifdef _WIN32
+  OVERLAPPED overlapped = { .Offset = (DWORD)offset, .OffsetHigh = (DWORD)(offset >> 32) };
+  DWORD bytes_read;
+  return (ReadFile(file, dest, (DWORD)size, &bytes_read, &overlapped) && bytes_read == size);
+#else
+  u8* cursor = dest;
+  while (size != 0)
+  {
+    ssize_t bytes_read = pread(file, cursor, size, offset);
+    if (bytes_read <= 0) break;
+
+    cursor += bytes_read;
+    offset += bytes_read;
+    size   -= bytes_read;
+  }
+
+  return (size == 0);
+#endif
+}
+
+// NOTE: Maps [offset, offset + size) of the file copy-on-write over dest. dest, offset and size must be page aligned.
+//       Pages are faulted in on first touch, writes never reach the file. The part of the last page past the end
+//       of the file reads as zero.
+bool
+Platform_MapPrivateAt(Platform_File file, u64 offset, void* dest, u64 size)
+{
+#ifdef _WIN32
+  // NOTE: MapViewOfFileEx can't replace part of an existing allocation, so on Windows the range is read in up front
+  //       instead and costs time proportional to its size. dest has to be zeroed, which stands in for the tail of
+  //       the last page.
+  OVERLAPPED overlapped = { .Offset = (DWORD)offset, .OffsetHigh = (DWORD)(offset >> 32) };
+  DWORD bytes_read;
+  return !!ReadFile(file, dest, (DWORD)size, &bytes_read, &overlapped);
+#else
+  return (mmap(dest, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file, offset) != MAP_FAILED);
+#endif
+}
+
+typedef struct Platform__Thread_Start
+{
+  Platform_Thread_Proc* proc;
+  void* data;
+} Platform__Thread_Start;
+
+#ifdef _WIN32
+DWORD WINAPI
+Platform__ThreadMain(LPVOID parameter)
+#else
+void*
+Platform__ThreadMain(void* parameter)
+#endif
+{
+  Platform__Thread_Start start = *(Platform__Thread_Start*)parameter;
+  free(parameter);
+
+  start.proc(start.data);
+
+  return 0;
+}
+
+bool
+Platform_StartThread(Platform_Thread* thread, Platform_Thread_Proc* proc, void* data)
+{
+  bool result = false;
+
+  Platform__Thread_Start* start = malloc(sizeof(Platform__Thread_Start));
+  if (start != 0)
+  {
+    *start = (Platform__Thread_Start){ .proc = proc, .data = data };
+
+#ifdef _WIN32
+    *thread = CreateThread(0, 0, Platform__ThreadMain, start, 0, 0);
+    result  = (*thread != 0);
+#else
+    result = (pthread_create(thread, 0, Platform__ThreadMain, start) == 0);
+#endif
+
+    if (!result) free(start);
+  }
+
+  return result;
+}
+
+void
+Platform_JoinThread(Platform_Thread thread)
+{
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, 0);
+#endif
+}
+
+void
+Platform_Yield(void)
+{
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+// NOTE: A load that no later load or store is moved ahead of, pairs with Platform_AtomicStore
+u64
+Platform_AtomicLoad(volatile u64* value)
+{
+#ifdef _WIN32
+  u64 result = *value; // NOTE: Aligned 64 bit loads are atomic on x64, and volatile accesses are ordered by MSVC
+  _ReadWriteBarrier();
+  return result;
+#else
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// NOTE: A store that no earlier load or store is moved behind
+void
+Platform_AtomicStore(volatile u64* value, u64 new_value)
+{
+#ifdef _WIN32
+  _ReadWriteBarrier();
+  *value = new_value;
+#else
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+#endif
+}
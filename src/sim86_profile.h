@@ -0,0 +1,214 @@
+// NOTE: Hotspot profile
+//       Counters per instruction address of the image: how often the instruction ran, its clocks, and the EA and
+//       alignment penalty parts of them. A step is four adds into the slot of its address, the slots are indexed by
+//       the address relative to the start of the image, which is where execution stays. The report ranks the
+//       addresses by clocks. A NASM listing (nasm -l) of the input can be annotated with the counters, the offset
+//       column of a line is taken relative to the start of the image, which is what NASM prints for flat binaries,
+//       whatever their org. Lines of the listing keep their text and get the counters of the bytes they emitted.
+
+#define PROFILE_LISTING_LINE_MAX 4096
+
+typedef struct Profile_Site
+{
+  u64 count;
+  u64 clocks;
+  u64 ea;
+  u64 penalty;
+} Profile_Site;
+
+typedef struct Profile
+{
+  Profile_Site* sites;
+  u32 start;
+  u32 end;
+  u16 cs; // NOTE: Jump targets are printed relative to it
+} Profile;
+
+bool
+Profile_Begin(Profile* profile, Run_Info* run, CPU_State* state)
+{
+  *profile = (Profile){
+    .sites = calloc(run->code_end - run->code_start, sizeof(Profile_Site)),
+    .start = run->code_start,
+    .end   = run->code_end,
+    .cs    = GetRegister(state, Register_CS),
+  };
+
+  return (profile->sites != 0);
+}
+
+// NOTE: address is where the instruction is, it has to be in the image. Takes the parts of the instruction's clocks
+//       rather than its Clocks, copying those into every step costs more than the adds.
+void
+Profile_Step(Profile* profile, u32 address, uint clocks, uint ea, uint penalty)
+{
+  Profile_Site* site = &profile->sites[address - profile->start];
+  site->count   += 1;
+  site->clocks  += clocks;
+  site->ea      += ea;
+  site->penalty += penalty;
+}
+
+typedef struct Profile_Rank
+{
+  u64 clocks;
+  u32 index;
+} Profile_Rank;
+
+// NOTE: Most clocks first, then by address
+int
+Profile__CompareRanks(const void* a, const void* b)
+{
+  const Profile_Rank* x = a;
+  const Profile_Rank* y = b;
+
+  int result;
+  if      (x->clocks != y->clocks) result = (x->clocks > y->clocks ? -1 : 1);
+  else if (x->index != y->index)   result = (x->index < y->index ? -1 : 1);
+  else                             result = 0;
+
+  return result;
+}
+
+u64
+Profile__TotalClocks(Profile* profile)
+{
+  u64 result = 0;
+  for (u32 i = 0; i < profile->end - profile->start; ++i) result += profile->sites[i].clocks;
+
+  return result;
+}
+
+// NOTE: Prints the top instructions by clocks, model is the name of the timing model the clocks are from
+void
+Profile_Report(Profile* profile, Memory* memory, char* model, u32 top)
+{
+  u32 executed = 0;
+  for (u32 i = 0; i < profile->end - profile->start; ++i) executed += (profile->sites[i].count != 0);
+
+  Profile_Rank* ranks = malloc((executed != 0 ? executed : 1)*sizeof(Profile_Rank));
+  ASSERT(ranks != 0);
+
+  for (u32 i = 0, j = 0; i < profile->end - profile->start; ++i)
+  {
+    if (profile->sites[i].count != 0) ranks[j++] = (Profile_Rank){ .clocks = profile->sites[i].clocks, .index = i };
+  }
+
+  qsort(ranks, executed, sizeof(Profile_Rank), Profile__CompareRanks);
+
+  u64 total   = Profile__TotalClocks(profile);
+  u32 shown   = MIN(executed, top);
+  u32 cs_base = (u32)profile->cs << 4;
+
+  printf("\nHotspots (%s): the top %u of %u instructions by clocks\n", model, shown, executed);
+  if (shown != 0) printf("    Clocks       %%      Count         EA    Penalty  Address  Instruction\n");
+
+  for (u32 i = 0; i < shown; ++i)
+  {
+    u32 address        = profile->start + ranks[i].index;
+    Profile_Site* site = &profile->sites[ranks[i].index];
+
+    u32 cursor              = address;
+    Instruction instruction = DecodeInstruction(memory, &cursor);
+
+    printf("%10llu %6.2f%% %10llu %10llu %10llu  0x%05x  ", (unsigned long long)site->clocks,
+           (total != 0 ? 100.0*(double)site->clocks/(double)total : 0.0), (unsigned long long)site->count,
+           (unsigned long long)site->ea, (unsigned long long)site->penalty, address);
+    PrintInstruction(instruction, (u16)(address - cs_base), stdout);
+    printf("\n");
+  }
+
+  free(ranks);
+}
+
+bool
+Profile__IsHexDigit(char c)
+{
+  return ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f'));
+}
+
+// NOTE: The offset and the number of bytes a listing line emitted, false for lines without any.
+//       A line is "%6d %08X %-19s" and then the source, bytes NASM only knows after linking are in brackets.
+bool
+Profile__ParseListingLine(char* line, u32* offset, u32* size)
+{
+  char* at = line;
+  while (*at == ' ') ++at;
+  while (*at >= '0' && *at <= '9') ++at;
+
+  bool result = (at != line && *at == ' ');
+  for (u32 i = 1; i <= 8 && result; ++i) result = Profile__IsHexDigit(at[i]);
+
+  if (result && at[9] == ' ')
+  {
+    *offset = (u32)strtoul(at + 1, 0, 16);
+
+    u32 digits = 0;
+    for (at += 10; *at != 0 && *at != ' ' && *at != '-' && *at != '<'; ++at) digits += Profile__IsHexDigit(*at);
+
+    *size  = digits/2;
+    result = (*size != 0);
+  }
+  else result = false;
+
+  return result;
+}
+
+// NOTE: Prints the listing with the counters in front of every line that emitted executed bytes
+bool
+Profile_Annotate(Profile* profile, char* listing_path, char* model)
+{
+  FILE* file = fopen(listing_path, "rb");
+
+  if (file != 0)
+  {
+    char* line = malloc(PROFILE_LISTING_LINE_MAX);
+    ASSERT(line != 0);
+
+    u64 total = Profile__TotalClocks(profile);
+    printf("\nListing (%s): %s\n", model, listing_path);
+    printf("     Count     Clocks       %% | Source\n");
+
+    // NOTE: Lines longer than the buffer come in pieces, only the first piece is a line of the listing
+    bool line_start = true;
+    while (fgets(line, PROFILE_LISTING_LINE_MAX, file) != 0)
+    {
+      u64 length = strlen(line);
+      bool ended = (length != 0 && line[length - 1] == '\n');
+      if (ended) line[--length] = 0;
+      if (length != 0 && line[length - 1] == '\r') line[--length] = 0;
+
+      u32 offset, size;
+      u64 count = 0, clocks = 0;
+      bool has_code = (line_start && Profile__ParseListingLine(line, &offset, &size));
+      for (u32 i = 0; has_code && i < size && offset + i < profile->end - profile->start; ++i)
+      {
+        Profile_Site* site = &profile->sites[offset + i];
+        count  = MAX(count, site->count);
+        clocks += site->clocks;
+      }
+
+      if      (!line_start) printf("%s", line);
+      else if (count != 0)  printf("%10llu %10llu %6.2f%% | %s", (unsigned long long)count, (unsigned long long)clocks,
+                                   (total != 0 ? 100.0*(double)clocks/(double)total : 0.0), line);
+      else                  printf("%29s | %s", "", line);
+
+      if (ended) printf("\n");
+      line_start = ended;
+    }
+
+    if (!line_start) printf("\n");
+
+    free(line);
+    fclose(file);
+  }
+
+  return (file != 0);
+}
+
+void
+Profile_End(Profile* profile)
+{
+  free(profile->sites);
+  profile->sites = 0;
+}
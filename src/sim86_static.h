@@ -0,0 +1,170 @@
+// NOTE: Static block estimation
+//       Clocks of the image's basic blocks from the timing models alone, without running anything. The image is
+//       decoded in one linear pass from its start, like the disassembler does, so data in it decodes as instructions
+//       too. Blocks start at the entry point, at the targets of direct jumps, calls and loops, and behind every
+//       instruction that can branch. Targets behind the pass split the blocks when they are reported, which only
+//       walks the decoded instructions again. What depends on the run is a range: the low end has every transfer at
+//       an even address and no branch taken, the high end every transfer at an odd address, the branch at the end
+//       of the block taken, and mul and div at the top of their range. Rep strings and shifts by cl add their clocks
+//       per count on top, one term each. Where indirect jumps go and which blocks are ever reached isn't known here.
+
+#define STATIC_ENDS_BLOCK (1u << 31)
+
+typedef struct Static_Clocks
+{
+  u16 min;
+  u16 max;
+  u16 per_min; // NOTE: Per repetition of a rep string or bit shifted by cl, 0 when there is no count
+  u16 per_max;
+} Static_Clocks;
+
+typedef struct Static_Analysis
+{
+  u32 model_count;
+  u32 start;
+  u32 end;
+  u16 cs;
+  u8* leaders; // NOTE: One bit per byte of the image, set where a block has to start
+
+  u32* addresses;        // NOTE: Of every decoded instruction, or'ed with STATIC_ENDS_BLOCK when it can branch
+  Static_Clocks* clocks; // NOTE: model_count per instruction
+  u32 count;
+  u32 capacity;
+} Static_Analysis;
+
+Static_Clocks
+Static__Clocks(Instruction_Timing timing)
+{
+  // NOTE: mul and div have their count in the high end already
+  bool counted   = (timing.per_count != 0 && timing.range == 0);
+  uint per_words = (timing.word ? timing.count_transfers : 0);
+
+  return (Static_Clocks){
+    .min     = (u16)TotalClocks(InstructionClocks(timing, 0, false, 0)),
+    .max     = (u16)TotalClocks(InstructionClocks(timing, 1, true, timing.range)),
+    .per_min = (u16)(counted ? timing.per_count + per_words*timing.even_penalty : 0),
+    .per_max = (u16)(counted ? timing.per_count + per_words*timing.odd_penalty  : 0),
+  };
+}
+
+void
+Static__MarkLeader(Static_Analysis* analysis, u32 address)
+{
+  if (address >= analysis->start && address < analysis->end)
+  {
+    u32 offset = address - analysis->start;
+    analysis->leaders[offset/8] |= (u8)(1 << (offset%8));
+  }
+}
+
+bool
+Static__IsLeader(Static_Analysis* analysis, u32 address)
+{
+  u32 offset = address - analysis->start;
+  return ((analysis->leaders[offset/8] >> (offset%8)) & 1);
+}
+
+// NOTE: Decodes the image of the run, entry is the state it starts from
+bool
+Static_Analyze(Static_Analysis* analysis, Memory* memory, Run_Info* run, CPU_State* entry, Timing_Model** models, u32 model_count)
+{
+  *analysis = (Static_Analysis){
+    .model_count = model_count,
+    .start       = run->code_start,
+    .end         = run->code_end,
+    .cs          = GetRegister(entry, Register_CS),
+    .capacity    = 4096,
+  };
+
+  analysis->leaders   = calloc((run->code_end - run->code_start)/8 + 1, 1);
+  analysis->addresses = malloc(analysis->capacity*sizeof(u32));
+  analysis->clocks    = malloc(analysis->capacity*model_count*sizeof(Static_Clocks));
+
+  bool result = (analysis->leaders != 0 && analysis->addresses != 0 && analysis->clocks != 0);
+  if (result) Static__MarkLeader(analysis, InstructionAddress(entry));
+
+  for (u32 address = run->code_start; address < run->code_end && result;)
+  {
+    if (analysis->count == analysis->capacity)
+    {
+      analysis->capacity *= 2;
+      analysis->addresses = realloc(analysis->addresses, analysis->capacity*sizeof(u32));
+      analysis->clocks    = realloc(analysis->clocks, analysis->capacity*model_count*sizeof(Static_Clocks));
+      result              = (analysis->addresses != 0 && analysis->clocks != 0);
+      if (!result) break;
+    }
+
+    u32 cursor              = address;
+    Instruction instruction = DecodeInstruction(memory, &cursor);
+
+    u32 target;
+    u16 ip = (u16)(address - ((u32)analysis->cs << 4));
+    if (DirectBranchTarget(instruction, analysis->cs, ip, &target)) Static__MarkLeader(analysis, target);
+
+    Timing_Form form      = TimingFormOf(&instruction);
+    Static_Clocks* clocks = &analysis->clocks[analysis->count*model_count];
+    for (u32 i = 0; i < model_count; ++i) clocks[i] = Static__Clocks(Timing_Model_Lookup(models[i], form));
+
+    analysis->addresses[analysis->count++] = address | (EndsBasicBlock(instruction.kind) ? STATIC_ENDS_BLOCK : 0);
+
+    // NOTE: Not byte_size, a run of prefixes can be longer than it holds
+    address = cursor;
+  }
+
+  return result;
+}
+
+// NOTE: Prints a line per block, its ip range, instruction count and clocks in every model
+void
+Static_Report(Static_Analysis* analysis, char** model_names)
+{
+  u32 model_count = analysis->model_count;
+  u32 cs_base     = (u32)analysis->cs << 4;
+  u32 block_count = 0;
+
+  for (u32 first = 0, last; first < analysis->count; first = last)
+  {
+    last = first + 1;
+    while (last < analysis->count && !(analysis->addresses[last - 1] & STATIC_ENDS_BLOCK) &&
+           !Static__IsLeader(analysis, analysis->addresses[last] & ~STATIC_ENDS_BLOCK))
+    {
+      ++last;
+    }
+
+    u32 start = analysis->addresses[first] & ~STATIC_ENDS_BLOCK;
+    u32 end   = (last < analysis->count ? analysis->addresses[last] & ~STATIC_ENDS_BLOCK : analysis->end);
+    printf("0x%04x-0x%04x %5u instructions", (u16)(start - cs_base), (u16)(end - cs_base), last - first);
+
+    for (u32 i = 0; i < model_count; ++i)
+    {
+      u64 min = 0, max = 0;
+      for (u32 j = first; j < last; ++j) min += analysis->clocks[j*model_count + i].min, max += analysis->clocks[j*model_count + i].max;
+
+      printf(" ; ");
+      if (model_count > 1) printf("%s: ", model_names[i]);
+      if (min == max)      printf("%llu", (unsigned long long)min);
+      else                 printf("%llu-%llu", (unsigned long long)min, (unsigned long long)max);
+
+      for (u32 j = first; j < last; ++j)
+      {
+        Static_Clocks* clocks = &analysis->clocks[j*model_count + i];
+        if      (clocks->per_min == 0)               continue;
+        else if (clocks->per_min == clocks->per_max) printf(" + %un", clocks->per_min);
+        else                                         printf(" + %u-%un", clocks->per_min, clocks->per_max);
+      }
+    }
+
+    printf("\n");
+    block_count += 1;
+  }
+
+  printf("\nBlocks: %u\nInstructions: %u\n", block_count, analysis->count);
+}
+
+void
+Static_Free(Static_Analysis* analysis)
+{
+  free(analysis->leaders);
+  free(analysis->addresses);
+  free(analysis->clocks);
+}
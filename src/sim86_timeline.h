@@ -0,0 +1,247 @@
+// NOTE: Timeline export
+//       Writes the estimated run as Chrome trace events (JSON), which chrome://tracing and the Perfetto UI both load.
+//       Timestamps are the running clock total, shown as one microsecond per clock. Basic blocks are complete events
+//       on one track, call/ret and int/iret pairs are nested spans on another, chosen registers and the number of
+//       memory writes per window of clocks are counter tracks. Events are written as the run goes, nothing is held
+//       back but a few open spans.
+
+#define TIMELINE_DEFAULT_WINDOW 1000
+#define TIMELINE_EVENT_MAX      256
+
+#define TIMELINE_TRACK_BLOCKS 1
+#define TIMELINE_TRACK_CALLS  2
+
+typedef struct Timeline_Options
+{
+  char* path;
+  u32 counter_mask; // NOTE: Registers to chart, one bit per Register_Kind
+  u64 window;       // NOTE: Clocks per memory write rate sample
+} Timeline_Options;
+
+typedef struct Timeline
+{
+  FILE* file;
+  Writer writer;
+
+  u32 counter_mask;
+  u16 counter_values[REGISTER_COUNT];
+
+  bool in_block;
+  u32 block_ip;
+  u64 block_start;
+
+  u32 open_calls;
+
+  u64 window;
+  u64 window_start;
+  u64 window_writes;
+  u64 reported_writes;
+} Timeline;
+
+// NOTE: Writes an event named name_prefix followed by name_ip, up to its fields, for the caller to finish
+void
+Timeline__BeginEvent(Timeline* timeline, char* name_prefix, u32 name_ip, char* phase, u32 track, u64 timestamp)
+{
+  Writer* writer = &timeline->writer;
+  Writer_Reserve(writer, TIMELINE_EVENT_MAX);
+
+  Writer_String(writer, ",\n{\"name\":\"");
+  Writer_String(writer, name_prefix);
+  Writer_String(writer, "0x");
+  Writer_Hex(writer, name_ip, 4);
+  Writer_String(writer, "\",\"ph\":\"");
+  Writer_String(writer, phase);
+  Writer_String(writer, "\",\"pid\":1,\"tid\":");
+  Writer_Unsigned(writer, track);
+  Writer_String(writer, ",\"ts\":");
+  Writer_Unsigned(writer, timestamp);
+}
+
+void
+Timeline__Counter(Timeline* timeline, char* name, u64 timestamp, u64 value)
+{
+  Writer* writer = &timeline->writer;
+  Writer_Reserve(writer, TIMELINE_EVENT_MAX);
+
+  Writer_String(writer, ",\n{\"name\":\"");
+  Writer_String(writer, name);
+  Writer_String(writer, "\",\"ph\":\"C\",\"pid\":1,\"ts\":");
+  Writer_Unsigned(writer, timestamp);
+  Writer_String(writer, ",\"args\":{\"value\":");
+  Writer_Unsigned(writer, value);
+  Writer_String(writer, "}}");
+}
+
+void
+Timeline__EndCall(Timeline* timeline, u64 timestamp)
+{
+  Writer* writer = &timeline->writer;
+  Writer_Reserve(writer, TIMELINE_EVENT_MAX);
+
+  Writer_String(writer, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":");
+  Writer_Unsigned(writer, TIMELINE_TRACK_CALLS);
+  Writer_String(writer, ",\"ts\":");
+  Writer_Unsigned(writer, timestamp);
+  Writer_Char(writer, '}');
+
+  timeline->open_calls -= 1;
+}
+
+void
+Timeline__EndBlock(Timeline* timeline, u64 clocks)
+{
+  if (timeline->in_block)
+  {
+    Timeline__BeginEvent(timeline, "", timeline->block_ip, "X", TIMELINE_TRACK_BLOCKS, timeline->block_start);
+    Writer_String(&timeline->writer, ",\"dur\":");
+    Writer_Unsigned(&timeline->writer, clocks - timeline->block_start);
+    Writer_Char(&timeline->writer, '}');
+
+    timeline->in_block = false;
+  }
+}
+
+void
+Timeline__SampleWrites(Timeline* timeline, u64 clocks)
+{
+  while (clocks >= timeline->window_start + timeline->window)
+  {
+    if (timeline->window_writes != timeline->reported_writes)
+    {
+      Timeline__Counter(timeline, "memory writes", timeline->window_start, timeline->window_writes);
+      timeline->reported_writes = timeline->window_writes;
+    }
+
+    timeline->window_start += timeline->window;
+    timeline->window_writes = 0;
+  }
+}
+
+bool
+Timeline_Begin(Timeline* timeline, Timeline_Options* options, char* model, CPU_State* state, u64 clocks)
+{
+  *timeline = (Timeline){
+    .file         = fopen(options->path, "wb"),
+    .counter_mask = options->counter_mask,
+    .window       = (options->window != 0 ? options->window : TIMELINE_DEFAULT_WINDOW),
+    .window_start = clocks,
+  };
+
+  char* buffer = malloc(WRITER_DEFAULT_CAPACITY);
+
+  bool result = (timeline->file != 0 && buffer != 0);
+  if (!result)
+  {
+    if (timeline->file != 0) fclose(timeline->file);
+    free(buffer);
+  }
+  else
+  {
+    Writer* writer = &timeline->writer;
+    Writer_Init(writer, timeline->file, buffer, WRITER_DEFAULT_CAPACITY);
+
+    Writer_Reserve(writer, WRITER_LINE_MAX);
+    Writer_String(writer, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"model\":\"");
+    Writer_String(writer, model);
+    Writer_String(writer, "\",\"timestamps\":\"1 us = 1 clock\"},\"traceEvents\":[\n");
+    Writer_String(writer, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"sim86 ");
+    Writer_String(writer, model);
+    Writer_String(writer, "\"}},\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"basic blocks\"}},");
+    Writer_String(writer, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"calls\"}}");
+
+    for (u32 i = 0; i < REGISTER_COUNT; ++i)
+    {
+      timeline->counter_values[i] = state->register_file[i];
+      if (timeline->counter_mask & (1 << i)) Timeline__Counter(timeline, RegisterNames[i], clocks, state->register_file[i]);
+    }
+  }
+
+  return result;
+}
+
+// NOTE: start_clocks and end_clocks are the clock total before and after the instruction at ip, log holds the
+//       accesses it made and branch_taken is what ExecuteInstruction returned for it
+void
+Timeline_Step(Timeline* timeline, Instruction instruction, u32 ip, bool branch_taken, CPU_State* state, u64 start_clocks, u64 end_clocks, Memory_Access_Log* log)
+{
+  if (!timeline->in_block)
+  {
+    timeline->in_block    = true;
+    timeline->block_ip    = ip;
+    timeline->block_start = start_clocks;
+  }
+
+  Timeline__SampleWrites(timeline, start_clocks);
+  for (u32 i = 0; i < log->count; ++i) timeline->window_writes += log->accesses[i].is_write;
+
+  if (EndsBasicBlock(instruction.kind) || branch_taken) Timeline__EndBlock(timeline, end_clocks);
+
+  Instruction_Kind kind = instruction.kind;
+  if (kind == Instruction_Call || kind == Instruction_CallFar || kind == Instruction_Int || kind == Instruction_Int3 || kind == Instruction_Into)
+  {
+    // NOTE: Only the calls that were taken, into fails over to the next instruction when OF is clear
+    if (branch_taken)
+    {
+      Timeline__BeginEvent(timeline, (kind == Instruction_Call || kind == Instruction_CallFar ? "call " : "int "), state->ip, "B", TIMELINE_TRACK_CALLS, start_clocks);
+      Writer_Char(&timeline->writer, '}');
+      timeline->open_calls += 1;
+    }
+  }
+  else if ((kind == Instruction_Ret || kind == Instruction_RetF || kind == Instruction_Iret) && timeline->open_calls != 0)
+  {
+    Timeline__EndCall(timeline, end_clocks);
+  }
+
+  for (u32 i = 0; i < REGISTER_COUNT; ++i)
+  {
+    if ((timeline->counter_mask & (1 << i)) && state->register_file[i] != timeline->counter_values[i])
+    {
+      Timeline__Counter(timeline, RegisterNames[i], end_clocks, state->register_file[i]);
+      timeline->counter_values[i] = state->register_file[i];
+    }
+  }
+}
+
+// NOTE: Closes whatever is still open at clocks and finishes the file
+bool
+Timeline_End(Timeline* timeline, u64 clocks)
+{
+  Timeline__EndBlock(timeline, clocks);
+  Timeline__SampleWrites(timeline, clocks + timeline->window);
+
+  while (timeline->open_calls != 0) Timeline__EndCall(timeline, clocks);
+
+  Writer_Reserve(&timeline->writer, WRITER_LINE_MAX);
+  Writer_String(&timeline->writer, "\n]}\n");
+  Writer_Flush(&timeline->writer);
+  free(timeline->writer.buffer);
+
+  return (fclose(timeline->file) == 0);
+}
+
+// NOTE: Consumes argv[*i] (and its value) if it is a timeline option
+bool
+ParseTimelineOption(int argc, char** argv, int* i, Timeline_Options* options)
+{
+  bool result = true;
+
+  char* arg   = argv[*i];
+  char* value = (*i + 1 < argc ? argv[*i + 1] : 0);
+
+  if      (value == 0)                            result = false;
+  else if (strcmp(arg, "--timeline") == 0)        options->path = value, *i += 1;
+  else if (strcmp(arg, "--timeline-window") == 0) options->window = strtoull(value, 0, 0), *i += 1;
+  else if (strcmp(arg, "--timeline-counter") == 0)
+  {
+    result = false;
+    for (u32 reg = 0; reg < REGISTER_COUNT && !result; ++reg)
+    {
+      if (strcmp(RegisterNames[reg], value) == 0) options->counter_mask |= 1 << reg, result = true;
+    }
+
+    if (result) *i += 1;
+  }
+  else result = false;
+
+  return result;
+}
@@ -0,0 +1,458 @@
+// NOTE: Timing models
+//       A model is a text file, read at startup into a table with an entry per kind, shape and operand size of an
+//       instruction (see Timing_Form), so timing an instruction in any model is one lookup. The 8086 and 8088 are
+//       built in, other members of the family come from files like timing_v30.txt. A model file has one statement
+//       per line, # starts a comment:
+//
+//         model <name>             name shown in the output, the file name otherwise
+//         bus <8|16>               data bus width, a word takes two bus cycles on an 8 bit bus and at an odd address
+//         bus_cycle <clocks>       clocks per bus cycle, also what the second bus cycle of a word adds
+//         queue <bytes>            prefetch queue size, for --biu
+//         ea <class> <clocks>      effective address clocks, class is one of TimingEANames
+//         segment <clocks>         segment override, added to the ea clocks or the base when there are none
+//         lock <clocks>            lock prefix
+//         <kinds> <shapes> <clocks> [taken=<n>] [per=<n>] [range=<n>] [transfers=<n>] [count_transfers=<n>] [word]
+//
+//       The last one gives the base clocks of instruction kinds (mnemonics, e.g. add,sub or call far) in shapes
+//       (TimingShapeNames, with /8 or /16 for one operand size only). taken is added when a branch is taken, per for
+//       every repetition of a rep string or bit shifted by cl, range is the operand dependent part of mul and div.
+//       transfers are the memory transfers, count_transfers those per repetition, operand sized unless word is
+//       given. Forms a model leaves out take no clocks.
+
+#define TIMING_NAME_MAX     32
+#define TIMING_LINE_MAX     256
+#define TIMING_TOKEN_MAX    64
+#define TIMING_FILE_MAX     (1 << 20)
+
+typedef struct Timing_Model
+{
+  char name[TIMING_NAME_MAX];
+  u32 bus_width;
+  u32 bus_cycle;
+  u32 queue_size;
+  u8 ea[TIMING_EA_COUNT];
+  u8 segment;
+  u8 lock;
+  Instruction_Timing timings[TIMING_FORM_COUNT]; // NOTE: Without the ea and prefixes, see Timing_Model_Lookup
+} Timing_Model;
+
+char* TimingShapeNames[TIMING_SHAPE_COUNT] = {
+  [TimingShape_None]   = "none",
+  [TimingShape_Reg]    = "reg",
+  [TimingShape_RMReg]  = "rmreg",
+  [TimingShape_Mem]    = "mem",
+  [TimingShape_RegReg] = "regreg",
+  [TimingShape_RegMem] = "regmem",
+  [TimingShape_MemReg] = "memreg",
+  [TimingShape_RegImm] = "regimm",
+  [TimingShape_MemImm] = "memimm",
+  [TimingShape_AccImm] = "accimm",
+  [TimingShape_AccMem] = "accmem",
+  [TimingShape_SegReg] = "sreg",
+  [TimingShape_Imm]    = "imm",
+  [TimingShape_Near]   = "near",
+  [TimingShape_Far]    = "far",
+  [TimingShape_Rep]    = "rep",
+  [TimingShape_RegCL]  = "regcl",
+  [TimingShape_MemCL]  = "memcl",
+};
+
+char* TimingEANames[TIMING_EA_COUNT] = {
+  [TimingEA_None]          = "",
+  [TimingEA_Disp]          = "disp",
+  [TimingEA_Base]          = "base",
+  [TimingEA_Bp]            = "bp",
+  [TimingEA_BaseDisp]      = "base_disp",
+  [TimingEA_Index]         = "index",
+  [TimingEA_IndexSlow]     = "index_slow",
+  [TimingEA_IndexDisp]     = "index_disp",
+  [TimingEA_IndexDispSlow] = "index_disp_slow",
+};
+
+// NOTE: 8086 timing table, from the instruction set reference in the 8086 family user's manual. mul and div take
+//       the low end of their ranges. The 8088 runs the same table, only its word transfers cost more.
+#define TIMING_8086_FAMILY_TABLE \
+  "ea disp 6\n"                                                      \
+  "ea base 5\n"                                                      \
+  "ea bp 5\n"                                                        \
+  "ea base_disp 9\n"                                                 \
+  "ea index 7\n"                                                     \
+  "ea index_slow 8\n"                                                \
+  "ea index_disp 11\n"                                               \
+  "ea index_disp_slow 12\n"                                          \
+  "segment 2\n"                                                      \
+  "lock 2\n"                                                         \
+  "add,or,adc,sbb,and,sub,xor accimm,regimm 4\n"                     \
+  "add,or,adc,sbb,and,sub,xor memimm 17 transfers=2\n"               \
+  "add,or,adc,sbb,and,sub,xor regreg 3\n"                            \
+  "add,or,adc,sbb,and,sub,xor regmem 9 transfers=1\n"                \
+  "add,or,adc,sbb,and,sub,xor memreg 16 transfers=2\n"               \
+  "cmp accimm,regimm 4\n"                                            \
+  "cmp memimm 10 transfers=1\n"                                      \
+  "cmp regreg 3\n"                                                   \
+  "cmp regmem,memreg 9 transfers=1\n"                                \
+  "test accimm 4\n"                                                  \
+  "test regimm 5\n"                                                  \
+  "test memimm 11 transfers=1\n"                                     \
+  "test regreg 3\n"                                                  \
+  "test regmem,memreg 9 transfers=1\n"                               \
+  "mov regimm 4\n"                                                   \
+  "mov accmem,memimm 10 transfers=1\n"                               \
+  "mov regreg 2\n"                                                   \
+  "mov regmem 8 transfers=1\n"                                       \
+  "mov memreg 9 transfers=1\n"                                       \
+  "xchg reg 3\n"                                                     \
+  "xchg regreg 4\n"                                                  \
+  "xchg regmem,memreg 17 transfers=2\n"                              \
+  "lea mem 2\n"                                                      \
+  "les,lds mem 16 transfers=2 word\n"                                \
+  "inc,dec reg 2\n"                                                  \
+  "inc,dec rmreg 3\n"                                                \
+  "inc,dec mem 15 transfers=2\n"                                     \
+  "not,neg rmreg 3\n"                                                \
+  "not,neg mem 16 transfers=2\n"                                     \
+  "push reg,rmreg 11 transfers=1 word\n"                             \
+  "push mem 16 transfers=2 word\n"                                   \
+  "push sreg 10 transfers=1 word\n"                                  \
+  "pop reg,rmreg,sreg 8 transfers=1 word\n"                          \
+  "pop mem 17 transfers=2 word\n"                                    \
+  "pushf none 10 transfers=1 word\n"                                 \
+  "popf none 8 transfers=1 word\n"                                   \
+  "sahf,lahf,daa,das,aaa,aas none 4\n"                               \
+  "cbw none 2\n"                                                     \
+  "cwd none 5\n"                                                     \
+  "aam none 83\n"                                                    \
+  "aad none 60\n"                                                    \
+  "xlat none 11 transfers=1\n"                                       \
+  "rol,ror,rcl,rcr,shl,shr,sar rmreg 2\n"                            \
+  "rol,ror,rcl,rcr,shl,shr,sar mem 15 transfers=2\n"                 \
+  "rol,ror,rcl,rcr,shl,shr,sar regcl 8 per=4\n"                      \
+  "rol,ror,rcl,rcr,shl,shr,sar memcl 20 per=4 transfers=2\n"         \
+  "mul rmreg/8 70 range=7\n"                                         \
+  "mul rmreg/16 118 range=15\n"                                      \
+  "mul mem/8 76 range=7 transfers=1\n"                               \
+  "mul mem/16 124 range=15 transfers=1\n"                            \
+  "imul rmreg/8 80 range=18\n"                                       \
+  "imul rmreg/16 128 range=26\n"                                     \
+  "imul mem/8 86 range=18 transfers=1\n"                             \
+  "imul mem/16 134 range=26 transfers=1\n"                           \
+  "div rmreg/8 80 range=10\n"                                        \
+  "div rmreg/16 144 range=18\n"                                      \
+  "div mem/8 86 range=10 transfers=1\n"                              \
+  "div mem/16 150 range=18 transfers=1\n"                            \
+  "idiv rmreg/8 101 range=11\n"                                      \
+  "idiv rmreg/16 165 range=19\n"                                     \
+  "idiv mem/8 107 range=11 transfers=1\n"                            \
+  "idiv mem/16 171 range=19 transfers=1\n"                           \
+  "jo,jno,jb,jae,je,jne,jbe,ja,js,jns,jp,jnp,jl,jge,jle,jg near 4 taken=12\n" \
+  "jcxz,loopz near 6 taken=12\n"                                     \
+  "loop near 5 taken=12\n"                                           \
+  "loopnz near 5 taken=14\n"                                         \
+  "jmp near,far 15\n"                                                \
+  "jmp rmreg 11\n"                                                   \
+  "jmp mem 18 transfers=1 word\n"                                    \
+  "jmp far rmreg,mem 24 transfers=2 word\n"                          \
+  "call near 19 transfers=1 word\n"                                  \
+  "call far 28 transfers=2 word\n"                                   \
+  "call rmreg 16 transfers=1 word\n"                                 \
+  "call mem 21 transfers=2 word\n"                                   \
+  "call far rmreg,mem 37 transfers=4 word\n"                         \
+  "ret none 8 transfers=1 word\n"                                    \
+  "ret imm 12 transfers=1 word\n"                                    \
+  "retf none 18 transfers=2 word\n"                                  \
+  "retf imm 17 transfers=2 word\n"                                   \
+  "int imm 51 transfers=5 word\n"                                    \
+  "int3 none 52 transfers=5 word\n"                                  \
+  "into none 4 taken=49\n"                                           \
+  "iret none 24 transfers=3 word\n"                                  \
+  "in,out imm 10 transfers=1\n"                                      \
+  "in,out none 8 transfers=1\n"                                      \
+  "movs none 18 transfers=2\n"                                       \
+  "movs rep 9 per=17 count_transfers=2\n"                            \
+  "cmps none 22 transfers=2\n"                                       \
+  "cmps rep 9 per=22 count_transfers=2\n"                            \
+  "scas none 15 transfers=1\n"                                       \
+  "scas rep 9 per=15 count_transfers=1\n"                            \
+  "lods none 12 transfers=1\n"                                       \
+  "lods rep 9 per=13 count_transfers=1\n"                            \
+  "stos none 11 transfers=1\n"                                       \
+  "stos rep 9 per=10 count_transfers=1\n"                            \
+  "esc rmreg 2\n"                                                    \
+  "esc mem 8\n"                                                      \
+  "wait none 3\n"                                                    \
+  "hlt,cmc,clc,stc,cli,sti,cld,std none 2\n"
+
+char* TimingModel8086 = "model 8086\nbus 16\nbus_cycle 4\nqueue 6\n" TIMING_8086_FAMILY_TABLE;
+char* TimingModel8088 = "model 8088\nbus 8\nbus_cycle 4\nqueue 4\n"  TIMING_8086_FAMILY_TABLE;
+
+// NOTE: Reads the next whitespace separated token of the line, false at the end of the line or at a comment
+bool
+Timing__NextToken(char** cursor, char* token)
+{
+  char* c = *cursor;
+  while (*c == ' ' || *c == '\t' || *c == '\r') ++c;
+
+  u32 length = 0;
+  for (; *c != 0 && *c != ' ' && *c != '\t' && *c != '\r' && *c != '#'; ++c)
+  {
+    if (length + 1 < TIMING_TOKEN_MAX) token[length++] = *c;
+  }
+
+  token[length] = 0;
+  *cursor       = c;
+
+  return (length != 0);
+}
+
+// NOTE: Splits the next item off a comma separated list
+bool
+Timing__NextItem(char** list, char* item)
+{
+  char* c     = *list;
+  u32 length  = 0;
+  for (; *c != 0 && *c != ','; ++c)
+  {
+    if (length + 1 < TIMING_TOKEN_MAX) item[length++] = *c;
+  }
+
+  item[length] = 0;
+  *list        = (*c == ',' ? c + 1 : c);
+
+  return (length != 0);
+}
+
+bool
+Timing__Number(char* token, u32 max, u32* value)
+{
+  char* end;
+  unsigned long number = strtoul(token, &end, 0);
+
+  bool result = (end != token && *end == 0 && number <= max);
+  if (result) *value = (u32)number;
+
+  return result;
+}
+
+// NOTE: The rest of a line that starts with its kinds, the shapes, clocks and options
+bool
+Timing__ParseEntry(Timing_Model* model, char* kinds, char** cursor)
+{
+  char shapes[TIMING_TOKEN_MAX];
+  char token[TIMING_TOKEN_MAX];
+
+  bool ok = (Timing__NextToken(cursor, shapes) && Timing__NextToken(cursor, token));
+
+  // NOTE: call far and jmp far are kinds of their own, call far 28 is call in the far shape
+  bool far  = false;
+  u32 value = 0;
+  if (ok && strcmp(shapes, "far") == 0 && !Timing__Number(token, 255, &value))
+  {
+    far = true;
+    strcpy(shapes, token);
+    ok  = Timing__NextToken(cursor, token);
+  }
+
+  Instruction_Timing entry = {0};
+  ok         = (ok && Timing__Number(token, 255, &value));
+  entry.base = (u8)value;
+
+  while (ok && Timing__NextToken(cursor, token))
+  {
+    char* equals = strchr(token, '=');
+    if      (strcmp(token, "word") == 0)                           entry.word = true;
+    else if (equals == 0 || !Timing__Number(equals + 1, 255, &value)) ok = false;
+    else
+    {
+      *equals = 0;
+      if      (strcmp(token, "taken") == 0)           entry.taken           = (u8)value;
+      else if (strcmp(token, "per") == 0)             entry.per_count       = (u8)value;
+      else if (strcmp(token, "range") == 0)           entry.range           = (u8)value;
+      else if (strcmp(token, "transfers") == 0)       entry.transfers       = (u8)value;
+      else if (strcmp(token, "count_transfers") == 0) entry.count_transfers = (u8)value;
+      else                                            ok = false;
+    }
+  }
+
+  // NOTE: mul and div count their operand dependent clocks one by one, see OperandCount
+  if (entry.range != 0 && entry.per_count == 0) entry.per_count = 1;
+
+  char kind_name[TIMING_TOKEN_MAX + 4];
+  char item[TIMING_TOKEN_MAX];
+  for (char* list = kinds; ok && Timing__NextItem(&list, item);)
+  {
+    snprintf(kind_name, sizeof(kind_name), "%s%s", item, (far ? " far" : ""));
+
+    u32 kind = 0;
+    while (kind < INSTRUCTION_COUNT && (InstructionNames[kind] == 0 || strcmp(InstructionNames[kind], kind_name) != 0)) ++kind;
+    ok = (kind < INSTRUCTION_COUNT);
+
+    for (char* shape_list = shapes; ok && Timing__NextItem(&shape_list, item);)
+    {
+      // NOTE: Both operand sizes unless one is given
+      u32 first_w = 0, last_w = 1;
+      char* slash = strchr(item, '/');
+      if (slash != 0)
+      {
+        if      (strcmp(slash, "/8") == 0)  last_w  = 0;
+        else if (strcmp(slash, "/16") == 0) first_w = 1;
+        else                                ok      = false;
+
+        *slash = 0;
+      }
+
+      u32 shape = 0;
+      while (shape < TIMING_SHAPE_COUNT && strcmp(TimingShapeNames[shape], item) != 0) ++shape;
+      ok = (ok && shape < TIMING_SHAPE_COUNT);
+
+      for (u32 w = first_w; w <= last_w && ok; ++w) model->timings[(kind*TIMING_SHAPE_COUNT + shape)*2 + w] = entry;
+    }
+  }
+
+  return ok;
+}
+
+// NOTE: Returns 0, or the number of the first line that is wrong
+u32
+Timing_Model_Parse(Timing_Model* model, char* text)
+{
+  *model = (Timing_Model){ .bus_width = 16, .bus_cycle = 4, .queue_size = 6 };
+
+  u32 error_line  = 0;
+  u32 line_number = 0;
+  for (char* cursor = text; *cursor != 0 && error_line == 0;)
+  {
+    line_number += 1;
+
+    char line[TIMING_LINE_MAX];
+    u32 length = 0;
+    for (; *cursor != 0 && *cursor != '\n'; ++cursor)
+    {
+      if (length + 1 < TIMING_LINE_MAX) line[length++] = *cursor;
+    }
+
+    if (*cursor == '\n') ++cursor;
+    line[length] = 0;
+
+    char* c = line;
+    char key[TIMING_TOKEN_MAX];
+    char token[TIMING_TOKEN_MAX];
+    u32 value = 0;
+
+    bool ok = true;
+    if (Timing__NextToken(&c, key))
+    {
+      if (strcmp(key, "model") == 0)
+      {
+        ok = (Timing__NextToken(&c, token) && strlen(token) < TIMING_NAME_MAX);
+        if (ok) strcpy(model->name, token);
+      }
+      else if (strcmp(key, "bus") == 0)
+      {
+        ok = (Timing__NextToken(&c, token) && Timing__Number(token, 16, &value) && (value == 8 || value == 16));
+        model->bus_width = value;
+      }
+      else if (strcmp(key, "bus_cycle") == 0)
+      {
+        ok = (Timing__NextToken(&c, token) && Timing__Number(token, 255, &value) && value != 0);
+        model->bus_cycle = value;
+      }
+      else if (strcmp(key, "queue") == 0)
+      {
+        ok = (Timing__NextToken(&c, token) && Timing__Number(token, 255, &value) && value >= 2);
+        model->queue_size = value;
+      }
+      else if (strcmp(key, "ea") == 0)
+      {
+        u32 ea = 1;
+        ok = Timing__NextToken(&c, token);
+        while (ok && ea < TIMING_EA_COUNT && strcmp(TimingEANames[ea], token) != 0) ++ea;
+
+        ok = (ok && ea < TIMING_EA_COUNT && Timing__NextToken(&c, token) && Timing__Number(token, 255, &value));
+        if (ok) model->ea[ea] = (u8)value;
+      }
+      else if (strcmp(key, "segment") == 0)
+      {
+        ok = (Timing__NextToken(&c, token) && Timing__Number(token, 255, &value));
+        model->segment = (u8)value;
+      }
+      else if (strcmp(key, "lock") == 0)
+      {
+        ok = (Timing__NextToken(&c, token) && Timing__Number(token, 255, &value));
+        model->lock = (u8)value;
+      }
+      else ok = Timing__ParseEntry(model, key, &c);
+
+      ok = (ok && !Timing__NextToken(&c, token));
+    }
+
+    if (!ok) error_line = line_number;
+  }
+
+  // NOTE: What every form of the model shares. A divide error raises the interrupt as int takes it, with its word
+  //       transfers at the even addresses of the vector and a word aligned stack.
+  Instruction_Timing interrupt = model->timings[(Instruction_Int*TIMING_SHAPE_COUNT + TimingShape_Imm)*2];
+  u8 even_penalty              = (u8)(model->bus_width == 8 ? model->bus_cycle : 0);
+  u8 fault                     = (u8)(interrupt.base + interrupt.transfers*even_penalty);
+  for (u32 i = 0; i < TIMING_FORM_COUNT; ++i)
+  {
+    Instruction_Timing* timing = &model->timings[i];
+    timing->fault              = fault;
+    timing->even_penalty       = even_penalty;
+    timing->odd_penalty        = (u8)model->bus_cycle;
+    timing->word               = (timing->word || i%2 != 0);
+  }
+
+  return error_line;
+}
+
+// NOTE: name is 8086, 8088 or the path of a model file. error_line is set when the file is there but wrong.
+bool
+Timing_Model_Load(Timing_Model* model, char* name, u32* error_line)
+{
+  char* text     = 0;
+  bool allocated = false;
+
+  if      (strcmp(name, "8086") == 0) text = TimingModel8086;
+  else if (strcmp(name, "8088") == 0) text = TimingModel8088;
+  else
+  {
+    Platform_File file;
+    if (Platform_OpenFileForReading(name, &file))
+    {
+      u64 size;
+      if (Platform_GetFileSize(file, &size) && size < TIMING_FILE_MAX)
+      {
+        text = malloc(size + 1);
+        if (text != 0 && Platform_ReadAt(file, 0, text, size)) text[size] = 0, allocated = true;
+        else                                                   free(text), text = 0;
+      }
+
+      Platform_CloseFile(file);
+    }
+  }
+
+  *error_line = (text != 0 ? Timing_Model_Parse(model, text) : 0);
+  if (text != 0 && *error_line == 0 && model->name[0] == 0) snprintf(model->name, sizeof(model->name), "%s", name);
+
+  if (allocated) free(text);
+
+  return (text != 0 && *error_line == 0);
+}
+
+// NOTE: The timing of an instruction of the form in the model
+Instruction_Timing
+Timing_Model_Lookup(Timing_Model* model, Timing_Form form)
+{
+  Instruction_Timing timing = model->timings[form.index];
+
+  if (form.ea != TimingEA_None)
+  {
+    timing.ea     = model->ea[form.ea] + (form.seg ? model->segment : 0);
+    timing.has_ea = true;
+  }
+  else if (form.seg) timing.base += model->segment;
+
+  if (form.lock) timing.base += model->lock;
+
+  return timing;
+}
@@ -0,0 +1,746 @@
+// NOTE: Traces
+//       The text trace is what execute and estimate print per step. The binary trace holds the same information in
+//       a fraction of the space, and render turns it back into the exact text.
+//
+//       Binary trace layout
+//       [Trace_Header][record][record]...
+//       A record starts with a tag byte. Its low 3 bits hold the instruction length, 0 meaning a length byte follows,
+//       and then come the raw instruction bytes. The remaining tag bits say which of these follow, in order:
+//         TraceTag_Jump      zigzag varint, ip after the instruction minus the ip right behind it
+//         TraceTag_Registers varint mask of the registers that changed, then each new value as u16
+//         TraceTag_Flags     u16 new flags
+//         (estimate only)    varint base clocks
+//         TraceTag_EA        varint ea clocks
+//         TraceTag_Penalty   varint penalty clocks, varint fetch clocks, varint wait clocks
+//       Old values are never stored, a reader reconstructs them from the header and the records before.
+//
+//       Loops
+//       Every step has a signature: its ip, bytes, jump and clocks (its shape), how much each register moved and the
+//       flags it set. A step with the same shape as the step period steps back continues a repeat record instead of
+//       getting a record of its own:
+//         tag 0, length byte 0, varint period, varint count, varint patch count, patches
+//       Each of the count steps is replayed from the signature period steps back, so registers move by the same
+//       amount and the same flags get set. A patch corrects a step the replay gets wrong:
+//         varint steps skipped since the previous patch, varint mask, varint per set bit
+//       with bits 0 to REGISTER_COUNT-1 standing for registers and bit REGISTER_COUNT for the flags. The varints are
+//       the actual value xor the replayed one, which keeps near misses like a flipped parity bit to a byte. A loop
+//       costs its body once plus a few bytes per iteration for whatever the replay can't predict.
+
+#ifndef DISPLAY_IP
+#define DISPLAY_IP 1
+#endif
+
+#define TRACE_MAGIC   0x54363853 // "S86T"
+#define TRACE_VERSION 4
+
+#define ESTIMATE_MODEL_MAX  4
+#define ESTIMATE_CLOCKS_MAX 96 // NOTE: Text of one model's clocks in a trace line
+
+#define TRACE_INSTRUCTION_MAX 255 // NOTE: Longest instruction a record holds, its length is a byte
+#define TRACE_RECORD_MAX      (TRACE_INSTRUCTION_MAX + 128)
+#define TRACE_HISTORY_SIZE    1024 // NOTE: Longest loop that can be folded is one step shorter
+#define TRACE_IP_TABLE_SIZE   4096
+#define TRACE_PATCH_MAX       (5 + 3 + 3*(REGISTER_COUNT + 1))
+#define TRACE_PATCH_CAPACITY  384
+
+typedef enum Trace_Kind
+{
+  TraceKind_Execute = 0,
+  TraceKind_Estimate,
+} Trace_Kind;
+
+typedef enum Trace_Tag
+{
+  TraceTag_LengthMask = 0x07,
+  TraceTag_Jump       = (1 << 3),
+  TraceTag_Registers  = (1 << 4),
+  TraceTag_Flags      = (1 << 5),
+  TraceTag_EA         = (1 << 6),
+  TraceTag_Penalty    = (1 << 7),
+} Trace_Tag;
+
+typedef struct Trace_Header
+{
+  u32 magic;
+  u32 version;
+  u32 kind;
+
+  u16 register_file[REGISTER_COUNT];
+  u16 flags;
+  u32 ip;
+
+  u64 instruction_count;
+  u64 clocks;
+} Trace_Header;
+
+typedef struct Trace_Signature
+{
+  u32 ip;
+  u32 length;
+  u8 bytes[TRACE_INSTRUCTION_MAX];
+  i32 jump;
+  Clocks clocks;
+
+  u16 register_deltas[REGISTER_COUNT];
+  u16 flags;
+  bool sets_flags;
+} Trace_Signature;
+
+typedef struct Trace_Encoder
+{
+  Writer writer;
+  Trace_Kind kind;
+
+  // NOTE: State as of the last record, to find what changed without a copy of the previous CPU_State
+  u16 register_file[REGISTER_COUNT];
+  u16 flags;
+
+  u64 step_count;
+  Trace_Signature history[TRACE_HISTORY_SIZE];
+  u64 ip_table[TRACE_IP_TABLE_SIZE]; // NOTE: Index + 1 of the last step at an ip, 0 when there is none
+
+  // NOTE: The repeat record being built, there is none while run_count is 0
+  u32 run_period;
+  u64 run_count;
+  u64 run_next_patch;
+  u32 patch_count;
+  u32 patch_size;
+  u8 patches[TRACE_PATCH_CAPACITY];
+} Trace_Encoder;
+
+typedef struct Trace_Step
+{
+  u8 bytes[TRACE_INSTRUCTION_MAX];
+  u32 length;
+  u32 ip;
+  Clocks clocks;
+} Trace_Step;
+
+typedef struct Trace_Reader
+{
+  u8* data;
+  u64 size;
+  u64 at;
+
+  Trace_Header header;
+
+  u64 step_count;
+  Trace_Signature history[TRACE_HISTORY_SIZE];
+
+  // NOTE: The repeat record being replayed
+  u32 run_period;
+  u64 run_remaining;
+  u32 patches_remaining;
+  u64 steps_to_patch;
+} Trace_Reader;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Text
+
+void
+PrintRegisters(CPU_State* cpu_state)
+{
+  Register_Kind print_registers[12] = {
+    Register_AX,
+    Register_BX,
+    Register_CX,
+    Register_DX,
+    Register_SP,
+    Register_BP,
+    Register_SI,
+    Register_DI,
+
+    Register_CS,
+    Register_ES,
+    Register_SS,
+    Register_DS,
+  };
+  for (uint i = 0; i < sizeof(print_registers)/sizeof(0[print_registers]); ++i)
+  {
+    Register_Kind reg_kind = print_registers[i];
+    if (cpu_state->register_file[reg_kind] != 0)
+    {
+      printf("      %s: 0x%04x (%u)\n", RegisterNames[reg_kind], cpu_state->register_file[reg_kind], cpu_state->register_file[reg_kind]);
+    }
+  }
+
+#if DISPLAY_IP
+  printf("      ip: 0x%04x (%u)\n", cpu_state->ip, cpu_state->ip);
+#endif
+
+  if (cpu_state->flags != 0)
+  {
+    printf("   flags: ");
+
+    for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(cpu_state, i)) printf("%c", FlagNames[i]);
+
+    printf("\n");
+  }
+}
+
+void
+WriteRegisterChanges(Writer* writer, CPU_State* prev_state, CPU_State* cpu_state)
+{
+  for (Register_Kind i = Register_AX; i < REGISTER_COUNT; ++i)
+  {
+    u16 old = prev_state->register_file[i];
+    u16 new = cpu_state->register_file[i];
+
+    if (old == new) continue;
+    else
+    {
+      Writer_String(writer, RegisterNames[i]);
+      Writer_String(writer, ":0x");
+      Writer_Hex(writer, old, 0);
+      Writer_String(writer, "->0x");
+      Writer_Hex(writer, new, 0);
+      Writer_Char(writer, ' ');
+    }
+  }
+}
+
+void
+WriteFlagChanges(Writer* writer, CPU_State* prev_state, CPU_State* cpu_state)
+{
+  if (prev_state->flags != cpu_state->flags)
+  {
+    Writer_String(writer, "flags:");
+    for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(prev_state, i)) Writer_Char(writer, FlagNames[i]);
+    Writer_String(writer, "->");
+    for (uint i = 0; i < FLAG_COUNT; ++i) if (GetFlag(cpu_state, i)) Writer_Char(writer, FlagNames[i]);
+    Writer_Char(writer, ' ');
+  }
+}
+
+// NOTE: One line of execute's trace
+void
+WriteExecuteStep(Writer* writer, Instruction instruction, CPU_State* prev_state, CPU_State* cpu_state)
+{
+  Writer_Reserve(writer, WRITER_LINE_MAX);
+  WriteInstruction(writer, instruction, prev_state->ip);
+
+  bool has_changes = (DISPLAY_IP || prev_state->flags != cpu_state->flags);
+  for (Register_Kind i = Register_AX; i < REGISTER_COUNT && !has_changes; ++i)
+  {
+    has_changes = (prev_state->register_file[i] != cpu_state->register_file[i]);
+  }
+
+  if (has_changes) Writer_String(writer, " ; ");
+
+  WriteRegisterChanges(writer, prev_state, cpu_state);
+
+#if DISPLAY_IP
+  Writer_String(writer, "ip:0x");
+  Writer_Hex(writer, prev_state->ip, 0);
+  Writer_String(writer, "->0x");
+  Writer_Hex(writer, cpu_state->ip, 0);
+  Writer_Char(writer, ' ');
+#endif
+
+  WriteFlagChanges(writer, prev_state, cpu_state);
+
+  Writer_Char(writer, '\n');
+}
+
+// NOTE: One line of estimate's trace, with the clocks of each of model_count models. total_clocks include this
+//       step. A single model is printed as "Clocks", several by the names in model_names.
+void
+WriteEstimateStep(Writer* writer, Instruction instruction, u32 model_count, char** model_names, Clocks* steps, u64* total_clocks, CPU_State* prev_state, CPU_State* cpu_state)
+{
+  Writer_Reserve(writer, WRITER_LINE_MAX);
+  WriteInstruction(writer, instruction, prev_state->ip);
+
+  for (u32 i = 0; i < model_count; ++i)
+  {
+    Clocks step = steps[i];
+
+    Writer_Reserve(writer, ESTIMATE_CLOCKS_MAX);
+    Writer_String(writer, (i == 0 ? " ; " : "; "));
+    Writer_String(writer, (model_count == 1 ? "Clocks" : model_names[i]));
+    Writer_String(writer, ": +");
+    Writer_Unsigned(writer, TotalClocks(step));
+    Writer_String(writer, " = ");
+    Writer_Unsigned(writer, total_clocks[i]);
+    Writer_Char(writer, ' ');
+
+    if (step.has_ea || step.fetch || step.wait)
+    {
+      Writer_Char(writer, '(');
+      Writer_Unsigned(writer, step.base);
+      if (step.has_ea)  Writer_String(writer, " + "), Writer_Unsigned(writer, step.ea), Writer_String(writer, "ea");
+      if (step.penalty) Writer_String(writer, " + "), Writer_Unsigned(writer, step.penalty), Writer_Char(writer, 'p');
+      if (step.fetch)   Writer_String(writer, " + "), Writer_Unsigned(writer, step.fetch), Writer_Char(writer, 'f');
+      if (step.wait)    Writer_String(writer, " + "), Writer_Unsigned(writer, step.wait), Writer_Char(writer, 'w');
+      Writer_String(writer, ") ");
+    }
+  }
+
+  Writer_Reserve(writer, WRITER_LINE_MAX);
+  Writer_String(writer, "| ");
+
+  WriteRegisterChanges(writer, prev_state, cpu_state);
+
+  Writer_String(writer, "ip:0x");
+  Writer_Hex(writer, prev_state->ip, 0);
+  Writer_String(writer, "->0x");
+  Writer_Hex(writer, cpu_state->ip, 0);
+  Writer_Char(writer, ' ');
+
+  WriteFlagChanges(writer, prev_state, cpu_state);
+
+  Writer_Char(writer, '\n');
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Binary
+
+void
+Trace__PutVarint(Writer* writer, u64 value)
+{
+  while (value >= 0x80)
+  {
+    *writer->at++ = (char)(value | 0x80);
+    value >>= 7;
+  }
+
+  *writer->at++ = (char)value;
+}
+
+void
+Trace__PutU16(Writer* writer, u16 value)
+{
+  *writer->at++ = (char)(value & 0xFF);
+  *writer->at++ = (char)(value >> 8);
+}
+
+Trace_Signature
+Trace__Sign(u16* old_registers, u16 old_flags, CPU_State* state, u8* bytes, u32 length, u32 ip, Clocks clocks)
+{
+  Trace_Signature signature = {
+    .ip         = ip,
+    .length     = length,
+    .jump       = (i32)(state->ip - (ip + length)),
+    .clocks     = clocks,
+    .flags      = state->flags,
+    .sets_flags = (state->flags != old_flags),
+  };
+
+  memcpy(signature.bytes, bytes, length);
+  for (u32 i = 0; i < REGISTER_COUNT; ++i) signature.register_deltas[i] = state->register_file[i] - old_registers[i];
+
+  return signature;
+}
+
+bool
+Trace__SameShape(Trace_Signature* a, Trace_Signature* b)
+{
+  return (a->ip == b->ip && a->length == b->length && a->jump == b->jump && memcmp(a->bytes, b->bytes, a->length) == 0 &&
+          a->clocks.base == b->clocks.base && a->clocks.ea == b->clocks.ea && a->clocks.penalty == b->clocks.penalty &&
+          a->clocks.fetch == b->clocks.fetch && a->clocks.wait == b->clocks.wait && a->clocks.has_ea == b->clocks.has_ea);
+}
+
+void
+Trace__EndRun(Trace_Encoder* encoder)
+{
+  if (encoder->run_count != 0)
+  {
+    Writer* writer = &encoder->writer;
+    Writer_Reserve(writer, WRITER_LINE_MAX);
+
+    *writer->at++ = 0;
+    *writer->at++ = 0;
+    Trace__PutVarint(writer, encoder->run_period);
+    Trace__PutVarint(writer, encoder->run_count);
+    Trace__PutVarint(writer, encoder->patch_count);
+
+    memcpy(writer->at, encoder->patches, encoder->patch_size);
+    writer->at += encoder->patch_size;
+
+    encoder->run_count      = 0;
+    encoder->run_next_patch = 0;
+    encoder->patch_count    = 0;
+    encoder->patch_size     = 0;
+  }
+}
+
+// NOTE: Adds the current step to the repeat record, patching whatever replaying body gets wrong
+void
+Trace__ExtendRun(Trace_Encoder* encoder, Trace_Signature* body, CPU_State* state)
+{
+  u16 misses[REGISTER_COUNT + 1];
+  for (u32 i = 0; i < REGISTER_COUNT; ++i) misses[i] = (u16)(encoder->register_file[i] + body->register_deltas[i]) ^ state->register_file[i];
+  misses[REGISTER_COUNT] = (body->sets_flags ? body->flags : encoder->flags) ^ state->flags;
+
+  u32 mask = 0;
+  for (u32 i = 0; i < REGISTER_COUNT + 1; ++i) if (misses[i] != 0) mask |= 1 << i;
+
+  if (mask != 0)
+  {
+    if (encoder->patch_size + TRACE_PATCH_MAX > TRACE_PATCH_CAPACITY) Trace__EndRun(encoder);
+
+    // NOTE: Writes to the patch buffer through a writer of its own, it is big enough by the check above
+    Writer patch = { .at = (char*)encoder->patches + encoder->patch_size };
+    Trace__PutVarint(&patch, encoder->run_count - encoder->run_next_patch);
+    Trace__PutVarint(&patch, mask);
+    for (u32 i = 0; i < REGISTER_COUNT + 1; ++i) if (mask & (1 << i)) Trace__PutVarint(&patch, misses[i]);
+
+    encoder->patch_size     = (u32)((u8*)patch.at - encoder->patches);
+    encoder->patch_count   += 1;
+    encoder->run_next_patch = encoder->run_count + 1;
+  }
+
+  encoder->run_count += 1;
+}
+
+void
+Trace__PutLiteral(Trace_Encoder* encoder, Trace_Signature* signature, CPU_State* state)
+{
+  Writer* writer = &encoder->writer;
+  Writer_Reserve(writer, TRACE_RECORD_MAX);
+
+  u32 register_mask = 0;
+  for (u32 i = 0; i < REGISTER_COUNT; ++i)
+  {
+    if (signature->register_deltas[i] != 0) register_mask |= 1 << i;
+  }
+
+  u32 length = signature->length;
+  u8 tag     = (length <= TraceTag_LengthMask ? (u8)length : 0);
+  if (signature->jump != 0)  tag |= TraceTag_Jump;
+  if (register_mask != 0)    tag |= TraceTag_Registers;
+  if (signature->sets_flags) tag |= TraceTag_Flags;
+  if (encoder->kind == TraceKind_Estimate)
+  {
+    if (signature->clocks.has_ea)       tag |= TraceTag_EA;
+    if (signature->clocks.penalty != 0 || signature->clocks.fetch != 0 || signature->clocks.wait != 0) tag |= TraceTag_Penalty;
+  }
+
+  *writer->at++ = (char)tag;
+  if ((tag & TraceTag_LengthMask) == 0) *writer->at++ = (char)length;
+  for (u32 i = 0; i < length; ++i) *writer->at++ = (char)signature->bytes[i];
+
+  if (tag & TraceTag_Jump)
+  {
+    i64 delta = signature->jump;
+    Trace__PutVarint(writer, (u64)((delta << 1) ^ (delta >> 63)));
+  }
+
+  if (tag & TraceTag_Registers)
+  {
+    Trace__PutVarint(writer, register_mask);
+    for (u32 i = 0; i < REGISTER_COUNT; ++i)
+    {
+      if (register_mask & (1 << i)) Trace__PutU16(writer, state->register_file[i]);
+    }
+  }
+
+  if (tag & TraceTag_Flags) Trace__PutU16(writer, state->flags);
+
+  if (encoder->kind == TraceKind_Estimate)
+  {
+    Trace__PutVarint(writer, signature->clocks.base);
+    if (tag & TraceTag_EA)      Trace__PutVarint(writer, signature->clocks.ea);
+    if (tag & TraceTag_Penalty)
+    {
+      Trace__PutVarint(writer, signature->clocks.penalty);
+      Trace__PutVarint(writer, signature->clocks.fetch);
+      Trace__PutVarint(writer, signature->clocks.wait);
+    }
+  }
+}
+
+// NOTE: The encoder is large, keep it off the stack
+void
+Trace_BeginEncoding(Trace_Encoder* encoder, FILE* file, char* buffer, u32 capacity, Trace_Kind kind, CPU_State* state, Run_Info* run)
+{
+  memset(encoder, 0, sizeof(*encoder));
+  encoder->kind  = kind;
+  encoder->flags = state->flags;
+  memcpy(encoder->register_file, state->register_file, sizeof(encoder->register_file));
+
+  Writer_Init(&encoder->writer, file, buffer, capacity);
+
+  Trace_Header header = {
+    .magic             = TRACE_MAGIC,
+    .version           = TRACE_VERSION,
+    .kind              = kind,
+    .flags             = state->flags,
+    .ip                = state->ip,
+    .instruction_count = run->instruction_count,
+    .clocks            = run->clocks,
+  };
+  memcpy(header.register_file, state->register_file, sizeof(header.register_file));
+
+  Writer_Reserve(&encoder->writer, sizeof(header));
+  memcpy(encoder->writer.at, &header, sizeof(header));
+  encoder->writer.at += sizeof(header);
+}
+
+// NOTE: Copies the bytes of the instruction at address into bytes, which holds TRACE_INSTRUCTION_MAX, a byte at a time
+//       so one running off the end of memory wraps around to its start as it did when it was decoded
+void
+Trace_CopyInstruction(Memory* memory, u32 address, u32 length, u8* bytes)
+{
+  for (u32 i = 0; i < MIN(length, TRACE_INSTRUCTION_MAX); ++i) bytes[i] = memory->mem[(address + i) & MEMORY_MASK];
+}
+
+// NOTE: bytes are the instruction as it was fetched, fallthrough_ip the ip right behind it. clocks is only used by
+//       estimate traces. Returns false, writing nothing, for an instruction longer than TRACE_INSTRUCTION_MAX, which
+//       only a run of redundant prefixes makes.
+bool
+Trace_EncodeStep(Trace_Encoder* encoder, u8* bytes, u32 length, u32 fallthrough_ip, CPU_State* state, Clocks clocks)
+{
+  bool result = (length <= TRACE_INSTRUCTION_MAX);
+  if (result)
+  {
+    if (encoder->kind != TraceKind_Estimate) clocks = (Clocks){0};
+
+    // NOTE: Periods stay below TRACE_HISTORY_SIZE, so the slot of this step is never the one of its body
+    u64 index = encoder->step_count;
+    Trace_Signature* signature = &encoder->history[index % TRACE_HISTORY_SIZE];
+    *signature = Trace__Sign(encoder->register_file, encoder->flags, state, bytes, length, fallthrough_ip - length, clocks);
+
+    // NOTE: Keep the current repeat going, or start one against the last step at the same ip
+    Trace_Signature* body = 0;
+    if (encoder->run_count != 0)
+    {
+      body = &encoder->history[(index - encoder->run_period) % TRACE_HISTORY_SIZE];
+      if (!Trace__SameShape(signature, body))
+      {
+        Trace__EndRun(encoder);
+        body = 0;
+      }
+    }
+
+    u64* last = &encoder->ip_table[signature->ip % TRACE_IP_TABLE_SIZE];
+    if (body == 0 && *last != 0 && index - (*last - 1) < TRACE_HISTORY_SIZE)
+    {
+      body = &encoder->history[(*last - 1) % TRACE_HISTORY_SIZE];
+      if (Trace__SameShape(signature, body)) encoder->run_period = (u32)(index - (*last - 1));
+      else                                   body = 0;
+    }
+
+    if (body != 0) Trace__ExtendRun(encoder, body, state);
+    else           Trace__PutLiteral(encoder, signature, state);
+
+    memcpy(encoder->register_file, state->register_file, sizeof(encoder->register_file));
+    encoder->flags = state->flags;
+
+    *last                = index + 1;
+    encoder->step_count += 1;
+  }
+
+  return result;
+}
+
+void
+Trace_EndEncoding(Trace_Encoder* encoder)
+{
+  Trace__EndRun(encoder);
+  Writer_Flush(&encoder->writer);
+}
+
+// NOTE: The reader is large, keep it off the stack. Release it with Trace_CloseReader.
+bool
+Trace_OpenReader(Trace_Reader* reader, char* path)
+{
+  bool result = false;
+  memset(reader, 0, sizeof(*reader));
+
+  Platform_File file;
+  if (Platform_OpenFileForReading(path, &file))
+  {
+    if (Platform_GetFileSize(file, &reader->size) && reader->size >= sizeof(Trace_Header))
+    {
+      reader->data = malloc(reader->size);
+      if (reader->data != 0 && Platform_ReadAt(file, 0, reader->data, reader->size))
+      {
+        memcpy(&reader->header, reader->data, sizeof(Trace_Header));
+        reader->at = sizeof(Trace_Header);
+
+        result = (reader->header.magic == TRACE_MAGIC && reader->header.version == TRACE_VERSION);
+      }
+    }
+
+    Platform_CloseFile(file);
+  }
+
+  return result;
+}
+
+void
+Trace_CloseReader(Trace_Reader* reader)
+{
+  free(reader->data);
+  reader->data = 0;
+}
+
+// NOTE: Sets state to the state as of the start of the trace
+void
+Trace_InitialState(Trace_Reader* reader, CPU_State* state)
+{
+  state->flags = reader->header.flags;
+  state->ip    = reader->header.ip;
+  memcpy(state->register_file, reader->header.register_file, sizeof(state->register_file));
+}
+
+bool
+Trace__GetVarint(Trace_Reader* reader, u64* value)
+{
+  *value = 0;
+
+  for (u32 shift = 0; reader->at < reader->size && shift < 64; shift += 7)
+  {
+    u8 byte = reader->data[reader->at++];
+    *value |= (u64)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+
+  return false;
+}
+
+bool
+Trace__GetU16(Trace_Reader* reader, u16* value)
+{
+  bool result = (reader->size - reader->at >= 2);
+  if (result)
+  {
+    *value = (u16)(reader->data[reader->at] | (reader->data[reader->at + 1] << 8));
+    reader->at += 2;
+  }
+
+  return result;
+}
+
+bool
+Trace__BeginRun(Trace_Reader* reader)
+{
+  u64 period, count, patch_count, gap = 0;
+
+  reader->at += 2;
+  bool result = (Trace__GetVarint(reader, &period) && Trace__GetVarint(reader, &count) && Trace__GetVarint(reader, &patch_count));
+  if (result && patch_count != 0) result = Trace__GetVarint(reader, &gap);
+
+  result = (result && period != 0 && period < TRACE_HISTORY_SIZE && period <= reader->step_count && count != 0);
+  if (result)
+  {
+    reader->run_period        = (u32)period;
+    reader->run_remaining     = count;
+    reader->patches_remaining = (u32)patch_count;
+    reader->steps_to_patch    = gap;
+  }
+
+  return result;
+}
+
+bool
+Trace__ReplayStep(Trace_Reader* reader, CPU_State* state, Trace_Step* step)
+{
+  bool result = true;
+
+  Trace_Signature* body = &reader->history[(reader->step_count - reader->run_period) % TRACE_HISTORY_SIZE];
+
+  *step = (Trace_Step){ .length = body->length, .ip = state->ip, .clocks = body->clocks };
+  memcpy(step->bytes, body->bytes, body->length);
+
+  state->ip += body->length + body->jump;
+  for (u32 i = 0; i < REGISTER_COUNT; ++i) state->register_file[i] += body->register_deltas[i];
+  if (body->sets_flags) state->flags = body->flags;
+
+  if (reader->patches_remaining != 0 && reader->steps_to_patch == 0)
+  {
+    u64 mask, miss;
+    result = Trace__GetVarint(reader, &mask);
+    for (u32 i = 0; i < REGISTER_COUNT + 1 && result; ++i)
+    {
+      if (mask & (1 << i))
+      {
+        result = Trace__GetVarint(reader, &miss);
+        if (i < REGISTER_COUNT) state->register_file[i] ^= (u16)miss;
+        else                    state->flags            ^= (u16)miss;
+      }
+    }
+
+    reader->patches_remaining -= 1;
+    if (result && reader->patches_remaining != 0) result = Trace__GetVarint(reader, &reader->steps_to_patch);
+  }
+  else if (reader->patches_remaining != 0) reader->steps_to_patch -= 1;
+
+  reader->run_remaining -= 1;
+
+  return result;
+}
+
+bool
+Trace__ReadLiteral(Trace_Reader* reader, CPU_State* state, Trace_Step* step)
+{
+  u8 tag = reader->data[reader->at++];
+
+  *step = (Trace_Step){ .length = tag & TraceTag_LengthMask, .ip = state->ip };
+  if (step->length == 0 && reader->at < reader->size) step->length = reader->data[reader->at++];
+
+  bool result = (step->length != 0 && step->length <= sizeof(step->bytes) && reader->size - reader->at >= step->length);
+  if (result)
+  {
+    memcpy(step->bytes, reader->data + reader->at, step->length);
+    reader->at += step->length;
+  }
+
+  state->ip += step->length;
+
+  u64 value;
+  if (result && (tag & TraceTag_Jump))
+  {
+    result = Trace__GetVarint(reader, &value);
+    state->ip += (u32)((value >> 1) ^ -(value & 1));
+  }
+
+  if (result && (tag & TraceTag_Registers))
+  {
+    result = Trace__GetVarint(reader, &value);
+    for (u32 i = 0; i < REGISTER_COUNT && result; ++i)
+    {
+      if (value & (1 << i)) result = Trace__GetU16(reader, &state->register_file[i]);
+    }
+  }
+
+  if (result && (tag & TraceTag_Flags)) result = Trace__GetU16(reader, &state->flags);
+
+  if (result && reader->header.kind == TraceKind_Estimate)
+  {
+    step->clocks.has_ea = !!(tag & TraceTag_EA);
+
+    result = Trace__GetVarint(reader, &value), step->clocks.base = value;
+    if (result && (tag & TraceTag_EA))      result = Trace__GetVarint(reader, &value), step->clocks.ea = value;
+    if (result && (tag & TraceTag_Penalty)) result = Trace__GetVarint(reader, &value), step->clocks.penalty = value;
+    if (result && (tag & TraceTag_Penalty)) result = Trace__GetVarint(reader, &value), step->clocks.fetch   = value;
+    if (result && (tag & TraceTag_Penalty)) result = Trace__GetVarint(reader, &value), step->clocks.wait    = value;
+  }
+
+  return result;
+}
+
+// NOTE: Advances state past the next step. Returns false at the end of the trace, or on a truncated record.
+bool
+Trace_ReadStep(Trace_Reader* reader, CPU_State* state, Trace_Step* step)
+{
+  bool result = false;
+
+  u16 old_registers[REGISTER_COUNT];
+  u16 old_flags = state->flags;
+  memcpy(old_registers, state->register_file, sizeof(old_registers));
+
+  bool is_repeat = (reader->size - reader->at >= 2 && reader->data[reader->at] == 0 && reader->data[reader->at + 1] == 0);
+
+  if      (reader->run_remaining != 0)              result = Trace__ReplayStep(reader, state, step);
+  else if (is_repeat && Trace__BeginRun(reader))    result = Trace__ReplayStep(reader, state, step);
+  else if (!is_repeat && reader->at < reader->size) result = Trace__ReadLiteral(reader, state, step);
+
+  if (result)
+  {
+    reader->history[reader->step_count % TRACE_HISTORY_SIZE] = Trace__Sign(old_registers, old_flags, state, step->bytes, step->length, step->ip, step->clocks);
+    reader->step_count += 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,10 @@
+@echo off
+
+nasm %~dpn1.asm
+call build >nul
+build\execute.exe --checkpoint %~dpn1.checkpoint --checkpoint-on-hlt %~dpn1 > nul
+build\execute.exe --restore %~dpn1.checkpoint > %~dpn1_out.txt
+fc %~dpn1_out.txt %~dpn1.txt
+del %~dpn1
+del %~dpn1.checkpoint
+del %~dpn1_out.txt
@@ -0,0 +1,31 @@
+; ========================================================================
+; CHECKPOINT AND RESTORE
+; ========================================================================
+; Run to the first hlt with --checkpoint-on-hlt, the .txt is the run restored from there:
+; test_checkpoint test_checkpoint_resume.asm
+
+bits 16
+
+; Registers, segment registers, flags, the stack and memory in pages far apart
+mov ax, 0x1234
+mov word [0x600], 0x5678
+mov sp, 0x2000
+push ax
+mov cx, 0x9000
+mov ds, cx
+mov word [0x10], 0x9abc
+mov dx, 1
+sub dx, 2
+hlt
+
+; Everything from here on only sees what the checkpoint kept
+jb carry_kept
+hlt
+carry_kept:
+pop si
+mov di, [0x10]
+mov cx, 0
+mov ds, cx
+mov bp, [0x600]
+add ax, si
+hlt
@@ -0,0 +1,66 @@
+; ========================================================================
+; MUL, IMUL, DIV AND IDIV CLOCKS
+; ========================================================================
+
+bits 16
+
+; The interrupt vector table starts at 0, jump over the divide error vector
+jmp start
+times 2 db 0
+
+start:
+mov word [0], divide_error
+mov word [2], 0
+mov sp, 0x1000
+
+; Multiplies take longer the more bits are set in the multiplier, using its magnitude when signed
+mov al, 5
+mov cl, 0
+mul cl
+mov ax, 1000
+mov cx, 100
+mul cx
+mov ax, 1000
+mov cx, 0xffff
+mul cx
+mov al, 3
+mov cl, -1
+imul cl
+mov ax, 3
+mov cx, -32768
+imul cx
+mov word [0x600], 7
+mov ax, 50
+mul word [0x600]
+mov word [0x603], 7
+imul word [0x603]
+
+; Divides take longer the more bits are set in the quotient
+mov ax, 600
+mov bl, 7
+div bl
+mov ax, 255
+mov bl, 1
+div bl
+mov dx, 0
+mov ax, 50000
+mov cx, 7
+div cx
+mov dx, -1
+mov ax, -200
+mov cx, 3
+idiv cx
+
+; A divide error adds the interrupt it raises, also when the quotient is too large for the host
+mov ax, 10
+mov cl, 0
+div cl
+mov dx, 0x8000
+mov ax, 0
+mov cx, -1
+idiv cx
+
+hlt
+
+divide_error:
+iret
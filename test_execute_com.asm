@@ -0,0 +1,21 @@
+; ========================================================================
+; .COM PROGRAM
+; ========================================================================
+; Run with --format com: test_execute test_execute_com.asm --format com
+
+bits 16
+org 0x100
+
+; The image starts at psp:0x100, with every segment register at the PSP and sp at the top of the segment
+mov bx, [0x02]
+mov al, [0x80]
+mov ah, [0x81]
+mov cx, [value]
+mov dx, sp
+mov si, cs
+
+; A near ret pops the 0 the loader left at the top of the stack, which is the int 20h at psp:0, outside the image
+ret
+
+value:
+dw 0x1234
@@ -0,0 +1,52 @@
+; ========================================================================
+; MZ .EXE PROGRAM
+; ========================================================================
+
+bits 16
+
+; Header of 3 paragraphs, the two relocations follow its fixed part
+header:
+db 'MZ'
+dw (file_end - header) % 512
+dw (file_end - header + 511) / 512
+dw 2
+dw 3
+dw 0
+dw 0xffff
+dw 3
+dw 0x40
+dw 0
+dw start - module
+dw 0
+dw relocations - header
+dw 0
+
+relocations:
+dw data_fixup - module, 0
+dw far_fixup - module, 0
+
+times 0x30 - ($ - $$) db 0
+
+; Load module, paragraph 0 is code, 2 is data, 3 the stack and 7 more code. The entry point isn't at its start.
+module:
+hlt
+
+start:
+mov ax, 2
+data_fixup equ $ - 2
+mov ds, ax
+mov bx, [0]
+mov cx, ss
+mov dx, sp
+mov di, es
+jmp 7:0
+far_fixup equ $ - 2
+
+times 0x20 - ($ - module) db 0
+dw 0x5678
+
+times 0x70 - ($ - module) db 0
+mov si, cs
+hlt
+
+file_end:
@@ -0,0 +1,92 @@
+; ========================================================================
+; MUL, IMUL, DIV AND IDIV
+; ========================================================================
+
+bits 16
+
+; The interrupt vector table starts at 0, jump over the divide error vector
+jmp start
+times 2 db 0
+
+start:
+mov word [0], divide_error
+mov word [2], 0
+mov sp, 0x1000
+
+; Byte multiplies, CF and OF are set when ah is significant
+mov ax, 200
+mov bl, 3
+mul bl
+mov ax, 100
+mov bl, 2
+mul bl
+mov ax, -7
+mov bl, 3
+imul bl
+mov al, 100
+mov bl, 2
+imul bl
+
+; Word multiplies, CF and OF are set when dx is significant
+mov ax, 1000
+mov cx, 1000
+mul cx
+mov ax, -300
+mov cx, 100
+imul cx
+mov ax, -300
+mov cx, 200
+imul cx
+mov word [0x600], 7
+mov ax, 50
+mul word [0x600]
+
+; Byte divides, the quotient goes to al and the remainder to ah
+mov ax, 600
+mov bl, 7
+div bl
+mov ax, -7
+mov bl, 3
+idiv bl
+mov ax, 100
+mov bl, -7
+idiv bl
+
+; Word divides, the quotient goes to ax and the remainder to dx
+mov dx, 1
+mov ax, 0x86a0
+mov cx, 1000
+div cx
+mov dx, -1
+mov ax, -200
+mov cx, 3
+idiv cx
+mov word [0x602], -10
+mov dx, 0
+mov ax, 1000
+idiv word [0x602]
+
+; Divide errors: a zero divisor, a quotient that doesn't fit, -128, which the 8086's idiv doesn't produce, and the
+; most negative dividend by -1
+mov ax, 10
+mov cl, 0
+div cl
+mov ax, 1000
+mov bl, 2
+div bl
+mov ax, -256
+mov bl, 2
+idiv bl
+mov dx, 0x8000
+mov ax, 0
+mov cx, -1
+idiv cx
+
+hlt
+
+; Counts the errors in di and checks the return address is past the divide
+divide_error:
+add di, 1
+pop si
+push si
+iret
@@ -0,0 +1,100 @@
+; ========================================================================
+; PUSH, POP, CALL, RET, INT AND IRET
+; ========================================================================
+
+bits 16
+
+; The interrupt vector table starts at 0, jump over the vectors that are used
+jmp start
+times 22 db 0
+
+start:
+mov sp, 0x1000
+mov word [0x0c], breakpoint
+mov word [0x0e], 0
+mov word [0x10], overflow
+mov word [0x12], 0
+mov word [0x14], service
+mov word [0x16], 0
+
+; Registers, segment registers, memory and flags
+mov ax, 0x1234
+push ax
+pop bx
+mov cx, 0x2000
+mov es, cx
+push es
+pop ds
+push cs
+pop ds
+mov word [0x600], 0x5678
+push word [0x600]
+pop word [0x602]
+mov dx, [0x602]
+push sp
+pop si
+mov ax, 1
+sub ax, 2
+pushf
+add ax, 1
+popf
+
+; Near calls, direct, through a register and through memory, and ret dropping an argument
+mov ax, 0
+call add_one
+mov bx, add_one
+call bx
+mov word [0x604], add_one
+call word [0x604]
+push ax
+call drop_argument
+
+; Far calls, direct and through memory
+call 0:far_add_one
+mov word [0x608], far_add_one
+mov word [0x60a], 0
+call far [0x608]
+
+; Jumps through a register and far
+mov bx, near_target
+jmp bx
+hlt
+near_target:
+jmp 0:far_target
+hlt
+far_target:
+
+; Interrupts, into only when OF is set
+int 5
+int3
+mov ax, 0x7fff
+add ax, 1
+into
+mov ax, 1
+add ax, 1
+into
+
+hlt
+
+add_one:
+add ax, 1
+ret
+
+drop_argument:
+ret 2
+
+far_add_one:
+add ax, 1
+retf
+
+service:
+mov dx, 5
+iret
+
+breakpoint:
+mov dx, 3
+iret
+
+overflow:
+mov dx, 4
+iret
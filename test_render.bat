@@ -0,0 +1,10 @@
+@echo off
+
+nasm %~dpn1.asm
+call build >nul
+build\execute.exe --binary-trace %~dpn1.trace %~dpn1 > nul
+build\render.exe %~dpn1.trace > %~dpn1_out.txt
+fc %~dpn1_out.txt %~dpn1.txt
+del %~dpn1
+del %~dpn1.trace
+del %~dpn1_out.txt
@@ -0,0 +1,43 @@
+; ========================================================================
+; LOOPS IN THE BINARY TRACE
+; ========================================================================
+; render turns the binary trace of execute back into its text trace: test_render test_render_loops.asm
+
+bits 16
+
+; A loop whose iterations replay exactly
+mov cx, 20
+mov bx, 0x600
+store:
+mov word [bx], cx
+add bx, 2
+loop store
+
+; A loop whose flags and branches only sometimes repeat the iteration before
+mov cx, 40
+mov ax, 0
+mov dx, 0
+mixed:
+add ax, cx
+cmp ax, 100
+jb below
+sub ax, 90
+add dx, 3
+below:
+loop mixed
+
+; Nested loops, the outer one is longer than the inner
+mov si, 5
+outer:
+mov cx, 6
+inner:
+add di, si
+loop inner
+sub si, 1
+jne outer
+
+; An instruction longer than 16 bytes, from a run of redundant segment prefixes
+db 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26
+mov word [bx], ax
+
+hlt